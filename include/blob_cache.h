@@ -0,0 +1,101 @@
+#ifndef _BLOB_CACHE_H_
+#define _BLOB_CACHE_H_ 1
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex.h>
+#include <stdint.h>
+#include <uncopyable.h>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    /**
+     * A bounded in-memory cache of objects already read, decrypted
+     * and verified, for HeapFileT::getBlob() to hand out again w/o
+     * going to the file.  Entries are looked up by ObjectId (as
+     * stored, i.e. encrypted) and its hash, which is the key() of the
+     * Record of its Blob, so anything that knows only the Record can
+     * still invalidate it.
+     *
+     * It's split into shards by hash, each w/ its own lock, its own
+     * least-recently-used list, and an even share of the capacity.
+     * Capacity counts the bytes of the ObjectIds and objects held; an
+     * object too big for a shard isn't cached at all.  Entries hold
+     * copies only, never the Record itself, so one that outlives its
+     * Blob is stale but never dangling.
+     */
+    class BlobCache : private Uncopyable {
+    public:
+      struct Stats {
+	Stats() : hits(0), misses(0), bytes(0), entries(0), evictions(0) {}
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bytes;     // of ObjectIds and objects held now
+	uint64_t entries;   // held now
+	uint64_t evictions; // to stay under capacity
+      };
+
+      explicit BlobCache(std::size_t capacity, unsigned numShards = 16);
+      ~BlobCache();
+
+      /**
+       * Copies the object cached under _id_ into _value_.  An object
+       * that expired by _now_ (see Record::expiry()) is a miss, and
+       * it's dropped.
+       */
+      bool get(const uint8_t *id, std::size_t idSize, uint32_t hashCode,
+	       uint64_t now, std::vector<uint8_t> &value);
+
+      /**
+       * Caches a copy of _value_ under _id_, along w/ the _expiry_ of
+       * its Blob, replacing whatever's there and making room by
+       * dropping the least recently used.
+       */
+      void put(const uint8_t *id, std::size_t idSize, uint32_t hashCode,
+	       const uint8_t *value, std::size_t size, uint64_t expiry);
+
+      /**
+       * Drops every object whose ObjectId hashes to _hashCode_.
+       */
+      void invalidate(uint32_t hashCode);
+      void clear();
+
+      std::size_t capacity() const { return m_capacity; }
+      Stats stats() const;
+
+    private:
+      struct Entry {
+	std::vector<uint8_t> id;
+	std::vector<uint8_t> value;
+	uint64_t expiry;
+	uint32_t hashCode;
+      };
+
+      typedef std::list<Entry> Lru; // most recently used first
+      typedef std::multimap<uint32_t, Lru::iterator> Lookup;
+
+      struct Shard {
+	Shard() : mutex(), lru(), lookup(), stats() {}
+
+	ThreadUtils::Mutex mutex;
+	Lru lru;
+	Lookup lookup;
+	Stats stats;
+      };
+
+      Shard &shardFor(uint32_t hashCode);
+      void erase(Shard &shard, Lookup::iterator itr);
+
+      std::size_t m_capacity;
+      std::size_t m_shardCapacity;
+      std::vector<Shard *> m_shards;
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _BLOB_CACHE_H_
@@ -0,0 +1,74 @@
+#ifndef _FREQUENCY_SKETCH_H_
+#define _FREQUENCY_SKETCH_H_ 1
+
+#include <cstddef>
+#include <stdint.h>
+#include <uncopyable.h>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    /**
+     * A count-min sketch of how often keys (the hashes of ObjectIds,
+     * see Record::key()) have been seen lately, for deciding which of
+     * two Blobs is worth keeping (TinyLFU).  Each key has a 4-bit
+     * counter in each of DEPTH rows; its frequency is the smallest of
+     * them, which can overestimate but never underestimates.
+     *
+     * So that old popularity fades, every counter is halved once there
+     * have been as many increments as there are counters per row.
+     *
+     * increment() and frequency() may be called from any number of
+     * threads at once; clear() may not.
+     */
+    class FrequencySketch : private Uncopyable {
+    public:
+      /**
+       * Rows of counters per key.
+       */
+      static const unsigned DEPTH = 4;
+
+      /**
+       * The most a counter counts to.
+       */
+      static const uint32_t MAX_FREQUENCY = 15;
+
+      /**
+       * Takes no more than _memory_ bytes for its counters (but at
+       * least one 64-bit word a row), rounded down to a power of two.
+       */
+      explicit FrequencySketch(std::size_t memory);
+
+      void increment(uint32_t key);
+      uint32_t frequency(uint32_t key) const;
+
+      /**
+       * Forgets everything.
+       */
+      void clear();
+
+      /**
+       * Bytes taken by the counters.
+       */
+      std::size_t memoryUsage() const { return m_table.size() * sizeof(uint64_t); }
+
+      /**
+       * How many times the counters have been halved.
+       */
+      uint64_t numAgings() const { return m_numAgings; }
+
+    private:
+      std::size_t counterFor(uint32_t key, unsigned row) const;
+      void age();
+
+      std::vector<uint64_t> m_table; // DEPTH rows of 16 counters a word
+      std::size_t m_rowMask;         // counters per row, less one
+      uint64_t m_numIncrements;      // since the last aging
+      uint64_t m_numAgings;
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _FREQUENCY_SKETCH_H_
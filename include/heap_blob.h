@@ -1,6 +1,7 @@
 #ifndef _HEAP_BLOB_H_
 #define _HEAP_BLOB_H_ 1
 
+#include <cstddef>
 #include <stdint.h>
 #include <vector>
 
@@ -19,6 +20,30 @@ namespace FileUtils {
       virtual void writeBlob(uint8_t *dest) const = 0;
     };
 
+    /**
+     * A BlobWriter that encrypts _size_ bytes at _data_ on their way
+     * into the Blob, w/ _key_, an EncryptionPolicy.
+     */
+    template<class EncryptionPolicy>
+    class EncryptingWriter : public BlobWriter {
+    public:
+      EncryptingWriter(const uint8_t *data, std::size_t size,
+		       const EncryptionPolicy &key)
+	: m_data(data), m_size(size), m_key(key)
+      {}
+
+      virtual uint32_t size() const { return m_size; }
+      virtual void writeBlob(uint8_t *dest) const
+      {
+	m_key.encrypt(m_data, dest, m_size);
+      }
+
+    private:
+      const uint8_t *m_data;
+      std::size_t m_size;
+      const EncryptionPolicy &m_key;
+    };
+
     /**
      * An interface for reading data from a Blob object
      */
@@ -27,6 +52,44 @@ namespace FileUtils {
       virtual void readBlob(uint32_t size, const uint8_t *src) const = 0;
     };
 
+    /**
+     * A view of an Object right where it's stored in an MmapFile, so
+     * reading it takes no copy.  The MmapFile stays pinned (see
+     * MmapFile::pin()) as long as the view or any copy of it lives,
+     * which keeps the pointer good no matter what else is read in the
+     * meantime.  It does not keep the Object from being erased or
+     * overwritten, though.  The hash of the Object is only checked
+     * when you call verify().
+     */
+    class BlobView
+    {
+    public:
+      BlobView();
+      BlobView(const MmapFile &file, const uint8_t *data,
+	       uint32_t size, uint32_t hashCode);
+      BlobView(const BlobView &v);
+      BlobView &operator=(const BlobView &v);
+      ~BlobView();
+
+      bool isNil() const          { return NULL == m_data; }
+      const uint8_t *data() const { return m_data; }
+      uint32_t size() const       { return m_size; }
+
+      /**
+       * Does the Object still hash to what was stored along with it?
+       * A nil view doesn't verify.
+       */
+      bool verify() const;
+
+    private:
+      void release();
+
+      const MmapFile *m_file;
+      const uint8_t *m_data;
+      uint32_t m_size;
+      uint32_t m_hash;
+    };
+
     /**
      * This class encapsulates the layout of how the ObjectId and
      * and the Object are stored.
@@ -39,6 +102,11 @@ namespace FileUtils {
     class Blob
     {
     public:
+      /**
+       * The longest ObjectId a Blob can store, in bytes.
+       */
+      static const std::size_t MAX_ID_SIZE = 255;
+
       Blob();
       Blob(uint8_t *p, const Record &r);
       Blob(const Record &r, const MmapFile &file);
@@ -51,8 +119,15 @@ namespace FileUtils {
       /**
        * Compares the ObjectId passed in with the one stored here.
        */
+      bool hasId(const uint8_t *id, std::size_t idSize) const;
       bool hasId(const std::vector<uint8_t> &id) const;
 
+      /**
+       * Copies the ObjectId stored here into _id_.  Returns false if
+       * the Blob is nil or its sizes don't add up.
+       */
+      bool getId(std::vector<uint8_t> &id) const;
+
       /**
        * Read the object stored by this Blob.  Returns true
        * on success.  By abstracting away the reading into
@@ -64,6 +139,15 @@ namespace FileUtils {
        */
       bool getData(const BlobReader &reader) const;
 
+      /**
+       * Points _view_ at the Object stored by this Blob in _file_,
+       * which must be the file this Blob was read from.  Unlike
+       * getData(), the hash of the Object is left for
+       * BlobView::verify() to check.  Returns false, leaving _view_
+       * alone, if the Blob is nil or its sizes don't add up.
+       */
+      bool getView(const MmapFile &file, BlobView &view) const;
+
       /**
        * Returns a reference to an object with all of this Blob's
        * metadata--it's size in bytes, the hash code of the ObjectId
@@ -81,6 +165,8 @@ namespace FileUtils {
        * the available space in this Blob, then it will return false;
        * Returns true on sucess.
        */
+      bool writeData(const uint8_t *id, std::size_t idSize,
+		     const BlobWriter &writer);
       bool writeData(const std::vector<uint8_t> &id,
 		     const BlobWriter &writer);
 
@@ -92,6 +178,8 @@ namespace FileUtils {
       static uint32_t blobSize(size_t keySize, size_t dataSize);
 
     private:
+      const uint8_t *findData(uint32_t &size, uint32_t &hashCode) const;
+
       const Record &m_rec;
       const uint8_t * const m_ptr;
     };
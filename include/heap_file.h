@@ -1,17 +1,88 @@
 #ifndef _HEAP_FILE_H_
 #define _HEAP_FILE_H_ 1
 
+#include <blob_cache.h>
+#include <heap_blob.h>
 #include <heap_file_fwd.h>
+#include <cstddef>
+#include <frequency_sketch.h>
 #include <heap_index.h>
+#include <map>
 #include <mmap_file.h>
+#include <memory>
+#include <mutex.h>
+#include <pthread.h>
 #include <simple_encrypt.h>
 #include <stdint.h>
+#include <timer_wheel.h>
 #include <uncopyable.h>
+#include <utility>
 #include <vector>
+#include <write_ahead_log.h>
 
 namespace FileUtils {
   namespace StructuredFiles {
 
+    /**
+     * An interface for taking the objects found by
+     * HeapFileT::getBlobs().  _i_ is the position of the ObjectId in
+     * the batch, and _blob_ is only good for the duration of the call.
+     */
+    class MultiBlobReader {
+    public:
+      virtual void readBlob(std::size_t i, const uint8_t *blob,
+			    std::size_t size) const = 0;
+    };
+
+    /**
+     * Writes and erasures staged for HeapFileT::commit(), which applies
+     * them all or none of them.  Staging copies the ObjectIds and the
+     * objects.  Whatever was staged last for an ObjectId is what's
+     * committed for it.
+     */
+    class WriteBatch {
+    public:
+      WriteBatch() : m_ops() {}
+
+      void writeBlob(const uint8_t *id, std::size_t idSize,
+		     const uint8_t *blob, std::size_t blobSize,
+		     uint64_t expiry = 0);
+      void writeBlob(const std::vector<uint8_t> &id,
+		     const std::vector<uint8_t> &blob, uint64_t expiry = 0) {
+	writeBlob(bytes(id), id.size(), bytes(blob), blob.size(), expiry);
+      }
+
+      void eraseBlob(const uint8_t *id, std::size_t idSize);
+      void eraseBlob(const std::vector<uint8_t> &id) {
+	eraseBlob(bytes(id), id.size());
+      }
+
+      /**
+       * The number of ObjectIds staged.
+       */
+      std::size_t size() const { return m_ops.size(); }
+      bool empty() const { return m_ops.empty(); }
+      void clear() { m_ops.clear(); }
+
+    private:
+      template <class> friend class HeapFileT;
+
+      static const uint8_t *bytes(const std::vector<uint8_t> &v) {
+	return v.empty() ? NULL : &v[0];
+      }
+
+      struct Op {
+	Op() : erase(false), blob(), expiry(0) {}
+
+	bool erase;
+	std::vector<uint8_t> blob;
+	uint64_t expiry;
+      };
+      typedef std::map<std::vector<uint8_t>, Op> Ops; // by ObjectId
+
+      Ops m_ops;
+    };
+
     /**
      * This class can be thought of as a hash table serialized
      * to disk.  It supports encryption by policy class.
@@ -30,12 +101,46 @@ namespace FileUtils {
      * but can easily be changed at some later date.
      * Providing the empty key is equivalent to using no encryption.
      * This is because (A^0 == A).
+     *
+     * Threads: every call into a HeapFile takes a read-write lock.
+     * Writes, erasures and everything else that changes the HeapFile
+     * take it exclusively.  hasBlob(), getBlob(), getBlobs() and
+     * getBlobView() share it w/ each other, so any number of threads
+     * can read at once, when the file is mapped w/
+     * MmapFile::Options::WHOLE_FILE.  Under the other mappings reading
+     * maps and unmaps windows of the file, so they take the lock
+     * exclusively too.  What readers do share is thread-safe:
+     * the cache has a lock per shard, the admission filter counts w/
+     * atomic operations, and all they write to a Record is its
+     * reference bit, which they only ever set.
+     *
+     * Persistence: the index is kept in memory while the HeapFile is
+     * open.  It's written to the file only by commit() and the
+     * destructor, to a place of its own, and the header at the front
+     * of the file is pointed at it once it's on disk.  The index the
+     * header points at is left alone until the next one is written, so
+     * the file always has a whole index in it.  Unless there's a
+     * write-ahead log (see setDurability()), writes outside of
+     * commit() aren't durable: after a crash the HeapFile opens as of
+     * the last commit.  Nor do they write over the Blobs that commit
+     * left in the file: one that's replaced or erased keeps its space
+     * until the index is committed again (compact() does that to get
+     * the space back), and only w/ a log is it replaced in place.
+     * Blobs evicted since (see setEviction()) read as misses.
      */
     template <class EncryptionPolicy = DefaultEncryptionPolicy>
     class HeapFileT : private Uncopyable {
     public:
+      /**
+       * _fileOptions_ say how the file is mapped into memory (see
+       * MmapFile).  A HeapFile opened with MmapFile::Options::readOnly
+       * set can be opened by any number of readers at once.  It never
+       * writes the index back out when it's destroyed, and writeBlob(),
+       * eraseBlob(), clear() and setMaxSize() throw a std::runtime_error.
+       */
       HeapFileT(const std::string &path, 
-		const std::vector<uint8_t> &encryptionKey = std::vector<uint8_t>());
+		const std::vector<uint8_t> &encryptionKey = std::vector<uint8_t>(),
+		const MmapFile::Options &fileOptions = MmapFile::Options());
       ~HeapFileT();
 
       const HeapIndex &getIndex() const { return m_index; }
@@ -43,21 +148,67 @@ namespace FileUtils {
       /**
        * HeapFile size on disk in bytes.
        */
-      uint64_t size() const { return m_file.size(); }
+      uint64_t size() const;
+
+      bool isReadOnly() const { return m_file.isReadOnly(); }
+
+      /**
+       * Every function taking an ObjectId or an object comes in two
+       * flavours: one taking vectors and one taking a pointer and a
+       * length, for callers whose bytes live somewhere else.  Neither
+       * copies the ObjectId to the heap, so looking up a Blob takes no
+       * allocations.  ObjectIds longer than Blob::MAX_ID_SIZE bytes
+       * can't be stored and are never found.
+       */
 
       /**
        * Existence test.  Will actually read from disk to compare
        * the object id stored to the one passed in.
        */
-      bool hasBlob(const std::vector<uint8_t> &id) const;
+      bool hasBlob(const uint8_t *id, std::size_t idSize) const;
+      bool hasBlob(const std::vector<uint8_t> &id) const {
+	return hasBlob(bytes(id), id.size());
+      }
 
       /**
        * Returns true if the data appears to not be corrupt
        * and is successfully read.  Returns false on failure.
        * It is not erased from the heap file on failure, however.
        */
-      bool getBlob(const std::vector<uint8_t> &id, 
+      bool getBlob(const uint8_t *id, std::size_t idSize,
 		   std::vector<uint8_t> &blob) const;
+      bool getBlob(const std::vector<uint8_t> &id, 
+		   std::vector<uint8_t> &blob) const {
+	return getBlob(bytes(id), id.size(), blob);
+      }
+
+      /**
+       * getBlob() for a whole batch of ObjectIds at once.  Every
+       * ObjectId is looked up in the index before anything is read.
+       * The hits are then sorted by where they are in the file, the
+       * kernel is told to start paging them in (MmapFile::willNeed()),
+       * and they're read in file order, each one going to _reader_.
+       * That way the cost of a batch follows the number of pages it
+       * touches rather than the number of ObjectIds in it.  _found_
+       * ends up with what getBlob() would have returned for each
+       * ObjectId; the number found is returned.
+       */
+      std::size_t getBlobs(const std::vector<std::vector<uint8_t> > &ids,
+			   const MultiBlobReader &reader,
+			   std::vector<bool> &found) const;
+
+      /**
+       * Like getBlob(), but rather than copying the object out it
+       * points _view_ at it in the mapped file (see BlobView).  The
+       * hash of the object is only checked by BlobView::verify().
+       * The object must not need decrypting, so this throws a
+       * std::runtime_error unless the encryption key is the identity.
+       */
+      bool getBlobView(const uint8_t *id, std::size_t idSize,
+		       BlobView &view) const;
+      bool getBlobView(const std::vector<uint8_t> &id, BlobView &view) const {
+	return getBlobView(bytes(id), id.size(), view);
+      }
 
       /**
        * Returns true if the object mapped to by the ObjectId
@@ -67,20 +218,137 @@ namespace FileUtils {
        * case the file is truncated to its actual size.  Erasures
        * from the middle of the file are practically free.
        */
-      bool eraseBlob(const std::vector<uint8_t> &id);
+      bool eraseBlob(const uint8_t *id, std::size_t idSize);
+      bool eraseBlob(const std::vector<uint8_t> &id) {
+	return eraseBlob(bytes(id), id.size());
+      }
 
       /**
-       * Will call eraseBlob on the ObjectId passed in first.
-       * Then it will write the new object, growing the heap file
-       * as necessary.
+       * Replaces whatever is stored under the ObjectId.  If the new
+       * object fits where the old one was without wasting much space
+       * (see HeapIndex::isGoodFit()), it is overwritten in place,
+       * leaving the index and the file size alone.  Otherwise the old
+       * one is erased and the new one is written elsewhere, growing the
+       * heap file as necessary.
+       *
+       * A nonzero _expiry_, in seconds since the epoch (as in time(2)),
+       * is when the object goes stale.  From then on it's a miss to
+       * hasBlob(), getBlob() and the rest, and expireBlobs() frees the
+       * space it takes up.  Expiries are stored in the file along w/
+       * the index.
        */
+      bool writeBlob(const uint8_t *id, std::size_t idSize,
+		     const uint8_t *blob, std::size_t blobSize,
+		     uint64_t expiry = 0);
       bool writeBlob(const std::vector<uint8_t> &id,
-		     const std::vector<uint8_t> &blob);
+		     const std::vector<uint8_t> &blob, uint64_t expiry = 0) {
+	return writeBlob(bytes(id), id.size(), bytes(blob), blob.size(), expiry);
+      }
+
+      /**
+       * (ObjectId, object) pairs for writeBlobs().
+       */
+      typedef std::vector<std::pair<std::vector<uint8_t>, 
+				    std::vector<uint8_t> > > Batch;
+
+      /**
+       * writeBlob() for a whole batch of objects at once.  Whatever
+       * fits in the file as it is gets written first; everything else
+       * is laid out end to end past the last Blob, the file grows once
+       * to make room for all of it, and those objects are copied in
+       * one after the other through a single mapping.  If that would
+       * make the file bigger than setMaxSize() allows, objects are left
+       * out from the end of the batch until it doesn't.  An ObjectId
+       * in the batch more than once ends up with the last of its
+       * objects.  _written_ ends up with what writeBlob() would have
+       * returned for each pair; the number written is returned.  None
+       * of them expire.
+       */
+      std::size_t writeBlobs(const Batch &batch, std::vector<bool> &written);
+
+      /**
+       * Applies every write and erasure in _batch_ at once, as
+       * writeBlob() and eraseBlob() would, and makes them durable.
+       * Room is made for all of the objects and they're written to disk
+       * before anything they replace is let go, and then the index is
+       * committed: written to the file, synced, and published by
+       * pointing the header at it, which is synced again.  That's two
+       * syncs however big the batch is.  A crash before the header is
+       * written leaves the HeapFile as of the commit before, w/ none
+       * of the batch in it.
+       *
+       * Objects are never overwritten in place, and while the batch is
+       * applied nothing can be evicted (as w/ a Snapshot open).  If
+       * there isn't room for every object, or an ObjectId is too long,
+       * nothing is changed and false is returned.
+       */
+      bool commit(const WriteBatch &batch);
+
+      /**
+       * Erases every Blob that has expired (see writeBlob()).  They're
+       * found on a timer wheel (see TimerWheel) rather than by going
+       * through the index, so it costs about as much as the number of
+       * Blobs that expired since the last call.  Returns that number.
+       * The maintenance thread calls it too.
+       */
+      std::size_t expireBlobs();
+
       /**
        * Clears the state of the HeapFile...file, index and all.
        */
       void clear();
 
+      /**
+       * What gives when a write would make the file bigger than
+       * setMaxSize() allows.
+       *
+       * EVICT_TAIL refuses the write, and setMaxSize() drops Blobs
+       * from the end of the file, used or not.
+       *
+       * EVICT_CLOCK treats the file as a cache.  Every Blob has a
+       * reference bit (Record::isReferenced()) that's set whenever it's
+       * looked up or written.  A clock hand sweeps over the allocated
+       * Records, clearing the bits it finds set and evicting the first
+       * Blob whose bit is clear, until the write fits, either in the
+       * hole left behind or at the end of the file.  Whenever enough
+       * has been evicted, the file is compacted (see compact()) so it
+       * actually shrinks.  setMaxSize() evicts the same way.
+       */
+      enum Eviction {
+	EVICT_TAIL,
+	EVICT_CLOCK
+      };
+
+      void setEviction(Eviction eviction);
+
+      /**
+       * The number of Blobs EVICT_CLOCK has evicted so far.
+       */
+      uint64_t numEvictions() const;
+
+      /**
+       * Turns on an admission filter for EVICT_CLOCK (TinyLFU), which
+       * keeps a one-off write from pushing out a Blob that's in
+       * demand.  Every lookup and write counts the ObjectId in a
+       * FrequencySketch taking about _sketchMemory_ bytes.  When a write
+       * would have to evict a Blob, it's refused instead if its
+       * ObjectId hasn't been seen more often lately than the victim's.
+       * Zero, the default, turns it off.  Like the slab threshold, it's
+       * not stored in the file, and the counts start over every time
+       * it's set.
+       */
+      void setAdmission(std::size_t sketchMemory);
+
+      /**
+       * Bytes taken by the admission filter's counters, zero if it's off.
+       */
+      std::size_t admissionMemory() const;
+
+      /**
+       * The number of writes the admission filter has refused so far.
+       */
+      uint64_t numRejections() const;
+
       /**
        * When this function returns, the size of the HeapFile on
        * disk will be no larger than the maxSize.  This will be
@@ -89,15 +357,356 @@ namespace FileUtils {
        * effecient as we just call deallocate on the last allocated
        * Record until the metadata says we've made the cut--only
        * then do we truncate the file to the appropriate size.
+       * That's EVICT_TAIL; EVICT_CLOCK evicts Blobs that haven't been
+       * used lately instead (see setEviction()).
        */
       void setMaxSize(uint64_t maxSize);
 
+      /**
+       * What a call to compact() did.  Moved counts the bytes of Blobs
+       * copied to somewhere else in the file, reclaimed how much
+       * smaller the file got.
+       */
+      struct Compaction {
+	Compaction() : bytesMoved(0), bytesReclaimed(0) {}
+
+	uint64_t bytesMoved;
+	uint64_t bytesReclaimed;
+      };
+
+      /**
+       * Unlike setMaxSize(), shrinks the file w/o losing any Blobs.
+       * Blobs at the end of the file are moved into free space nearer
+       * the front, one at a time, and the file is truncated behind
+       * them.  No more than _budget_ bytes are moved per call, so it
+       * can be called over and over between other work until nothing
+       * more is moved.  It stops early once the last Blob has nowhere
+       * better to go.  When it's the index last committed (see commit())
+       * that's at the end of the file, it's moved by committing the
+       * index again nearer the front.  The places Blobs in that index
+       * leave behind, whether they're moved, replaced or erased, are
+       * only free once it's committed again, so compact() commits it
+       * when there are any, and goes on w/ the room that makes.
+       */
+      Compaction compact(uint64_t budget);
+
+      /**
+       * What the maintenance thread does and how hard it works.  It
+       * wakes up every _intervalMillis_ and, as long as nothing else
+       * used the HeapFile since the last time, does one pass of work
+       * w/o touching more than _bytesPerSecond_ worth of Blobs for the
+       * interval.  A pass runs expireBlobs() and compact() (unless the
+       * file is read-only), then checks the hashes of stored objects
+       * round-robin (scrub), then writes changed pages back to disk
+       * (flush).  It takes the lock for each of those in turn, and
+       * compact() goes a Blob at a time, so calls into the HeapFile
+       * aren't held up for a whole pass.
+       */
+      struct MaintenanceOptions {
+	MaintenanceOptions()
+	  : intervalMillis(100), bytesPerSecond(64 << 20),
+	    expire(true), compact(true), scrub(true), flush(true)
+	{}
+
+	unsigned intervalMillis;
+	uint64_t bytesPerSecond;
+	bool expire;
+	bool compact;
+	bool scrub;
+	bool flush;
+      };
+
+      /**
+       * What the maintenance thread has done since it was started.
+       * Passes count the wake-ups that did work, pauses the ones that
+       * didn't because the HeapFile was in use.  Corrupt Blobs are
+       * counted every time a scrub comes across them; they're left
+       * where they are.
+       */
+      struct MaintenanceStats {
+	MaintenanceStats()
+	  : passes(0), pauses(0), blobsExpired(0), bytesMoved(0),
+	    bytesReclaimed(0), bytesScrubbed(0), corruptBlobs(0), flushes(0),
+	    errors(0)
+	{}
+
+	uint64_t passes;
+	uint64_t pauses;
+	uint64_t blobsExpired;
+	uint64_t bytesMoved;
+	uint64_t bytesReclaimed;
+	uint64_t bytesScrubbed;
+	uint64_t corruptBlobs;
+	uint64_t flushes;
+	uint64_t errors;
+      };
+
+      /**
+       * Starts a thread that does maintenance in the background (see
+       * MaintenanceOptions), restarting it if it's running already.
+       * Each step of a pass has the HeapFile to itself, like a write
+       * (see the class comment on threads).  getIndex() takes no lock
+       * at all, so don't count on what it says while the thread runs.
+       * The thread is stopped by stopMaintenance() or the destructor.
+       */
+      void startMaintenance(const MaintenanceOptions &options = MaintenanceOptions());
+      void stopMaintenance();
+      bool isMaintenanceRunning() const;
+      MaintenanceStats maintenanceStats() const;
+
+      /**
+       * Does what the maintenance thread does when it wakes up, right
+       * away in the calling thread and w/ _options_ in place of the
+       * thread's: a pass, or a pause if the HeapFile was used since the
+       * last wake-up.  It counts in maintenanceStats(), which it
+       * returns, whether or not the thread runs.
+       */
+      MaintenanceStats maintainNow(const MaintenanceOptions &options = MaintenanceOptions());
+
+      /**
+       * Keeps up to _capacity_ bytes of objects read by getBlob() and
+       * getBlobs() in memory, decrypted and verified, split into
+       * _numShards_ shards (see BlobCache).  Reading them again takes
+       * neither the index nor the file, the hash nor the decryption.
+       * Anything that changes or drops a Blob drops it from the cache
+       * too: writes, erasures, evictions, expiries, compaction, clear()
+       * and setMaxSize().  Zero, the default, turns it off.  Setting it
+       * starts over w/ an empty cache.
+       */
+      void setCache(std::size_t capacity, unsigned numShards = 16);
+
+      typedef BlobCache::Stats CacheStats;
+
+      /**
+       * Hits, misses and bytes held by the cache.  All zeroes when it's
+       * off.
+       */
+      CacheStats cacheStats() const;
+
+      class Snapshot;
+
+      /**
+       * Takes a Snapshot of the HeapFile as it is now, for reading a
+       * consistent view of it for as long as it takes, an export say,
+       * w/o holding up writers.  Taking one copies the Records of the
+       * index, so it costs about as much as the number of Blobs.  The
+       * HeapFile must outlive its Snapshots.
+       *
+       * Snapshots pin an epoch of the HeapIndex (see HeapIndex::pin()).
+       * While any is open, the space of Blobs erased, rewritten,
+       * evicted or expired is retired rather than freed, so it isn't
+       * reused until every Snapshot older than that is released, and
+       * writeBlob() never overwrites a Blob in place.  Writes carry on
+       * as usual otherwise, w/ a few things put off while space can't
+       * be reclaimed: compact() does nothing, setMaxSize() only takes
+       * effect once the last Snapshot is released, EVICT_CLOCK refuses
+       * writes that would need an eviction, and clear() throws a
+       * std::runtime_error.
+       */
+      std::auto_ptr<Snapshot> snapshot();
+
+      /**
+       * How many bytes of retired Blobs open Snapshots keep from being
+       * reused.
+       */
+      uint64_t pinnedBytes() const;
+
+      /**
+       * Blobs that take up no more than _size_ bytes on disk, ObjectId
+       * and metadata included, will share 4K slabs with Blobs of about
+       * the same size instead of getting a 256 byte block each.  Zero,
+       * the default, turns this off.  It's not stored in the file, so
+       * set it again after reopening.
+       */
+      void setSlabThreshold(uint32_t size);
+
+      /**
+       * How writes outside of commit() survive a crash.  DURABLE_NONE,
+       * the default, leaves them to the next commit.  The others keep
+       * a write-ahead log of the changes to the index next to the file
+       * (its path w/ ".wal" on the end; see WriteAheadLog), which is
+       * replayed when the HeapFile is opened again.  W/ DURABLE_SYNC,
+       * writeBlob(), writeBlobs() and eraseBlob() return once what
+       * they did is on disk.  Threads writing at once share the
+       * fdatasync()s: whoever's first syncs for everyone who's written
+       * by then, outside of the lock.  W/ DURABLE_PERIODIC a thread
+       * syncs every _intervalMillis_ instead, so a crash loses no more
+       * than that much.
+       *
+       * The log is folded into the index once it gets bigger than the
+       * index (but not before it's 1MB), and when the HeapFile is
+       * destroyed, after which it's removed.  A write that hasn't
+       * returned yet when the process dies may lose the object it
+       * replaces as well as its own.  It's not stored in the file, so
+       * set it again after reopening, and not while other threads are
+       * writing.  Throws a std::runtime_error if the log can't be
+       * created, or the HeapFile is open read-only.
+       */
+      enum Durability { DURABLE_NONE, DURABLE_PERIODIC, DURABLE_SYNC };
+      void setDurability(Durability durability, unsigned intervalMillis = 100);
+      Durability durability() const;
+
+      /**
+       * The number of times the log has been synced, however many
+       * writes each one was for.
+       */
+      uint64_t numLogSyncs() const;
+
     private:
+      static const uint8_t *bytes(const std::vector<uint8_t> &v) {
+	return v.empty() ? NULL : &v[0];
+      }
+
+      friend class Snapshot;
+      void releaseSnapshot(uint64_t epoch);
+      void unpin(uint64_t epoch);
+      void shrinkToMaxSize();
+
+      bool applyBatch(const WriteBatch &batch);
+      bool commitIndex(bool onlyIfLower = false);
+
+      bool doWriteBlob(const uint8_t *id, std::size_t idSize,
+		       const uint8_t *blob, std::size_t blobSize,
+		       uint64_t expiry);
+      bool doEraseBlob(const uint8_t *id, std::size_t idSize);
+      std::size_t doWriteBlobs(const Batch &batch, std::vector<bool> &written);
+
+      uint64_t logChanges();
+      void syncLog(uint64_t position);
+      void resetLog();
+      void replayLog(uint64_t indexOffset, uint64_t indexSize);
+
+      enum Access { EXCLUSIVE, SHARED };
+
+      /**
+       * Holds m_lock for the duration of a call into the HeapFile and
+       * counts the call, which is how the maintenance thread tells the
+       * HeapFile is busy.  SHARED calls only share it w/ each other
+       * when reading can't map anything (see sharesReads()).
+       */
+      class Operation : private Uncopyable {
+      public:
+	explicit Operation(const HeapFileT &file, Access access = EXCLUSIVE)
+	  : m_lock(file.m_lock, SHARED == access and file.sharesReads()) {
+	  file.m_numOperations.increment();
+	}
+
+      private:
+	ThreadUtils::RWLockGuard m_lock;
+      };
+      friend class Operation;
+
+      bool sharesReads() const {
+	return MmapFile::Options::WHOLE_FILE == m_file.options().mapping;
+      }
+
+      const Record *grow(uint32_t blobSize, uint32_t hashCode);
+      const Record *clockVictim();
+      uint32_t evict(const Record &victim);
+      uint32_t evictOne();
+      void countAccess(uint32_t hashCode) const;
+      void reference(uint32_t hashCode) const;
+      void invalidate(uint32_t hashCode);
+      void invalidate(const Record &r);
+
+      static void *runMaintenance(void *heapFile);
+      void wakeUp(const MaintenanceOptions &options);
+      void maintain(const MaintenanceOptions &options);
+      Compaction doCompact(uint64_t budget,
+			   std::size_t maxMoves = std::size_t(-1));
+      std::size_t doExpire();
+      void doClear();
+
+      bool encryptId(const uint8_t *clearId, std::size_t idSize, 
+		     uint8_t *id) const;
+      void checkWritable() const;
+
       HeapIndex m_index;
       MmapFile m_file;
       EncryptionPolicy m_key;
       uint64_t m_maxSize;
+      Eviction m_eviction;
+      std::size_t m_clockHand; // a slot of allocRecords()
+      uint64_t m_numEvictions;
+      std::auto_ptr<FrequencySketch> m_sketch; // NULL w/o admission
+      uint64_t m_numRejections;
+      TimerWheel m_wheel; // of Blobs that expire
+      std::auto_ptr<BlobCache> m_cache; // NULL w/o a cache
+      Record *m_committed; // where the header points, NULL if nowhere yet
+      const std::string m_logPath;
+      Durability m_durability;
+      std::auto_ptr<WriteAheadLog> m_log; // NULL w/ DURABLE_NONE
+
+      mutable ThreadUtils::RWLock m_lock; // see Operation
+      mutable ThreadUtils::StripedCounter m_numOperations; // so readers don't share a line
+
+      // the maintenance thread, which m_mutex is for
+      mutable ThreadUtils::Mutex m_mutex;
+      pthread_t m_maintenanceThread;
+      bool m_isMaintenanceRunning;
+      bool m_stopMaintenance;
+      ThreadUtils::Condition m_maintenanceWakeUp;
+      MaintenanceOptions m_maintenanceOptions;
+      MaintenanceStats m_maintenanceStats;
+      uint64_t m_numOperationsSeen; // as of the last wake-up
+      std::size_t m_scrubSlot; // where the scrub left off in allocRecords()
     };
+
+    /**
+     * A point-in-time view of a HeapFile (see HeapFileT::snapshot()):
+     * every Blob that was in it then, as it was then, and none written
+     * since.  Released when it's destroyed.  Reading takes the lock of
+     * the HeapFile only for as long as each call, like the reads of
+     * the HeapFile itself.  Blobs that expire are misses from then on,
+     * as usual.
+     */
+    template <class EncryptionPolicy>
+    class HeapFileT<EncryptionPolicy>::Snapshot : private Uncopyable {
+    public:
+      ~Snapshot();
+
+      /**
+       * The epoch of the HeapIndex the Snapshot pins.
+       */
+      uint64_t epoch() const { return m_epoch; }
+
+      /**
+       * How many Blobs there were.
+       */
+      std::size_t numBlobs() const { return m_records.size(); }
+
+      bool hasBlob(const uint8_t *id, std::size_t idSize) const;
+      bool hasBlob(const std::vector<uint8_t> &id) const {
+	return hasBlob(bytes(id), id.size());
+      }
+
+      bool getBlob(const uint8_t *id, std::size_t idSize,
+		   std::vector<uint8_t> &blob) const;
+      bool getBlob(const std::vector<uint8_t> &id,
+		   std::vector<uint8_t> &blob) const {
+	return getBlob(bytes(id), id.size(), blob);
+      }
+
+      /**
+       * Reads the _i_th Blob, in file order, into _id_ and _blob_, for
+       * going through all of them.  Returns false if it's corrupt or
+       * has expired.
+       */
+      bool getBlobAt(std::size_t i, std::vector<uint8_t> &id,
+		     std::vector<uint8_t> &blob) const;
+
+    private:
+      friend class HeapFileT;
+      explicit Snapshot(HeapFileT &file);
+
+      const Record *findRecord(const uint8_t *id, std::size_t idSize) const;
+
+      HeapFileT &m_file;
+      uint64_t m_epoch;
+      std::vector<Record> m_records; // copies, by offset
+      std::vector<std::pair<uint32_t, uint32_t> > m_byKey; // key(), position
+    };
+
   } // end namespace StructuredFiles
 } // end namespace FileUtils
 
@@ -0,0 +1,100 @@
+#ifndef _HEAP_FILE_BUILDER_H_
+#define _HEAP_FILE_BUILDER_H_ 1
+
+#include <heap_file_fwd.h>
+#include <cstddef>
+#include <heap_index.h>
+#include <simple_encrypt.h>
+#include <stdint.h>
+#include <string>
+#include <uncopyable.h>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    /**
+     * Builds a HeapFile from scratch out of a stream of (ObjectId,
+     * object) pairs, much faster than writing them one at a time
+     * with HeapFileT::writeBlob().  The Blobs are laid out end to end
+     * in the order they're added, so there are no free Records, and
+     * they go to disk through a buffer w/ big sequential write(2)s
+     * rather than through mmap'ed windows.  finish() writes the index
+     * and the header after them; after that HeapFileT opens the file
+     * like any other.
+     *
+     * The ObjectIds have to be unique.  Nothing checks that they are;
+     * HeapFileT would find just one of the objects under an ObjectId
+     * added twice.  The file at _path_ is truncated to begin with, and
+     * until finish() returns it opens as an empty HeapFile.
+     */
+    template <class EncryptionPolicy = DefaultEncryptionPolicy>
+    class HeapFileBuilderT : private Uncopyable {
+    public:
+      /**
+       * _bufferSize_ is how many bytes are gathered up for each write.
+       * A Blob bigger than that gets a bigger buffer.
+       */
+      HeapFileBuilderT(const std::string &path,
+		       const std::vector<uint8_t> &encryptionKey = std::vector<uint8_t>(),
+		       std::size_t bufferSize = std::size_t(1) << 20);
+
+      /**
+       * Calls finish() if it hasn't been called yet.
+       */
+      ~HeapFileBuilderT();
+
+      /**
+       * Appends a Blob.  Returns false if the ObjectId is longer than
+       * Blob::MAX_ID_SIZE bytes or if the builder is finished.  Throws
+       * a std::runtime_error if it can't write to the file.
+       */
+      bool add(const uint8_t *id, std::size_t idSize,
+	       const uint8_t *blob, std::size_t blobSize);
+      bool add(const std::vector<uint8_t> &id,
+	       const std::vector<uint8_t> &blob) {
+	return add(bytes(id), id.size(), bytes(blob), blob.size());
+      }
+
+      /**
+       * Writes out whatever's buffered and the index, and flushes
+       * them to disk; only then does it write the header that points
+       * at the index, and flush that too.  Nothing can be added
+       * afterwards.  Calling it again does nothing.
+       */
+      void finish();
+
+      bool isFinished() const { return m_fd < 0; }
+
+      /**
+       * How many Blobs have been added so far.
+       */
+      uint32_t numBlobs() const { return m_index.numAllocatedRecords(); }
+
+      /**
+       * HeapFile size in bytes so far: everything added plus the
+       * index, once finished.
+       */
+      uint64_t size() const { return m_size; }
+
+    private:
+      static const uint8_t *bytes(const std::vector<uint8_t> &v) {
+	return v.empty() ? NULL : &v[0];
+      }
+
+      uint8_t *reserve(std::size_t size);
+      void flush();
+
+      std::string m_path;
+      int m_fd;
+      EncryptionPolicy m_key;
+      HeapIndex m_index;
+      std::vector<uint8_t> m_buffer;
+      std::size_t m_buffered;  // bytes in m_buffer yet to be written
+      uint64_t m_size;         // bytes written or buffered
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _HEAP_FILE_BUILDER_H_
@@ -22,6 +22,12 @@ namespace FileUtils {
     template <typename> class HeapFileT;
     typedef HeapFileT<DefaultEncryptionPolicy> HeapFile;
 
+    template <typename> class HeapFileBuilderT;
+    typedef HeapFileBuilderT<DefaultEncryptionPolicy> HeapFileBuilder;
+
+    template <typename> class ShardedHeapFileT;
+    typedef ShardedHeapFileT<DefaultEncryptionPolicy> ShardedHeapFile;
+
   }
 }
 
@@ -1,16 +1,26 @@
 #ifndef _HEAP_INDEX_H_
 #define _HEAP_INDEX_H_ 1
 
+#include <cstddef>
+#include <deque>
 #include <iosfwd>
-#include <list>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <record_hash_map.h>
+#include <segregated_free_list.h>
+#include <set>
 #include <stdint.h>
 #include <uncopyable.h>
+#include <utility>
+#include <vector>
 
 namespace FileUtils {
   namespace StructuredFiles {
 
+    class RecordList;
+    class Slab;
+
     /**
      * Each instance of Record keeps metadata about one Blob instance:
      * it's location in the file, the hash code of the ObjectId,
@@ -34,6 +44,14 @@ namespace FileUtils {
       Record(uint64_t offset, uint32_t key, uint32_t size, bool toMinSize=false);
       Record(const Record &lhs, const Record &rhs);
       explicit Record(const char *&p);
+
+      /**
+       * Copies describe the same Blob but are not linked into any
+       * RecordList or SegregatedFreeList; assignment leaves the links
+       * of the target alone.
+       */
+      Record(const Record &r);
+      Record &operator=(const Record &r);
     
       /**
        * The capacity of the described Blob.
@@ -52,6 +70,59 @@ namespace FileUtils {
 
       void setKey(uint32_t key) { m_key = key; }
 
+      /**
+       * Does this Record describe a Slab rather than a single Blob?
+       * A Slab's key is the size of its slots.
+       */
+      bool isSlab() const     { return SLAB == m_kind; }
+
+      /**
+       * Does this Record describe a Blob in one of the slots of a Slab?
+       */
+      bool isSlabSlot() const { return SLAB_SLOT == m_kind; }
+
+      /**
+       * The CLOCK reference bit of the described Blob: set whenever
+       * the Blob is used and cleared as the clock hand sweeps past it
+       * (see HeapFileT::EVICT_CLOCK).  It isn't serialized.  Readers
+       * sharing the lock of a HeapFile set it at once, so it's read
+       * and written atomically, and only written if it changes: a Blob
+       * read over and over doesn't have its line written each time.
+       */
+      bool isReferenced() const {
+	return 0 != __atomic_load_n(&m_referenced, __ATOMIC_RELAXED);
+      }
+      void setReferenced(bool b) const {
+	if (b != isReferenced())
+	  __atomic_store_n(&m_referenced, uint8_t(b), __ATOMIC_RELAXED);
+      }
+
+      /**
+       * When the described Blob expires, in seconds since the epoch,
+       * or zero if it never does.  It's set through
+       * HeapIndex::setExpiry() and cleared when the Record is freed.
+       */
+      uint64_t expiry() const { return m_expiry; }
+      bool isExpired(uint64_t now) const {
+	return 0 != m_expiry and m_expiry <= now;
+      }
+
+      /**
+       * Was the described Blob freed by HeapIndex::retire() while an
+       * epoch was pinned, or while the committed index had it?  Its
+       * space isn't free yet.  The space of a Record set aside by
+       * HeapIndex::reserve() isn't free either, and it counts as
+       * retired too.  Neither is serialized, and copies aren't retired.
+       */
+      bool isRetired() const { return 0 != m_retired; }
+
+      /**
+       * Is the described Blob in the index last committed to the file
+       * (see HeapIndex::markCommitted())?  It isn't serialized, and
+       * copies aren't committed.
+       */
+      bool isCommitted() const { return 0 != m_committed; }
+
       /**
        * Returns true of the Blob described by the Record referenced by
        * _rhs_ is butting up against and to the right of the Blob this
@@ -61,7 +132,9 @@ namespace FileUtils {
 
       /**
        * Serializes this Record instance.  Advances p by the size
-       * of this Record (Record::SERIALIZED_SIZE bytes).
+       * of this Record (Record::SERIALIZED_SIZE bytes).  Slabs are
+       * marked by the top bit of the serialized size, so no Record
+       * may be 2GB or bigger.
        */
       uint32_t serialize(char *&p) const;
 
@@ -87,9 +160,25 @@ namespace FileUtils {
       std::auto_ptr<Record> splitOffLeft(const uint32_t size);
       
     private:
+      friend class HeapIndex;
+      friend class RecordList;
+      friend class SegregatedFreeList;
+      friend class Slab;
+
+      enum Kind { BLOCK, SLAB, SLAB_SLOT };
+
       uint64_t m_offset; // offset into file where the blob is stored
       uint32_t m_key;    // a hash of the ObjectId;
       uint32_t m_size;   // the size of the payload
+
+      Record *m_prev;    // left neighbour, maintained by RecordList
+      Record *m_next;    // right neighbour, maintained by RecordList
+      uint32_t m_freeSlot; // position in its SegregatedFreeList class
+      uint8_t m_kind;      // a Kind
+      mutable uint8_t m_referenced; // the CLOCK bit
+      uint8_t m_retired;   // see isRetired()
+      uint8_t m_committed; // see isCommitted()
+      uint64_t m_expiry;   // zero is never
     };
 
 
@@ -98,8 +187,125 @@ namespace FileUtils {
     std::ostream &operator<<(std::ostream &strm, const Record &e);
 
 
-    typedef std::multimap<uint32_t, Record *> RecordMap;
-    typedef std::list<Record *> RecordList;
+
+    /**
+     * An intrusive doubly-linked list of Records.  Each Record carries
+     * the links to its left and right neighbours, so given a Record we
+     * can find its neighbours, unlink it, or insert next to it in
+     * constant time without searching the list.  It behaves like
+     * a std::list<Record *> for iteration, but it does not own the
+     * Records linked into it and a Record may be in at most one
+     * RecordList at a time.
+     */
+    class RecordList : private Uncopyable {
+    public:
+      class const_iterator {
+      public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef Record *value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef Record * const *pointer;
+	typedef Record *reference; // by value; see std::reverse_iterator
+
+	const_iterator() : m_list(NULL), m_rec(NULL) {}
+
+	Record *operator*() const { return m_rec; }
+
+	const_iterator &operator++() {
+	  m_rec = RecordList::next(m_rec);
+	  return *this;
+	}
+
+	const_iterator operator++(int) {
+	  const_iterator tmp(*this);
+	  ++*this;
+	  return tmp;
+	}
+
+	const_iterator &operator--() {
+	  m_rec = (NULL == m_rec) ? m_list->back() : RecordList::prev(m_rec);
+	  return *this;
+	}
+
+	const_iterator operator--(int) {
+	  const_iterator tmp(*this);
+	  --*this;
+	  return tmp;
+	}
+
+	bool operator==(const const_iterator &rhs) const {
+	  return m_rec == rhs.m_rec;
+	}
+
+	bool operator!=(const const_iterator &rhs) const {
+	  return m_rec != rhs.m_rec;
+	}
+
+      private:
+	friend class RecordList;
+	const_iterator(const RecordList *list, Record *rec)
+	  : m_list(list), m_rec(rec)
+	{}
+
+	const RecordList *m_list;
+	Record *m_rec; // NULL is one past the end
+      };
+
+      typedef const_iterator iterator;
+      typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+      typedef const_reverse_iterator reverse_iterator;
+
+      RecordList() : m_head(NULL), m_tail(NULL), m_size(0) {}
+
+      bool empty() const { return 0 == m_size; }
+      std::size_t size() const { return m_size; }
+
+      Record *front() const { return m_head; }
+      Record *back()  const { return m_tail; }
+
+      const_iterator begin() const { return const_iterator(this, m_head); }
+      const_iterator end()   const { return const_iterator(this, NULL);   }
+      const_reverse_iterator rbegin() const {
+	return const_reverse_iterator(end());
+      }
+      const_reverse_iterator rend() const {
+	return const_reverse_iterator(begin());
+      }
+
+      /**
+       * The neighbours of a Record in whichever list it is linked into.
+       * NULL at either end of the list.
+       */
+      static Record *prev(const Record *r) { return r->m_prev; }
+      static Record *next(const Record *r) { return r->m_next; }
+
+      void push_back(Record *r);
+
+      /**
+       * Links _r_ into the list immediately to the left of _pos_.
+       */
+      void insert(Record *pos, Record *r);
+
+      /**
+       * Unlinks _r_ from the list.  It is not deleted.
+       */
+      void erase(Record *r);
+
+      /**
+       * Unlinks and returns the last Record in the list.
+       */
+      Record *pop_back();
+
+      /**
+       * Forgets about every Record in the list without deleting any.
+       */
+      void clear();
+
+    private:
+      Record *m_head;
+      Record *m_tail;
+      std::size_t m_size;
+    };
 
 
     /**
@@ -113,46 +319,82 @@ namespace FileUtils {
      * sbrk() equivalent here.  When we fail to find a sufficiently large
      * free block, we fail.  New allocations are added w/ addAllocatedBlock().
      *
-     * Each Record (whether allocated or free) is kept in a std::list
+     * Each Record (whether allocated or free) is kept in a RecordList
      * ordered by offset into the file with the property that for any two
      * Records at index i and i+1 in this list, the Record at i shares
-     * its right-most boundary with the Record at i+1.
+     * its right-most boundary with the Record at i+1.  Since the list is
+     * intrusive, finding the neighbours of a Record for coalescing or
+     * inserting the left half of a split Record is constant time.
      *
      * There are two more data structures.  Each Record is additionally stored
-     * in either the multimap for allocated Records or the multimap for
-     * free Records.  The key of the allocated Records multimap is 
+     * in either the hash map for allocated Records or the segregated
+     * free list for free Records.  The key of the allocated Records hash map is 
      * the hash code of the ObjectId of the Object stored on disk.  Provided
-     * there are few if any collisions in this multimap, reads for previously
+     * there are few if any collisions in this hash map, reads for previously
      * stored objects are nearly constant time.  Testing for the existence of
-     * an object is O(log N) in the multimap where N is the number of 
-     * allocated Records, but it's only O(M) trips to the disk
-     * where M is the number of unique ObjectIds that hash to the same
-     * value (a collision).  The number of collisions will largely depend 
-     * on my choice of hash function and the distribution of ObjectIds.
+     * an object is expected O(1) in the hash map, and it's only O(M) trips
+     * to the disk where M is the number of unique ObjectIds that hash to
+     * the same value (a collision).  The number of collisions will largely
+     * depend on my choice of hash function and the distribution of ObjectIds.
      *
-     * For allocation requests, the free Records multimap is key'ed on
-     * the size of each Record--this is expected to collide more often,
-     * however, multimap::lower_bound gives us logarithmic running time
-     * in the number of free blocks.  This beats K&R's linear time
-     * lookup for a suitable free block.
+     * For allocation requests, the free Records are segregated into
+     * size classes TLSF-style (see SegregatedFreeList).  Finding a
+     * suitable free block, freeing one, and telling whether a Record is
+     * free are all constant time, no matter how many free blocks share
+     * a size.  This beats K&R's linear time lookup for a suitable free
+     * block.
      *
      * This class manages the moving of Records into and out of
-     * their respective multimaps as allocations and deallocations
+     * their respective containers as allocations and deallocations
      * happen.  It will also coalesce adjacent free blocks and manage
      * the construction/destruction of new Record instances as needed.
+     *
+     * Optionally, allocations up to a size threshold are packed into
+     * Slabs (see heap_slab.h) instead.  A Slab is one block in the
+     * list of Records; the Blobs in its slots have Records in the hash
+     * map of allocated Records like every other Blob, but not in the
+     * list of Records.
      */
     class HeapIndex : private Uncopyable {
     public:
 
+      /**
+       * Told of every change to what serialize() writes as it's made
+       * (see setJournal()): an allocated Record or a Slab added or
+       * dropped, the expiry of an allocated Record changed, or the
+       * whole index cleared.  Dropping a Slab drops the Blobs in its
+       * slots along w/ it.
+       */
+      class Journal {
+      public:
+	virtual ~Journal() {}
+	virtual void added(const Record &r) = 0;
+	virtual void dropped(const Record &r) = 0;
+	virtual void expiryChanged(const Record &r) = 0;
+	virtual void cleared() = 0;
+      };
+
+      HeapIndex();
       ~HeapIndex();
 
       /**
        * Note the transfer of ownership with the auto_ptr passed by
        * value.  This will append to the Record list the newly allocated
        * block.  It is expected that the new block is contiguous with 
-       * the last Record in m_list.
+       * the last Record in m_list, or, for the slot of a Slab, that it
+       * lies within the Slab that is the last Record in m_list.
+       * Returns the Record, which the index now owns.
        */ 
-      void addAllocatedBlock(std::auto_ptr<Record> p);
+      Record *addAllocatedBlock(std::auto_ptr<Record> p);
+
+      /**
+       * Appends a newly allocated block for a Blob of _size_ bytes at
+       * _offset_, the end of the last Record in m_list.  This is how we
+       * grow when allocate() fails.  If _size_ is within the slab
+       * threshold, a new Slab is appended and the Record returned is its
+       * first slot.
+       */
+      Record *extend(uint64_t offset, uint32_t size, uint32_t key);
       
       /**
        * Clears the index entirely.  Called by the destructor.
@@ -160,7 +402,8 @@ namespace FileUtils {
       void clear();
 
       /**
-       * Is the passed-in Record in the free Records multimap?
+       * Is the passed-in Record, which must be one of the Records owned
+       * by this index, in the free Records list?
        */
       bool isFree(const Record &r)   const;
 
@@ -180,17 +423,156 @@ namespace FileUtils {
        */
       uint32_t numFreeRecords()      const { return m_free.size();  }
 
+      /**
+       * Returns the number of Slabs.
+       */
+      uint32_t numSlabs()            const { return m_slabs.size(); }
+
+      /**
+       * The Slab described by _r_, or NULL if _r_ isn't the Record of
+       * a Slab.
+       */
+      const Slab *findSlab(const Record &r) const;
+
+      /**
+       * Returns the number of Records serialize() writes, that is,
+       * every allocated Record and every Slab.
+       */
+      uint32_t numSerializedRecords() const;
+
+      /**
+       * Returns the number of allocated Records that expire.
+       */
+      uint32_t numExpiringRecords()  const { return m_numExpiring; }
+
       /*
        * Returns the number of bytes this index will take up on disk.
-       * It is sufficent to store only the allocated Records.
+       * It is sufficent to store only the allocated Records, and the
+       * expiries of those that have one.
        */
       uint32_t size() const; // in bytes
 
+      /**
+       * Serializes the allocated Records ordered by offset, each Slab
+       * followed by the Records of its slots.  Advances p.  Returns
+       * the number of Records serialized.
+       *
+       * If any of them expire, the Records are followed by an expiry
+       * section: EXPIRY_MAGIC, the number of expiring Records, and then
+       * for each of them its position among the serialized Records
+       * (uint32_t) and its expiry (uint64_t).  Files w/o expiries end
+       * right after the Records, just as they did before there were any.
+       */
+      uint32_t serialize(char *&p) const;
+
+      static const uint32_t EXPIRY_MAGIC;
+
+      /**
+       * Reads an expiry section written by serialize() from _p_, if
+       * there's one there and it fits before _end_, and sets the
+       * expiries of _records_, the Records in the order they were
+       * serialized, appending each of those to _expiring_.  Advances
+       * p past it.  Returns the number of expiries read.
+       */
+      uint32_t deserializeExpiries(const char *&p, const char *end,
+				   const std::vector<Record *> &records,
+				   std::vector<const Record *> &expiring);
+
+      /**
+       * Sets the expiry of the allocated Record _r_ (see
+       * Record::expiry()).  Zero clears it.
+       */
+      void setExpiry(const Record &r, uint64_t expiry);
+
+      /**
+       * Blobs of up to _size_ bytes will be packed into Slabs rather
+       * than get a Record::MIN_SIZE block of their own.  Sizes above
+       * Slab::MAX_SLOT_SIZE are clamped to it.  Zero, the default,
+       * turns this off; Slabs already allocated stay where they are.
+       */
+      void setSlabThreshold(uint32_t size);
+      uint32_t slabThreshold() const { return m_slabThreshold; }
+
+      /**
+       * Sets the Journal told of changes from now on, or none w/ NULL,
+       * the default.  The index doesn't own it.
+       */
+      void setJournal(Journal *journal) { m_journal = journal; }
+
       /*
-       * Analagous to K&R's free()
+       * Analagous to K&R's free().  Deallocating the Record of a Slab
+       * deallocates every Blob in it.
        */
       bool deallocate(const Record &r);
       
+      /**
+       * Epochs are for readers that need every Blob they can see to
+       * stay where it is, as long as they look (see
+       * HeapFileT::snapshot()).  pin() returns the current epoch and
+       * starts the next one; the epoch stays pinned until it's passed
+       * to unpin().
+       *
+       * retire() takes an allocated Record out of allocRecords() just
+       * like deallocate() does, but while any epoch is pinned its space
+       * isn't freed.  It's put aside, tagged w/ the current epoch,
+       * until no epoch older than that is pinned any more; unpin()
+       * frees what that releases, in the order it was retired.  W/
+       * nothing pinned, retire() is deallocate(), but for committed
+       * Records (see markCommitted()).  Retiring the Record of a Slab
+       * retires the Blobs in its slots.
+       */
+      uint64_t pin();
+      void unpin(uint64_t epoch);
+      bool isPinned() const { return not m_pins.empty(); }
+
+      bool retire(const Record &r);
+
+      /**
+       * The Records retired but not freed yet, and the bytes they take.
+       */
+      uint32_t numRetiredRecords() const { return m_retired.size(); }
+      uint64_t numRetiredBytes()   const { return m_retiredBytes; }
+
+      /**
+       * Marks every allocated Record as in the index just committed to
+       * the file (see HeapFileT::commit()), and frees what was held
+       * for the one committed before.  A committed Record that's
+       * retired isn't freed, even once no epoch keeps it: it's held,
+       * w/ its Blob still in place, until the next markCommitted(), so
+       * a crash can't find what the committed index points at written
+       * over.  deallocate() holds nothing.
+       */
+      void markCommitted();
+
+      /**
+       * The Records held for the committed index, and the bytes they take.
+       */
+      uint32_t numHeldRecords() const { return m_held.size(); }
+      uint64_t numHeldBytes()   const { return m_heldBytes; }
+
+      /**
+       * Sets aside _size_ bytes for something other than a Blob, like
+       * the HeapIndex itself once it's written to the file (see
+       * HeapFileT::commit()).  The Record returned is neither allocated
+       * nor free, and it stays where it is until it's passed to
+       * unreserve().  reserve() takes the space from a free block if
+       * there's one big enough, and otherwise appends it at _end_, the
+       * end of the last Record in m_list.  reserveAt() appends it at
+       * _offset_, at or past that end, the way addAllocatedBlock() does.
+       */
+      Record *reserve(uint32_t size, uint64_t end);
+      Record *reserveAt(uint64_t offset, uint32_t size);
+      void unreserve(Record *r);
+      uint32_t numReservedRecords() const { return m_numReserved; }
+
+      /**
+       * Is the allocated Record _r_ as good a place for a Blob of
+       * _size_ bytes as allocate() would find?  It is if the Blob fits
+       * and allocate() wouldn't have split off what's left over, or,
+       * for the slot of a Slab, if it's the right size class.
+       */
+      bool isGoodFit(const Record &r, uint32_t size) const;
+
       /*
        * Analogous to K&R's malloc()...note the key
        * is for placement in the allocRecords() multimap.
@@ -199,15 +581,46 @@ namespace FileUtils {
       
       // used for testing, primarily.
       const RecordList &allRecords()  const { return m_list;  }
-      const RecordMap &allocRecords() const { return m_alloc; }
-      const RecordMap &freeRecords()  const { return m_free;  }
+      const RecordHashMap &allocRecords() const { return m_alloc; }
+      const SegregatedFreeList &freeRecords() const { return m_free; }
       
     private:
-      bool coalesce(Record *r);
+      typedef std::map<uint64_t, Slab *> SlabMap;
+      typedef std::set<std::pair<uint32_t, uint64_t> > SlabSet;
+
+      bool usesSlab(uint32_t size) const;
+      Record *appendBlock(std::auto_ptr<Record> p);
+      Record *takeFreeBlock(uint32_t size);
+      Record *takeAllocated(const Record &rec);
+      void retireRecord(Record *r);
+      void freeOrHold(Record *r);
+      Record *allocateSlot(uint32_t size, uint32_t key);
+      Slab *newSlab(Record &r, uint32_t slotSize);
+      void releaseSlot(Record *r);
+      bool freeSlab(uint64_t offset);
+      void deleteSlab(SlabMap::iterator itr);
+      void freeBlock(Record *r);
+      void coalesce(Record *r);
+      void clearExpiry(Record &r);
 
       RecordList m_list;  // list of all blocks, sorted by offset
-      RecordMap  m_alloc; // lookup of allocated records by Record::key()
-      RecordMap  m_free;  // lookup of free records by Record::size()
+      RecordHashMap      m_alloc; // lookup of allocated records by Record::key()
+      SegregatedFreeList m_free;  // lookup of free records by Record::size()
+
+      uint32_t m_slabThreshold;
+      uint32_t m_numExpiring; // allocated Records w/ an expiry
+      SlabMap m_slabs;        // every Slab by offset
+      SlabSet m_partialSlabs; // slot size and offset of Slabs w/ free slots
+
+      typedef std::pair<uint64_t, Record *> Retired; // epoch and Record
+      uint64_t m_epoch;
+      std::multiset<uint64_t> m_pins;
+      std::deque<Retired> m_retired; // by epoch
+      uint64_t m_retiredBytes;
+      std::vector<Record *> m_held; // until markCommitted()
+      uint64_t m_heldBytes;
+      uint32_t m_numReserved;
+      Journal *m_journal; // NULL w/o one
     };
 
 
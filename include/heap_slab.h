@@ -0,0 +1,107 @@
+#ifndef _HEAP_SLAB_H_
+#define _HEAP_SLAB_H_ 1
+
+#include <memory>
+#include <stdint.h>
+#include <uncopyable.h>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    class Record;
+
+    /**
+     * A Slab packs Blobs too small to be worth a Record::MIN_SIZE
+     * Record of their own into one page-sized Record.  The page is
+     * carved into equally sized slots, one Blob per slot, and every
+     * Slab only holds slots of one size class.  Slabs of different
+     * size classes are independent Records in the HeapIndex.
+     *
+     * Each occupied slot is described by a Record of its own so that
+     * it can be found by key and read like any other Blob; those
+     * Records are owned by the Slab and live inside the Slab's Record
+     * rather than in the HeapIndex's list of Records.  Which slots are
+     * taken is kept in an occupancy bitmap.  Nothing about the Slab is
+     * stored in the page itself: the bitmap is rebuilt from the slot
+     * Records when the heap file is opened.
+     */
+    class Slab : private Uncopyable {
+    public:
+      /**
+       * The size in bytes of every Slab on disk.
+       */
+      static const uint32_t SIZE;
+
+      /**
+       * Slot sizes are multiples of this.
+       */
+      static const uint32_t SLOT_ALIGNMENT;
+
+      /**
+       * The biggest slot size there is.
+       */
+      static const uint32_t MAX_SLOT_SIZE;
+
+      /**
+       * The slot size a Blob of _size_ bytes needs.
+       */
+      static uint32_t slotSizeFor(uint32_t size);
+
+      /**
+       * _rec_ describes the page this Slab manages.  It is not owned.
+       */
+      Slab(Record &rec, uint32_t slotSize);
+      ~Slab();
+
+      Record &record() const       { return m_rec; }
+      uint32_t slotSize() const    { return m_slotSize; }
+      uint32_t numSlots() const    { return m_slots.size(); }
+      uint32_t numUsed() const     { return m_numUsed; }
+      bool isFull() const          { return m_numUsed == numSlots(); }
+      bool isEmpty() const         { return 0 == m_numUsed; }
+
+      /**
+       * Is _offset_ within the page of this Slab?
+       */
+      bool contains(uint64_t offset) const;
+
+      /**
+       * Takes the free slot with the lowest offset and returns its
+       * Record, or NULL if the Slab is full.
+       */
+      Record *allocate(uint32_t key);
+
+      /**
+       * Takes ownership of a slot Record read back from disk.  Returns
+       * NULL (and deletes the Record) if it doesn't describe a free slot
+       * of this Slab.
+       */
+      Record *adopt(std::auto_ptr<Record> slot);
+
+      /**
+       * Frees the slot described by _slot_ and deletes the Record.
+       */
+      void release(Record *slot);
+
+      /**
+       * The slot Records, NULL where a slot is free, by ascending offset.
+       */
+      const std::vector<Record *> &slots() const { return m_slots; }
+
+    private:
+      uint32_t slotIndex(uint64_t offset) const;
+      bool isUsed(uint32_t i) const;
+      void setUsed(uint32_t i, bool used);
+
+      Record &m_rec;
+      const uint32_t m_slotSize;
+      uint32_t m_numUsed;
+      std::vector<uint64_t> m_bitmap; // a set bit per occupied slot
+      std::vector<Record *> m_slots;
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _HEAP_SLAB_H_
@@ -2,9 +2,15 @@
 #define _MMAP_FILE_H_ 1
 
 #include <sys/types.h>
+#include <list>
+#include <map>
+#include <mutex.h>
 #include <stdexcept>
+#include <stdint.h>
 #include <string>
 #include <uncopyable.h>
+#include <utility>
+#include <vector>
 
 namespace FileUtils {
 
@@ -14,17 +20,116 @@ namespace FileUtils {
    * It will manage the mapping and unmapping of pages from the
    * disk to pages in virtual memory in a sliding window
    * fashion, the window being the currently mapped bytes of the file.
+   *
+   * Alternatively, it can map the whole file at once into a range of
+   * address space reserved up front.  The mapping grows in place
+   * (MAP_FIXED into the reserved range) as the file grows, so getPtr()
+   * is just pointer arithmetic unless the file has to grow.  Only when
+   * the file outgrows the reservation is a bigger one made and the
+   * file mapped again somewhere else.  This wants a 64-bit address
+   * space; the sliding window is for everybody else.
+   *
+   * Where the whole file won't fit but one window is too few, it can
+   * keep several windows instead: fixed-size chunks of the file, mapped
+   * on demand and kept in an LRU cache with a budget on the total
+   * bytes mapped.  A range that crosses a chunk boundary gets a
+   * window of several chunks so that it's still contiguous in memory.
+   *
+   * The size of the file as far as the user is concerned (size()) may
+   * be less than its size on disk (physicalSize()).  With preallocation
+   * on, the file on disk grows geometrically ahead of size() with
+   * posix_fallocate(), so growing the file one Blob at a time hardly
+   * ever needs a syscall.  The slack is cut off when the file is closed
+   * or shrinkToFit() is called.
+   *
+   * Threads: w/ WHOLE_FILE, any number of threads may call the const
+   * functions at once, as long as nothing else is called meanwhile.
+   * Reading what's already mapped is just pointer arithmetic and a
+   * counter bumped atomically; nothing is mapped or unmapped unless
+   * the file grows.  The other mappings map and unmap windows to
+   * read, so they're good for one thread at a time.  pin() and
+   * unpin() may be called from any thread, whatever the mapping.
    */
   class MmapFile : private Uncopyable {
   public:
-    explicit MmapFile(const std::string &path);
+    struct Options {
+      enum Mapping {
+	SLIDING_WINDOW, // map only the range last asked for
+	WHOLE_FILE,     // map the whole file into reserved address space
+	CHUNK_CACHE     // keep the most recently used chunks mapped
+      };
+
+      Options();
+
+      Mapping mapping;
+
+      /**
+       * Bytes of address space to reserve for WHOLE_FILE up front.
+       * The reservation doubles whenever the file outgrows it.
+       */
+      off_t reserveSize;
+
+      /**
+       * The size of a CHUNK_CACHE chunk, rounded up to a page.
+       */
+      off_t chunkSize;
+
+      /**
+       * The most bytes CHUNK_CACHE keeps mapped at once.  A single
+       * range bigger than this is still mapped, but alone.
+       */
+      off_t cacheBudget;
+
+      /**
+       * The most bytes the file on disk may be allocated beyond size().
+       * Growth doubles the file on disk up to this much slack.  Zero,
+       * the default, keeps the file on disk exactly size() bytes.
+       */
+      off_t maxPreallocation;
+
+      /**
+       * Open the file O_RDONLY and map it PROT_READ.  The file must
+       * exist.  Anything that would write to or resize the file throws
+       * a std::runtime_error instead.
+       */
+      bool readOnly;
+    };
+
+    /**
+     * How getPtr() has fared.  A hit needed no mmap.  A miss did.  A
+     * remap is a miss that first had to unmap something to make room
+     * (or to make the window bigger).  Resizes count the times the
+     * file on disk changed size.  W/ Options::WHOLE_FILE, reads
+     * through the const getPtr() aren't counted: they're hits, and
+     * counting them would have concurrent readers all write one line.
+     */
+    struct Stats {
+      Stats() : hits(0), misses(0), remaps(0), resizes(0) {}
+
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t remaps;
+      uint64_t resizes;
+    };
+
+    explicit MmapFile(const std::string &path, 
+		      const Options &options = Options());
     ~MmapFile();
 
+    const Options &options() const { return m_options; }
+    const Stats &stats() const     { return m_stats;   }
+    bool isReadOnly() const        { return m_options.readOnly; }
+
     /**
      * The size of the file in bytes.
      */
     off_t size() const { return m_fileSize; }
 
+    /**
+     * The size of the file on disk in bytes, preallocated slack and all.
+     */
+    off_t physicalSize() const { return m_physicalSize; }
+
     /**
      * Gets a pointer to an area of the file at _offset_ bytes
      * from the beginning of the file and it'll map _size_
@@ -39,7 +144,8 @@ namespace FileUtils {
     /**
      * Same as w/ getReadPtr, except the file is grown to the 
      * appropriate size if it is not big enough.  Will not return
-     * NULL but will throw an exception on failure.
+     * NULL but will throw an exception on failure, which includes
+     * the file being open read-only.
      */
     template <typename T>
     T *getWritePtr(off_t offset, off_t size=sizeof(T)) {
@@ -99,10 +205,28 @@ namespace FileUtils {
      * munmap commits for you, so seeing your chagnes
      * on disk are as easy as calling getPtr on a range outside
      * of your window or destroying your MmapFile intance.
+     *
+     * With Options::WHOLE_FILE the window is the whole file, so
+     * pointers stay good until the file is trimmed or outgrows its
+     * reserved address space.
      */
     void *getPtr(off_t offset, off_t size);
     const void *getPtr(off_t offset, off_t size) const;
 
+    /**
+     * While the file is pinned, pointers handed out by getPtr() stay
+     * good: a window that would be unmapped is retired instead and
+     * only unmapped by the unpin() that releases the last pin.  Pins
+     * nest.  The pages of a window retired by trim() are past the
+     * end of the file, though, so they may no longer be read.
+     */
+    void pin() const;
+    void unpin() const;
+    bool isPinned() const {
+      ThreadUtils::MutexLock lock(m_pinMutex);
+      return 0 != m_pins;
+    }
+
     /**
      * A simple way of telling if your next invocation of getPtr()
      * will cause new pages to be paged in (and previoi\usly mmaped
@@ -110,6 +234,32 @@ namespace FileUtils {
      */
     bool isInWindow(off_t offset, off_t size) const;
 
+    /**
+     * Tells the kernel the _size_ bytes at _offset_ will be read soon,
+     * so it can start paging them in.  That's madvise(MADV_WILLNEED)
+     * if they're already mapped and posix_fadvise(POSIX_FADV_WILLNEED)
+     * if not.  It's only advice: nothing is mapped and errors are
+     * ignored.
+     */
+    void willNeed(off_t offset, off_t size) const;
+
+    /**
+     * Writes the mapped pages that have changed back to the file and
+     * waits for them and the file's size to reach the disk.  Throws a
+     * std::runtime_error on failure.
+     */
+    void flush();
+
+    /**
+     * Waits for what's been written to the file so far to reach the
+     * disk, w/ fdatasync(2) alone.  Pages changed through a shared
+     * mapping are written back by it too, on Linux at least, so unlike
+     * flush() it needn't go near the mappings, and it may be called
+     * from any thread at any time, like pin().  Throws a
+     * std::runtime_error on failure.
+     */
+    void sync() const;
+
     /**
      * calls trim(0)
      */
@@ -117,19 +267,59 @@ namespace FileUtils {
 
     /**
      * Truncates the file to numBytesToKeep.  Adjusts the window
-     * accordingly.
+     * accordingly.  With preallocation on, the file on disk keeps its
+     * size unless that leaves too much slack.
      */
     void trim(off_t numBytesToKeep);
+
+    /**
+     * Cuts the file on disk down to size().
+     */
+    void shrinkToFit();
   private:
+    struct Chunk {
+      char *begin;
+      off_t size;                         // a multiple of the chunk size
+      std::list<off_t>::iterator lruPos;  // in m_lru
+    };
+    typedef std::map<off_t, Chunk> ChunkMap; // by offset into the file
+
     void unmap() const;
+    void release(char *begin, off_t size) const;
+    int protection() const;
+    void checkWritable() const;
+    void *mapRange(off_t offset, off_t size);
+    void resize(off_t size);
+    void setPhysicalSize(off_t size);
+    void mapWholeFile(off_t size) const;
+    bool isWholeFile() const { return Options::WHOLE_FILE == m_options.mapping; }
+    bool isChunkCache() const { return Options::CHUNK_CACHE == m_options.mapping; }
+    const Chunk *findChunk(off_t offset, off_t size) const;
+    char *mapChunk(off_t offset, off_t size);
+    void unmapChunk(ChunkMap::iterator itr) const;
+    void unmapChunks() const;
 
 
     std::string m_path;
+    Options m_options;
     int m_fd;                   // file descriptor
     off_t m_fileSize;           // file size in bytes
+    off_t m_physicalSize;       // file size on disk in bytes
     mutable off_t m_offset;     // offset into file, a multiple of the page size
     mutable off_t m_windowSize; // size of window into the file
     mutable char *m_begin;      // pointer into beginning of mmap'ed area
+    mutable off_t m_reserved;   // address space reserved at m_begin (WHOLE_FILE)
+
+    // CHUNK_CACHE only
+    mutable ChunkMap m_chunks;
+    mutable std::list<off_t> m_lru;    // chunk offsets, most recent first
+    mutable off_t m_mappedBytes;
+
+    mutable Stats m_stats;
+
+    mutable ThreadUtils::Mutex m_pinMutex; // for the pins and m_retired
+    mutable unsigned m_pins;
+    mutable std::vector<std::pair<char *, off_t> > m_retired; // unmap on unpin
   };
 
 } // end namespace FileUtils
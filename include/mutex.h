@@ -0,0 +1,223 @@
+#ifndef _MUTEX_H_
+#define _MUTEX_H_ 1
+
+#include <cassert>
+#include <cerrno>
+#include <pthread.h>
+#include <cstddef>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/time.h>
+#include <uncopyable.h>
+
+namespace ThreadUtils {
+
+  /**
+   * A thin wrapper around a pthread mutex.  Lock it w/ a MutexLock
+   * rather than by hand so that it's unlocked on the way out of a
+   * scope, exceptions and all.
+   */
+  class Mutex : private Uncopyable {
+  public:
+    Mutex() {
+      if (0 != pthread_mutex_init(&m_mutex, NULL))
+	throw std::runtime_error("Failed to create a mutex");
+    }
+
+    ~Mutex() { pthread_mutex_destroy(&m_mutex); }
+
+    void lock() {
+      int err = pthread_mutex_lock(&m_mutex);
+      assert(0 == err);
+      (void)err;
+    }
+
+    void unlock() {
+      int err = pthread_mutex_unlock(&m_mutex);
+      assert(0 == err);
+      (void)err;
+    }
+
+  private:
+    friend class Condition;
+    pthread_mutex_t m_mutex;
+  };
+
+  /**
+   * Holds a Mutex for as long as it lives.
+   */
+  class MutexLock : private Uncopyable {
+  public:
+    explicit MutexLock(Mutex &m) : m_mutex(m) { m_mutex.lock(); }
+    ~MutexLock() { m_mutex.unlock(); }
+
+  private:
+    Mutex &m_mutex;
+  };
+
+  /**
+   * A thin wrapper around a pthread read-write lock: any number of
+   * readers or one writer.  Waiting writers go ahead of new readers
+   * where pthreads lets us say so, so a steady stream of readers
+   * can't starve them.  Lock it w/ an RWLockGuard.
+   */
+  class RWLock : private Uncopyable {
+  public:
+    RWLock() {
+      pthread_rwlockattr_t attr;
+      pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+      pthread_rwlockattr_setkind_np(&attr, 
+				    PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+      const int err = pthread_rwlock_init(&m_lock, &attr);
+      pthread_rwlockattr_destroy(&attr);
+      if (0 != err)
+	throw std::runtime_error("Failed to create a read-write lock");
+    }
+
+    ~RWLock() { pthread_rwlock_destroy(&m_lock); }
+
+    void readLock() {
+      int err = pthread_rwlock_rdlock(&m_lock);
+      assert(0 == err);
+      (void)err;
+    }
+
+    void writeLock() {
+      int err = pthread_rwlock_wrlock(&m_lock);
+      assert(0 == err);
+      (void)err;
+    }
+
+    void unlock() {
+      int err = pthread_rwlock_unlock(&m_lock);
+      assert(0 == err);
+      (void)err;
+    }
+
+  private:
+    pthread_rwlock_t m_lock;
+  };
+
+  /**
+   * Holds an RWLock for as long as it lives, shared w/ other readers
+   * or not.
+   */
+  class RWLockGuard : private Uncopyable {
+  public:
+    RWLockGuard(RWLock &lock, bool shared) : m_lock(lock) {
+      if (shared)
+	m_lock.readLock();
+      else
+	m_lock.writeLock();
+    }
+    ~RWLockGuard() { m_lock.unlock(); }
+
+  private:
+    RWLock &m_lock;
+  };
+
+  /**
+   * Adds _n_ to _counter_ in one indivisible step and returns the
+   * sum, for counters bumped by threads that don't otherwise hold a
+   * lock in common.
+   */
+  template<class T>
+  inline T atomicAdd(T &counter, T n) {
+    return __sync_add_and_fetch(&counter, n);
+  }
+
+  /**
+   * A counter for threads that would otherwise all write the same
+   * cache line bumping it.  It's split into stripes a cache line
+   * apart, and each thread adds to the one it was handed the first
+   * time, so up to NUM_STRIPES threads never share one.  Reading it
+   * adds them all up, which makes it for counts read now and then.
+   */
+  class StripedCounter : private Uncopyable {
+  public:
+    enum { NUM_STRIPES = 32, CACHE_LINE = 64 };
+
+    StripedCounter() {
+      for(std::size_t i = 0; i < NUM_STRIPES; ++i)
+	m_stripes[i].count = 0;
+    }
+
+    void increment() {
+      atomicAdd(m_stripes[stripe()].count, uint64_t(1));
+    }
+
+    uint64_t value() const {
+      uint64_t sum = 0;
+      for(std::size_t i = 0; i < NUM_STRIPES; ++i)
+	sum += __atomic_load_n(&m_stripes[i].count, __ATOMIC_RELAXED);
+      return sum;
+    }
+
+  private:
+    struct Stripe {
+      uint64_t count;
+      char padding[CACHE_LINE - sizeof(uint64_t)];
+    };
+
+    // Handed out round robin, to every StripedCounter at once.
+    static std::size_t stripe() {
+      static __thread unsigned t_stripe = 0; // 1 + the stripe, once there's one
+      if (0 == t_stripe) {
+	static unsigned s_next = 0;
+	t_stripe = 1 + atomicAdd(s_next, 1u) % NUM_STRIPES;
+      }
+      return t_stripe - 1;
+    }
+
+    Stripe m_stripes[NUM_STRIPES];
+  };
+
+  /**
+   * A thin wrapper around a pthread condition variable.  The Mutex
+   * passed to wait() must be locked by the caller, and it is again
+   * when wait() returns.
+   */
+  class Condition : private Uncopyable {
+  public:
+    Condition() {
+      if (0 != pthread_cond_init(&m_cond, NULL))
+	throw std::runtime_error("Failed to create a condition variable");
+    }
+
+    ~Condition() { pthread_cond_destroy(&m_cond); }
+
+    void wait(Mutex &m) {
+      pthread_cond_wait(&m_cond, &m.m_mutex);
+    }
+
+    /**
+     * Waits no longer than _millis_ milliseconds.  Returns false if
+     * it timed out.  Like wait(), it may also return for no reason at
+     * all, so check what you're waiting for either way.
+     */
+    bool wait(Mutex &m, unsigned millis) {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+
+      struct timespec until;
+      until.tv_sec = now.tv_sec + millis / 1000;
+      until.tv_nsec = now.tv_usec * 1000 + long(millis % 1000) * 1000000;
+      if (until.tv_nsec >= 1000000000) {
+	until.tv_sec += 1;
+	until.tv_nsec -= 1000000000;
+      }
+      return ETIMEDOUT != pthread_cond_timedwait(&m_cond, &m.m_mutex, &until);
+    }
+
+    void signal()    { pthread_cond_signal(&m_cond);    }
+    void broadcast() { pthread_cond_broadcast(&m_cond); }
+
+  private:
+    pthread_cond_t m_cond;
+  };
+
+} // end namespace ThreadUtils
+
+#endif // _MUTEX_H_
@@ -0,0 +1,146 @@
+#ifndef _RECORD_HASH_MAP_H_
+#define _RECORD_HASH_MAP_H_ 1
+
+#include <cstddef>
+#include <iterator>
+#include <stdint.h>
+#include <uncopyable.h>
+#include <utility>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    class Record;
+
+    /**
+     * An open-addressing hash multimap from a Record's key (the hash
+     * of its ObjectId) to the Record.  It stands in for a
+     * std::multimap<uint32_t, Record *> wherever the ordering of keys
+     * does not matter, which is the case for the lookup of allocated
+     * Records.
+     *
+     * The layout follows Google's SwissTable: slots are kept in one flat
+     * array and grouped 16 to a group.  Next to the slots sits an array
+     * with one control byte per slot that's either EMPTY, DELETED or,
+     * for a full slot, the low 7 bits of the slot's hash.  A lookup
+     * compares a whole group of control bytes against those 7 bits at
+     * once (with SSE2 where it's available) and only looks at the
+     * slots that match, so a lookup costs about one cache miss for the
+     * control bytes and one for the slot.  Groups are probed
+     * quadratically until a group with an EMPTY slot is found.
+     *
+     * Inserting may rehash, which invalidates every iterator.  Erasing
+     * only invalidates iterators to the erased element.
+     */
+    class RecordHashMap : private Uncopyable {
+    public:
+      typedef uint32_t key_type;
+      typedef Record *mapped_type;
+      typedef std::pair<uint32_t, Record *> value_type;
+
+      /**
+       * Visits either every element of the map or, when it comes
+       * from find() or equal_range(), only the elements with one key.
+       */
+      class const_iterator {
+      public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef RecordHashMap::value_type value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const value_type *pointer;
+	typedef const value_type &reference;
+
+	const_iterator();
+
+	reference operator*() const  { return m_map->m_slots[m_slot];  }
+	pointer operator->() const   { return &m_map->m_slots[m_slot]; }
+
+	/**
+	 * The slot of the element, for RecordHashMap::at().
+	 */
+	std::size_t slot() const { return m_slot; }
+
+	const_iterator &operator++();
+	const_iterator operator++(int);
+
+	bool operator==(const const_iterator &rhs) const {
+	  return m_slot == rhs.m_slot;
+	}
+
+	bool operator!=(const const_iterator &rhs) const {
+	  return m_slot != rhs.m_slot;
+	}
+
+      private:
+	friend class RecordHashMap;
+
+	const_iterator(const RecordHashMap *map, std::size_t slot);
+	const_iterator(const RecordHashMap *map, uint32_t key);
+
+	void nextFull();
+	void nextMatch();
+
+	const RecordHashMap *m_map;
+	std::size_t m_slot;     // npos when at the end
+
+	// only used when visiting the elements of one key
+	bool m_keyed;
+	uint32_t m_key;
+	int8_t m_h2;            // control byte of m_key
+	std::size_t m_group;    // the group being probed
+	std::size_t m_probe;    // number of groups probed so far
+	uint32_t m_matches;     // slots in m_group still to look at
+      };
+      friend class const_iterator;
+
+      typedef const_iterator iterator;
+
+      RecordHashMap();
+
+      bool empty() const          { return 0 == m_size; }
+      std::size_t size() const    { return m_size;      }
+
+      /**
+       * The number of slots, full or not.
+       */
+      std::size_t capacity() const { return m_slots.size(); }
+
+      const_iterator begin() const;
+      const_iterator end() const { return const_iterator(this, npos); }
+
+      /**
+       * The first element in slot _slot_ or after it, or end().  With
+       * const_iterator::slot() this lets a walk over every element be
+       * picked up again later where it left off, even though the map
+       * changed in the meantime.  What a rehash moves around may be
+       * visited twice or not at all, though.
+       */
+      const_iterator at(std::size_t slot) const;
+
+      const_iterator find(uint32_t key) const;
+      std::pair<const_iterator, const_iterator>
+      equal_range(uint32_t key) const;
+      std::size_t count(uint32_t key) const;
+
+      void insert(const value_type &v);
+      void erase(const_iterator itr);
+      void clear();
+
+    private:
+      static const std::size_t npos;
+
+      void rehash(std::size_t newCapacity);
+      std::size_t findInsertSlot(std::size_t hash) const;
+      void setCtrl(std::size_t slot, int8_t c) { m_ctrl[slot] = c; }
+
+      std::vector<int8_t> m_ctrl;       // one control byte per slot
+      std::vector<value_type> m_slots;
+      std::size_t m_size;
+      std::size_t m_growthLeft;         // EMPTY slots we may still fill
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _RECORD_HASH_MAP_H_
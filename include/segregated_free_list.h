@@ -0,0 +1,129 @@
+#ifndef _SEGREGATED_FREE_LIST_H_
+#define _SEGREGATED_FREE_LIST_H_ 1
+
+#include <cstddef>
+#include <iterator>
+#include <stdint.h>
+#include <uncopyable.h>
+#include <utility>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    class Record;
+
+    /**
+     * The free Records of a HeapIndex, segregated by size the way
+     * TLSF (Masmano et al., "TLSF: a New Dynamic Memory Allocator for
+     * Real-Time Systems") does it.
+     *
+     * Sizes are split into first-level classes by their most significant
+     * bit and each of those into 16 linear second-level classes, so every
+     * class spans at most 1/16th of its sizes.  A bitmap of non-empty
+     * first-level classes and one bitmap of non-empty second-level
+     * classes per first-level class let us find the smallest non-empty
+     * class that's big enough with two bit scans.  Every Record in
+     * the list remembers where it sits in its class, so removing it or
+     * testing whether it is free is constant time, no matter how many
+     * free Records share its size.
+     *
+     * Iteration visits the free Records by ascending size class.
+     */
+    class SegregatedFreeList : private Uncopyable {
+    public:
+      typedef std::pair<uint32_t, Record *> value_type; // size, Record
+
+      class const_iterator {
+      public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef SegregatedFreeList::value_type value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const value_type *pointer;
+	typedef const value_type &reference;
+
+	const_iterator();
+
+	reference operator*() const { return m_value;  }
+	pointer operator->() const  { return &m_value; }
+
+	const_iterator &operator++();
+	const_iterator operator++(int);
+
+	bool operator==(const const_iterator &rhs) const {
+	  return m_class == rhs.m_class and m_pos == rhs.m_pos;
+	}
+
+	bool operator!=(const const_iterator &rhs) const {
+	  return not(*this == rhs);
+	}
+
+      private:
+	friend class SegregatedFreeList;
+	const_iterator(const SegregatedFreeList *list,
+		       std::size_t sizeClass, std::size_t pos);
+
+	void settle(); // skip ahead over empty classes
+
+	const SegregatedFreeList *m_list;
+	std::size_t m_class;
+	std::size_t m_pos;
+	value_type m_value;
+      };
+      friend class const_iterator;
+
+      typedef const_iterator iterator;
+
+      SegregatedFreeList();
+
+      bool empty() const       { return 0 == m_size; }
+      std::size_t size() const { return m_size;      }
+
+      const_iterator begin() const;
+      const_iterator end() const;
+
+      /**
+       * Finds a free Record of exactly _size_ bytes, if there is one.
+       */
+      const_iterator find(uint32_t size) const;
+
+      /**
+       * Is _r_ (this very Record, not an equal one) in the list?
+       */
+      bool contains(const Record &r) const;
+
+      void insert(Record *r);
+
+      /**
+       * Removes _r_ from the list.  Returns false if it wasn't in it.
+       */
+      bool erase(Record *r);
+
+      /**
+       * Removes and returns a free Record at least _size_ bytes big or
+       * NULL if there isn't one.  The newest few Records of the class
+       * _size_ falls in are checked first for a close fit; failing that
+       * we take a Record from the smallest class whose every Record is
+       * big enough, which is two bit scans.  Only when neither works do
+       * we search the rest of the class _size_ falls in.
+       */
+      Record *takeFit(uint32_t size);
+
+      void clear();
+
+    private:
+      void remove(std::size_t sizeClass, std::size_t pos);
+      Record *bestFit(std::size_t sizeClass, uint32_t size,
+		      std::size_t maxScan);
+      Record *anyFromClassAbove(uint32_t size);
+
+      std::vector<std::vector<Record *> > m_classes;
+      uint32_t m_firstLevel;              // bit per non-empty first level
+      std::vector<uint32_t> m_secondLevel; // bit per non-empty class
+      std::size_t m_size;
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _SEGREGATED_FREE_LIST_H_
@@ -0,0 +1,147 @@
+#ifndef _SHARDED_HEAP_FILE_H_
+#define _SHARDED_HEAP_FILE_H_ 1
+
+#include <heap_file.h>
+#include <heap_file_fwd.h>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <uncopyable.h>
+#include <vector>
+#include <worker_pool.h>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    /**
+     * Spreads ObjectIds over a number of HeapFiles (shards) by their
+     * hash() so that writes to different shards don't wait on each
+     * other: each shard has its own index, its own file and its own
+     * lock (see HeapFileT on threads).  The shards live next to a
+     * manifest file at _path_, as "<path>.0", "<path>.1" and so on.
+     * The manifest records how many there are, since an ObjectId
+     * could only be found again in the shard it was routed to.
+     *
+     * Calls for a single ObjectId go straight to its shard.  Batches
+     * are split by shard and the pieces run at the same time on a
+     * WorkerPool w/ a thread for every shard but one, the caller
+     * taking the last.
+     *
+     * Anything about a single shard, like its eviction, cache or
+     * maintenance thread, is set up through shard().
+     */
+    template <class EncryptionPolicy = DefaultEncryptionPolicy>
+    class ShardedHeapFileT : private Uncopyable {
+    public:
+      typedef HeapFileT<EncryptionPolicy> Shard;
+      typedef typename Shard::Batch Batch;
+
+      /**
+       * Opens the manifest at _path_ and the shards it lists, or
+       * creates _numShards_ of them if there's no manifest yet.  Zero
+       * means however many the manifest says.  Throws a
+       * std::runtime_error if the manifest says otherwise, or if
+       * there's none and _numShards_ is zero or the file is opened
+       * read-only.  The rest of the arguments go to every shard.
+       */
+      ShardedHeapFileT(const std::string &path, unsigned numShards = 0,
+		       const std::vector<uint8_t> &encryptionKey = std::vector<uint8_t>(),
+		       const MmapFile::Options &fileOptions = MmapFile::Options());
+      ~ShardedHeapFileT();
+
+      unsigned numShards() const { return m_shards.size(); }
+      Shard &shard(unsigned i) { return *m_shards[i]; }
+      const Shard &shard(unsigned i) const { return *m_shards[i]; }
+
+      /**
+       * The shard an ObjectId belongs to.
+       */
+      unsigned shardOf(const uint8_t *id, std::size_t idSize) const;
+      unsigned shardOf(const std::vector<uint8_t> &id) const {
+	return shardOf(bytes(id), id.size());
+      }
+
+      /**
+       * The size of all the shards on disk in bytes.
+       */
+      uint64_t size() const;
+
+      bool isReadOnly() const { return m_shards[0]->isReadOnly(); }
+
+      /**
+       * These do what the HeapFileT functions of the same names do,
+       * in the shard the ObjectId belongs to.
+       */
+      bool hasBlob(const uint8_t *id, std::size_t idSize) const {
+	return m_shards[shardOf(id, idSize)]->hasBlob(id, idSize);
+      }
+      bool hasBlob(const std::vector<uint8_t> &id) const {
+	return hasBlob(bytes(id), id.size());
+      }
+
+      bool getBlob(const uint8_t *id, std::size_t idSize,
+		   std::vector<uint8_t> &blob) const {
+	return m_shards[shardOf(id, idSize)]->getBlob(id, idSize, blob);
+      }
+      bool getBlob(const std::vector<uint8_t> &id,
+		   std::vector<uint8_t> &blob) const {
+	return getBlob(bytes(id), id.size(), blob);
+      }
+
+      bool eraseBlob(const uint8_t *id, std::size_t idSize) {
+	return m_shards[shardOf(id, idSize)]->eraseBlob(id, idSize);
+      }
+      bool eraseBlob(const std::vector<uint8_t> &id) {
+	return eraseBlob(bytes(id), id.size());
+      }
+
+      bool writeBlob(const uint8_t *id, std::size_t idSize,
+		     const uint8_t *blob, std::size_t blobSize,
+		     uint64_t expiry = 0) {
+	return m_shards[shardOf(id, idSize)]->writeBlob(id, idSize, blob,
+							blobSize, expiry);
+      }
+      bool writeBlob(const std::vector<uint8_t> &id,
+		     const std::vector<uint8_t> &blob, uint64_t expiry = 0) {
+	return writeBlob(bytes(id), id.size(), bytes(blob), blob.size(), expiry);
+      }
+
+      /**
+       * HeapFileT::getBlobs() on every shard w/ ObjectIds in the batch,
+       * all at once.  _reader_ is called from the threads of the pool,
+       * but never from two at the same time.
+       */
+      std::size_t getBlobs(const std::vector<std::vector<uint8_t> > &ids,
+			   const MultiBlobReader &reader,
+			   std::vector<bool> &found) const;
+
+      /**
+       * HeapFileT::writeBlobs() on every shard w/ objects in the batch,
+       * all at once.
+       */
+      std::size_t writeBlobs(const Batch &batch, std::vector<bool> &written);
+
+      /**
+       * These run on every shard at once.  setMaxSize() gives each
+       * shard an even share of _maxSize_.
+       */
+      std::size_t expireBlobs();
+      void clear();
+      void setMaxSize(uint64_t maxSize);
+
+    private:
+      static const uint8_t *bytes(const std::vector<uint8_t> &v) {
+	return v.empty() ? NULL : &v[0];
+      }
+
+      void closeShards();
+
+      std::vector<Shard *> m_shards;
+      std::auto_ptr<ThreadUtils::WorkerPool> m_pool;
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _SHARDED_HEAP_FILE_H_
@@ -28,6 +28,12 @@ namespace Encryption {
     bool encrypt(const T *in, T *out, std::size_t size) const;
     bool decrypt(const T *in, T *out, std::size_t size) const;
 
+    /**
+     * Does encryption leave the data as it is?  It does if every
+     * element of the key is zero, the empty key included.
+     */
+    bool isIdentity() const;
+
     std::vector<T> m_key;
   };
 } // end namespace Encryption
@@ -0,0 +1,91 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_ 1
+
+#include <cstddef>
+#include <stdint.h>
+#include <uncopyable.h>
+#include <utility>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    /**
+     * A hierarchical timer wheel (Varghese & Lauck) of (key, expiry)
+     * pairs, keys being the hashes of ObjectIds (see Record::key())
+     * and expiries whole seconds.  It's how HeapFileT finds expired
+     * Blobs without going through the whole index.
+     *
+     * Level 0 has a slot for each of the next SLOTS seconds.  Each
+     * level up has a slot for SLOTS times as long a stretch of time as
+     * the one below; when time reaches the start of a slot, the timers
+     * in it are cascaded down to the level below, eventually to fire
+     * from level 0.  Timers further out than the top level can reach
+     * are kept aside and rescheduled whenever the top level wraps
+     * around.  Scheduling is constant time, and advancing costs the
+     * timers it moves plus no more than LEVELS * SLOTS steps however
+     * far time jumps.
+     *
+     * Timers can't be cancelled.  A Blob that's erased or rewritten
+     * leaves its timer behind, and whoever takes what advance()
+     * returns has to check it still applies (lazy deletion).
+     */
+    class TimerWheel : private Uncopyable {
+    public:
+      /**
+       * A key and when it expires.
+       */
+      typedef std::pair<uint32_t, uint64_t> Timer;
+
+      static const unsigned LEVELS = 4;
+      static const unsigned SLOT_BITS = 6;
+      static const unsigned SLOTS = 1u << SLOT_BITS;
+
+      /**
+       * The wheel starts out at time _now_.
+       */
+      explicit TimerWheel(uint64_t now = 0);
+
+      /**
+       * A timer that expires no later than now() fires on the next
+       * call to advance().
+       */
+      void schedule(uint32_t key, uint64_t expiry);
+
+      /**
+       * Moves the wheel forward to time _now_, appending every timer
+       * that expires by then to _due_.  Time never goes backwards; an
+       * earlier _now_ only fires the timers that were already due.
+       */
+      void advance(uint64_t now, std::vector<Timer> &due);
+
+      /**
+       * Drops every timer and starts over at time _now_.
+       */
+      void clear(uint64_t now);
+
+      uint64_t now() const { return m_now; }
+
+      /**
+       * How many timers are waiting, fired or not.
+       */
+      std::size_t size() const { return m_size; }
+
+    private:
+      void place(const Timer &t);
+      void cascade(unsigned level);
+
+      typedef std::vector<Timer> Slot;
+
+      uint64_t m_now;
+      std::size_t m_size;
+      Slot m_slots[LEVELS][SLOTS];
+      std::size_t m_levelSizes[LEVELS];
+      Slot m_overdue; // expired by the time they were scheduled
+      Slot m_far;     // beyond the reach of the top level
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _TIMER_WHEEL_H_
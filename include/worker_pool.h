@@ -0,0 +1,76 @@
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_ 1
+
+#include <cstddef>
+#include <deque>
+#include <mutex.h>
+#include <pthread.h>
+#include <string>
+#include <uncopyable.h>
+#include <vector>
+
+namespace ThreadUtils {
+
+  /**
+   * A piece of work for a WorkerPool.
+   */
+  class Task {
+  public:
+    virtual ~Task() {}
+    virtual void run() = 0;
+  };
+
+  /**
+   * A fixed set of threads for fanning a batch of Tasks out and
+   * waiting for all of them to finish.  The thread calling run()
+   * works on its own batch too, so a pool of no threads at all just
+   * runs the batch in the caller, and a batch of one Task never waits
+   * on another thread.  Any number of threads can call run() at once;
+   * their batches are worked on in the order they came in.
+   */
+  class WorkerPool : private Uncopyable {
+  public:
+    explicit WorkerPool(unsigned numThreads);
+
+    /**
+     * Stops the threads once they've finished what they're working on.
+     */
+    ~WorkerPool();
+
+    /**
+     * Runs every Task in _tasks_, returning when they've all finished.
+     * If any of them throws, the rest still run, and then a
+     * std::runtime_error is thrown w/ what the first one said.
+     */
+    void run(const std::vector<Task *> &tasks);
+
+    unsigned numThreads() const { return m_threads.size(); }
+
+  private:
+    struct Batch {
+      explicit Batch(const std::vector<Task *> &t)
+	: tasks(t), next(0), pending(t.size()), failed(false), error()
+      {}
+
+      const std::vector<Task *> &tasks;
+      std::size_t next;    // the first Task nobody's taken
+      std::size_t pending; // Tasks not finished yet
+      bool failed;
+      std::string error;
+    };
+
+    static void *work(void *pool);
+    void stop();
+    bool runOne(Batch &batch);
+
+    Mutex m_mutex; // for everything below
+    Condition m_wakeUp;
+    Condition m_finished;
+    std::deque<Batch *> m_batches; // w/ Tasks nobody's taken
+    bool m_stop;
+    std::vector<pthread_t> m_threads;
+  };
+
+} // end namespace ThreadUtils
+
+#endif // _WORKER_POOL_H_
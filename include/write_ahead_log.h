@@ -0,0 +1,163 @@
+#ifndef _WRITE_AHEAD_LOG_H_
+#define _WRITE_AHEAD_LOG_H_ 1
+
+#include <cstddef>
+#include <heap_index.h>
+#include <map>
+#include <mmap_file.h>
+#include <mutex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <uncopyable.h>
+#include <utility>
+#include <vector>
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    /**
+     * A log of the changes made to a HeapIndex since it was last
+     * committed to its HeapFile (see HeapFileT::setDurability()), so
+     * they aren't lost w/ the index in memory when the process dies.
+     * It's a file of its own that's only ever appended to, a frame at
+     * a time: the size of the frame, a hash of the rest of it, the
+     * offset of the committed index it follows on from, and then the
+     * changes, ENTRY_SIZE bytes each.  A frame cut short by a crash
+     * doesn't hash right, and one left over from before the index was
+     * committed again follows on from the wrong one, so reading stops
+     * at either.
+     *
+     * The log is told of changes as the Journal of the HeapIndex, and
+     * only stages them.  append() queues what's staged to be written,
+     * and sync() returns once everything queued up to a position is on
+     * disk.  Whoever calls sync() while nobody else is syncing writes
+     * everything queued so far as one frame and syncs it; everyone
+     * else waits for that, and then for the next one if it didn't have
+     * what they're after.  A sync is two fdatasync()s, of the HeapFile
+     * first so the Blobs the changes point at are on disk before the
+     * changes are, and then of the log, however many threads it's for.
+     *
+     * Threads: the Journal functions, append() and reset() are for
+     * whoever holds the lock of the HeapFile exclusively.  sync() and
+     * the syncing thread don't need it.
+     */
+    class WriteAheadLog : public HeapIndex::Journal, private Uncopyable {
+    public:
+      /**
+       * The bytes a change takes in a frame: what it is, the Record it
+       * was made to (see Record::serialize()) and its expiry.
+       */
+      static const std::size_t ENTRY_SIZE;
+
+      /**
+       * What replay() works on: the Records HeapIndex::serialize()
+       * writes and their expiries, by where they are in the file and
+       * then by whether they're not a Slab, so a Slab comes just
+       * before its first slot.
+       */
+      typedef std::map<std::pair<uint64_t, bool>,
+		       std::pair<Record, uint64_t> > Records;
+
+      /**
+       * Starts an empty log at _path_, over whatever was there, to
+       * follow on from the index committed at _base_ in _file_, or zero
+       * if none is.  Throws a std::runtime_error if it can't.
+       */
+      WriteAheadLog(const std::string &path, const MmapFile &file,
+		    uint64_t base);
+
+      /**
+       * Stops the syncing thread.  The file is left where it is.
+       */
+      ~WriteAheadLog();
+
+      virtual void added(const Record &r);
+      virtual void dropped(const Record &r);
+      virtual void expiryChanged(const Record &r);
+      virtual void cleared();
+
+      /**
+       * Queues the changes staged since the last call.  Returns the
+       * position in the log that they go up to, for sync().
+       */
+      uint64_t append();
+
+      /**
+       * Returns once everything queued up to _position_ is on disk.
+       * Throws a std::runtime_error if it can't be written, leaving it
+       * queued for the next try.
+       */
+      void sync(uint64_t position);
+
+      /**
+       * Empties the log once the index has been committed at _base_,
+       * waiting for a sync in progress first.  Everything queued is in
+       * that index, so it counts as synced.
+       */
+      void reset(uint64_t base);
+
+      /**
+       * The bytes written to the log since it was last reset, and
+       * queued to be.
+       */
+      uint64_t size() const;
+
+      /**
+       * The number of frames written so far.
+       */
+      uint64_t numSyncs() const;
+
+      /**
+       * Starts a thread that syncs whatever's been queued every
+       * _intervalMillis_, stopping the one before, if there's one.
+       * Zero just stops it.
+       */
+      void syncEvery(unsigned intervalMillis);
+
+      /**
+       * Reads the changes in the log at _path_ that follow on from the
+       * index committed at _base_ into _entries_.  It's left empty if
+       * there's no log, or it follows on from another index.
+       */
+      static void read(const std::string &path, uint64_t base,
+		       std::vector<char> &entries);
+
+      /**
+       * Makes the changes read() found to _records_, in order.
+       */
+      static void replay(const std::vector<char> &entries, Records &records);
+
+    private:
+      void stage(uint8_t change, const Record &r, uint64_t expiry);
+      void writeOut();
+      void stopSyncing();
+      static void *runSyncing(void *log);
+
+      const std::string m_path;
+      const MmapFile &m_file;
+      int m_fd;
+      std::vector<char> m_staged;
+
+      mutable ThreadUtils::Mutex m_mutex; // for everything below
+      ThreadUtils::Condition m_written;
+      std::vector<char> m_queued;
+      uint64_t m_base;
+      uint64_t m_numQueued; // appends ever made
+      uint64_t m_numSynced; // of those, on disk
+      uint64_t m_size;      // of the file
+      bool m_isSyncing;
+      uint64_t m_numSyncs;
+
+      // the syncing thread
+      pthread_t m_thread;
+      bool m_isThreadRunning;
+      bool m_stopThread;
+      unsigned m_intervalMillis;
+      ThreadUtils::Condition m_wakeUp;
+    };
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
+
+#endif // _WRITE_AHEAD_LOG_H_
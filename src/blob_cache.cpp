@@ -0,0 +1,147 @@
+#include <blob_cache.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+
+    BlobCache::BlobCache(size_t capacity, unsigned numShards)
+      : m_capacity(capacity), m_shardCapacity(0), m_shards()
+    {
+      numShards = std::max(1u, numShards);
+      m_shardCapacity = capacity / numShards;
+      for(unsigned i = 0; i < numShards; ++i)
+	m_shards.push_back(new Shard());
+    }
+
+    BlobCache::~BlobCache()
+    {
+      for(size_t i = 0; i < m_shards.size(); ++i)
+	delete m_shards[i];
+    }
+
+    BlobCache::Shard &BlobCache::shardFor(uint32_t hashCode)
+    {
+      // the low bits pick the bucket of a RecordHashMap; mix them up
+      return *m_shards[(hashCode * 0x9e3779b1u >> 16) % m_shards.size()];
+    }
+
+    void BlobCache::erase(Shard &shard, Lookup::iterator itr)
+    {
+      const Entry &e = *itr->second;
+      shard.stats.bytes -= e.id.size() + e.value.size();
+      --shard.stats.entries;
+      shard.lru.erase(itr->second);
+      shard.lookup.erase(itr);
+    }
+
+    bool BlobCache::get(const uint8_t *id, size_t idSize, uint32_t hashCode,
+			uint64_t now, vector<uint8_t> &value)
+    {
+      Shard &shard = shardFor(hashCode);
+      ThreadUtils::MutexLock lock(shard.mutex);
+
+      pair<Lookup::iterator, Lookup::iterator> range = 
+	shard.lookup.equal_range(hashCode);
+      for(; range.first != range.second; ++range.first) {
+	const Entry &e = *range.first->second;
+	if (e.id.size() != idSize or 0 != memcmp(&e.id[0], id, idSize))
+	  continue;
+
+	if (0 != e.expiry and e.expiry <= now) {
+	  erase(shard, range.first);
+	  break;
+	}
+
+	shard.lru.splice(shard.lru.begin(), shard.lru, range.first->second);
+	value = e.value;
+	++shard.stats.hits;
+	return true;
+      }
+
+      ++shard.stats.misses;
+      return false;
+    }
+
+    void BlobCache::put(const uint8_t *id, size_t idSize, uint32_t hashCode,
+			const uint8_t *value, size_t size, uint64_t expiry)
+    {
+      const size_t bytes = idSize + size;
+      if (0 == idSize or bytes > m_shardCapacity)
+	return;
+
+      Shard &shard = shardFor(hashCode);
+      ThreadUtils::MutexLock lock(shard.mutex);
+
+      pair<Lookup::iterator, Lookup::iterator> range = 
+	shard.lookup.equal_range(hashCode);
+      for(; range.first != range.second; ++range.first) {
+	const Entry &e = *range.first->second;
+	if (e.id.size() == idSize and 0 == memcmp(&e.id[0], id, idSize)) {
+	  erase(shard, range.first);
+	  break;
+	}
+      }
+
+      while (shard.stats.bytes + bytes > m_shardCapacity) {
+	const Lru::iterator victim = --shard.lru.end();
+	range = shard.lookup.equal_range(victim->hashCode);
+	while (range.first->second != victim)
+	  ++range.first;
+	erase(shard, range.first);
+	++shard.stats.evictions;
+      }
+
+      shard.lru.push_front(Entry());
+      Entry &e = shard.lru.front();
+      e.id.assign(id, id + idSize);
+      e.value.assign(value, value + size);
+      e.expiry = expiry;
+      e.hashCode = hashCode;
+      shard.lookup.insert(make_pair(hashCode, shard.lru.begin()));
+      shard.stats.bytes += bytes;
+      ++shard.stats.entries;
+    }
+
+    void BlobCache::invalidate(uint32_t hashCode)
+    {
+      Shard &shard = shardFor(hashCode);
+      ThreadUtils::MutexLock lock(shard.mutex);
+
+      pair<Lookup::iterator, Lookup::iterator> range = 
+	shard.lookup.equal_range(hashCode);
+      while (range.first != range.second)
+	erase(shard, range.first++);
+    }
+
+    void BlobCache::clear()
+    {
+      for(size_t i = 0; i < m_shards.size(); ++i) {
+	Shard &shard = *m_shards[i];
+	ThreadUtils::MutexLock lock(shard.mutex);
+	shard.lru.clear();
+	shard.lookup.clear();
+	shard.stats.bytes = 0;
+	shard.stats.entries = 0;
+      }
+    }
+
+    BlobCache::Stats BlobCache::stats() const
+    {
+      Stats total;
+      for(size_t i = 0; i < m_shards.size(); ++i) {
+	Shard &shard = *m_shards[i];
+	ThreadUtils::MutexLock lock(shard.mutex);
+	total.hits      += shard.stats.hits;
+	total.misses    += shard.stats.misses;
+	total.bytes     += shard.stats.bytes;
+	total.entries   += shard.stats.entries;
+	total.evictions += shard.stats.evictions;
+      }
+      return total;
+    }
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
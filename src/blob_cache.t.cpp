@@ -0,0 +1,101 @@
+#include <blob_cache.h>
+#include <unit_test.h>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  typedef vector<uint8_t> Vec;
+
+  bool get(BlobCache &cache, const Vec &id, uint32_t hashCode, Vec &value,
+	   uint64_t now = 0)
+  {
+    return cache.get(&id[0], id.size(), hashCode, now, value);
+  }
+
+  void put(BlobCache &cache, const Vec &id, uint32_t hashCode, const Vec &value,
+	   uint64_t expiry = 0)
+  {
+    cache.put(&id[0], id.size(), hashCode, &value[0], value.size(), expiry);
+  }
+
+  void testBlobCacheGetPut(UnitTestControl &utc)
+  {
+    BlobCache cache(1 << 20, 4);
+    TEST_ASSERT(utc, (1 << 20) == cache.capacity());
+
+    Vec value;
+    TEST_ASSERT(utc, not get(cache, Vec(1, 'a'), 0x42, value));
+
+    put(cache, Vec(1, 'a'), 0x42, Vec(100, 'A'));
+    put(cache, Vec(1, 'b'), 0x42, Vec(100, 'B')); // same hash
+    TEST_ASSERT(utc, get(cache, Vec(1, 'a'), 0x42, value));
+    TEST_ASSERT(utc, Vec(100, 'A') == value);
+    TEST_ASSERT(utc, get(cache, Vec(1, 'b'), 0x42, value));
+    TEST_ASSERT(utc, Vec(100, 'B') == value);
+    TEST_ASSERT(utc, not get(cache, Vec(2, 'a'), 0x42, value));
+
+    // replacing
+    put(cache, Vec(1, 'a'), 0x42, Vec(50, 'Z'));
+    TEST_ASSERT(utc, get(cache, Vec(1, 'a'), 0x42, value));
+    TEST_ASSERT(utc, Vec(50, 'Z') == value);
+
+    BlobCache::Stats stats = cache.stats();
+    TEST_ASSERT(utc, 3 == stats.hits);
+    TEST_ASSERT(utc, 2 == stats.misses);
+    TEST_ASSERT(utc, 2 == stats.entries);
+    TEST_ASSERT(utc, 1 + 50 + 1 + 100 == stats.bytes);
+
+    // everything under a hash goes at once
+    put(cache, Vec(1, 'c'), 0x43, Vec(10, 'C'));
+    cache.invalidate(0x42);
+    TEST_ASSERT(utc, not get(cache, Vec(1, 'a'), 0x42, value));
+    TEST_ASSERT(utc, not get(cache, Vec(1, 'b'), 0x42, value));
+    TEST_ASSERT(utc, get(cache, Vec(1, 'c'), 0x43, value));
+
+    cache.clear();
+    TEST_ASSERT(utc, not get(cache, Vec(1, 'c'), 0x43, value));
+    TEST_ASSERT(utc, 0 == cache.stats().bytes and 0 == cache.stats().entries);
+  }
+
+  void testBlobCacheExpiry(UnitTestControl &utc)
+  {
+    BlobCache cache(1 << 20);
+    Vec value;
+    put(cache, Vec(1, 'a'), 0x42, Vec(100, 'A'), 1000);
+    TEST_ASSERT(utc, get(cache, Vec(1, 'a'), 0x42, value, 999));
+    TEST_ASSERT(utc, not get(cache, Vec(1, 'a'), 0x42, value, 1000));
+    TEST_ASSERT(utc, 0 == cache.stats().entries);
+  }
+
+  void testBlobCacheCapacity(UnitTestControl &utc)
+  {
+    BlobCache cache(1000, 1); // one shard, to know who's evicted
+    Vec value;
+
+    for(uint8_t i = 0; i < 10; ++i)
+      put(cache, Vec(1, i), i, Vec(199, i));
+    TEST_ASSERT(utc, 5 == cache.stats().entries);
+    TEST_ASSERT(utc, 1000 == cache.stats().bytes);
+    TEST_ASSERT(utc, 5 == cache.stats().evictions);
+    TEST_ASSERT(utc, not get(cache, Vec(1, 4), 4, value));
+    TEST_ASSERT(utc, get(cache, Vec(1, 5), 5, value));
+
+    // 5 was just used, so 6 goes first
+    put(cache, Vec(1, 10), 10, Vec(199, 10));
+    TEST_ASSERT(utc, get(cache, Vec(1, 5), 5, value));
+    TEST_ASSERT(utc, not get(cache, Vec(1, 6), 6, value));
+
+    // too big to keep
+    put(cache, Vec(1, 11), 11, Vec(1000, 11));
+    TEST_ASSERT(utc, not get(cache, Vec(1, 11), 11, value));
+    TEST_ASSERT(utc, 5 == cache.stats().entries);
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testBlobCacheGetPut, &::testBlobCacheGetPut)
+REGISTER_TEST(testBlobCacheExpiry, &::testBlobCacheExpiry)
+REGISTER_TEST(testBlobCacheCapacity, &::testBlobCacheCapacity)
@@ -0,0 +1,103 @@
+#include <frequency_sketch.h>
+#include <algorithm>
+#include <mutex.h>
+
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+      const unsigned COUNTERS_PER_WORD = 16;
+      const unsigned BITS_PER_COUNTER  = 4;
+
+      // one per row, so that keys collide in different places in each
+      const uint32_t g_seeds[FrequencySketch::DEPTH] = {
+	0x97cb3127, 0xb492b66f, 0x9ae16a3b, 0xc3a5c85c
+      };
+    } // end namespace <anonymous>
+
+    const unsigned FrequencySketch::DEPTH;
+    const uint32_t FrequencySketch::MAX_FREQUENCY;
+
+    FrequencySketch::FrequencySketch(size_t memory)
+      : m_table(), m_rowMask(0), m_numIncrements(0), m_numAgings(0)
+    {
+      size_t wordsPerRow = 1;
+      while (2 * wordsPerRow * DEPTH * sizeof(uint64_t) <= memory)
+	wordsPerRow *= 2;
+
+      m_table.resize(wordsPerRow * DEPTH, 0);
+      m_rowMask = wordsPerRow * COUNTERS_PER_WORD - 1;
+    }
+
+    // The position of _key_'s counter in _row_, counting from the
+    // start of the table.
+    size_t FrequencySketch::counterFor(uint32_t key, unsigned row) const
+    {
+      uint32_t h = (key ^ g_seeds[row]) * 0x9e3779b1;
+      h ^= h >> 15;
+      h *= 0x85ebca6b;
+      h ^= h >> 13;
+      return row * (m_rowMask + 1) + (h & m_rowMask);
+    }
+
+    // Readers sharing a HeapFile count at the same time, so each
+    // counter is bumped w/ a compare-and-swap of its word.  That keeps
+    // a saturated counter from carrying into its neighbour.
+    void FrequencySketch::increment(uint32_t key)
+    {
+      for(unsigned row = 0; row < DEPTH; ++row) {
+	const size_t i = counterFor(key, row);
+	uint64_t *word = &m_table[i / COUNTERS_PER_WORD];
+	const unsigned shift = (i % COUNTERS_PER_WORD) * BITS_PER_COUNTER;
+	for(uint64_t w = *word; ((w >> shift) & MAX_FREQUENCY) != MAX_FREQUENCY; ) {
+	  const uint64_t seen = __sync_val_compare_and_swap(word, w,
+							    w + (uint64_t(1) << shift));
+	  if (seen == w)
+	    break;
+	  w = seen;
+	}
+      }
+
+      if (ThreadUtils::atomicAdd(m_numIncrements, uint64_t(1)) == m_rowMask + 1)
+	age();
+    }
+
+    uint32_t FrequencySketch::frequency(uint32_t key) const
+    {
+      uint32_t f = MAX_FREQUENCY;
+      for(unsigned row = 0; row < DEPTH; ++row) {
+	const size_t i = counterFor(key, row);
+	const uint64_t word = m_table[i / COUNTERS_PER_WORD];
+	const unsigned shift = (i % COUNTERS_PER_WORD) * BITS_PER_COUNTER;
+	f = min(f, static_cast<uint32_t>((word >> shift) & MAX_FREQUENCY));
+      }
+      return f;
+    }
+
+    // Halves every counter at once: shift each word right and drop the
+    // bit that crossed into the next counter down.  Only the thread
+    // whose increment completed the sample gets here; increments made
+    // meanwhile by others may be halved or not.
+    void FrequencySketch::age()
+    {
+      const uint64_t mask = ~uint64_t(0) / 15 * 7; // 0x7777...
+      for(size_t i = 0; i < m_table.size(); ++i) {
+	uint64_t w = m_table[i], seen;
+	while (w != (seen = __sync_val_compare_and_swap(&m_table[i], w,
+							(w >> 1) & mask)))
+	  w = seen;
+      }
+
+      ThreadUtils::atomicAdd(m_numIncrements, -uint64_t(m_rowMask + 1));
+      ThreadUtils::atomicAdd(m_numAgings, uint64_t(1));
+    }
+
+    void FrequencySketch::clear()
+    {
+      fill(m_table.begin(), m_table.end(), 0);
+      m_numIncrements = 0;
+    }
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
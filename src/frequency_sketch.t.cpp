@@ -0,0 +1,58 @@
+#include <frequency_sketch.h>
+#include <unit_test.h>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  void testFrequencySketchCounts(UnitTestControl &utc)
+  {
+    FrequencySketch sketch(4096);
+    TEST_ASSERT(utc, 4096 == sketch.memoryUsage());
+    TEST_ASSERT(utc, 0 == sketch.frequency(42));
+
+    for(int i = 0; i < 5; ++i)
+      sketch.increment(42);
+    sketch.increment(7);
+    TEST_ASSERT(utc, 5 <= sketch.frequency(42));
+    TEST_ASSERT(utc, 1 <= sketch.frequency(7));
+    TEST_ASSERT(utc, sketch.frequency(7) < sketch.frequency(42));
+
+    // counters saturate
+    for(int i = 0; i < 100; ++i)
+      sketch.increment(42);
+    TEST_ASSERT(utc, FrequencySketch::MAX_FREQUENCY == sketch.frequency(42));
+
+    sketch.clear();
+    TEST_ASSERT(utc, 0 == sketch.frequency(42));
+    TEST_ASSERT(utc, 4096 == sketch.memoryUsage());
+
+    // never less than a word a row, and a power of two
+    TEST_ASSERT(utc, FrequencySketch::DEPTH * sizeof(uint64_t) == 
+		FrequencySketch(0).memoryUsage());
+    TEST_ASSERT(utc, 4096 == FrequencySketch(5000).memoryUsage());
+  }
+
+  void testFrequencySketchAging(UnitTestControl &utc)
+  {
+    // 64 counters a row
+    FrequencySketch sketch(FrequencySketch::DEPTH * 4 * sizeof(uint64_t));
+
+    for(int i = 0; i < 12; ++i)
+      sketch.increment(1);
+    TEST_ASSERT(utc, 12 <= sketch.frequency(1));
+    TEST_ASSERT(utc, 0 == sketch.numAgings());
+
+    // one-hit wonders push it over the sample size
+    for(uint32_t key = 1000; 0 == sketch.numAgings(); ++key)
+      sketch.increment(key);
+    TEST_ASSERT(utc, 1 == sketch.numAgings());
+    TEST_ASSERT(utc, 6 <= sketch.frequency(1) and sketch.frequency(1) <= 7);
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testFrequencySketchCounts, &::testFrequencySketchCounts)
+REGISTER_TEST(testFrequencySketchAging, &::testFrequencySketchAging)
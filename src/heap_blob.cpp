@@ -22,14 +22,15 @@ namespace FileUtils {
 	  sizeof(IdSizeType);
       }
 
-      std::size_t diskSize(const vector<uint8_t> &id,
-			   const BlobWriter &wr)
+      std::size_t diskSize(std::size_t idSize, const BlobWriter &wr)
       {
-	return overhead() + id.size() + wr.size();
+	return overhead() + idSize + wr.size();
       }
     } // end namespace <anonymous>
 
     
+    const std::size_t Blob::MAX_ID_SIZE;
+
     Blob::Blob() 
       : m_rec(Record()), m_ptr(NULL)
     {}
@@ -43,7 +44,7 @@ namespace FileUtils {
 	m_ptr(file.getReadPtr<uint8_t>(r.offset(), r.size()))
     {}
   
-    bool Blob::hasId(const std::vector<uint8_t> &id) const
+    bool Blob::hasId(const uint8_t *id, std::size_t size) const
     {
       if (NULL == m_ptr)
 	return false;
@@ -52,7 +53,7 @@ namespace FileUtils {
       IdSizeType idSize;
       readN2H(p, idSize); // advances p;
 
-      if (id.size() != idSize or idSize > m_rec.size())
+      if (size != idSize or idSize > m_rec.size())
 	return false;
 
       for(uint8_t i = 0; i < idSize; ++i) {
@@ -62,6 +63,27 @@ namespace FileUtils {
       return true;
     }
 
+    bool Blob::hasId(const std::vector<uint8_t> &id) const
+    {
+      return hasId(id.empty() ? NULL : &id[0], id.size());
+    }
+
+    bool Blob::getId(std::vector<uint8_t> &id) const
+    {
+      if (NULL == m_ptr)
+	return false;
+
+      const uint8_t *p = m_ptr;
+      IdSizeType idSize;
+      readN2H(p, idSize); // advances p;
+
+      if (idSize + overhead() > m_rec.size())
+	return false;
+
+      id.assign(p, p + idSize);
+      return true;
+    }
+
     uint32_t Blob::blobSize(size_t keySize, size_t dataSize)
     {
       return overhead() + keySize + dataSize; 
@@ -70,15 +92,21 @@ namespace FileUtils {
     bool Blob::writeData(const vector<uint8_t> &id,
 			 const BlobWriter &wr)
     {
-      assert(diskSize(id, wr) <= m_rec.size());
+      return writeData(id.empty() ? NULL : &id[0], id.size(), wr);
+    }
+
+    bool Blob::writeData(const uint8_t *id, std::size_t idSize,
+			 const BlobWriter &wr)
+    {
+      assert(diskSize(idSize, wr) <= m_rec.size());
 
-      if (id.size() > numeric_limits<IdSizeType>::max() or 
+      if (idSize > numeric_limits<IdSizeType>::max() or 
 	  wr.size() > numeric_limits<BlobSizeType>::max())
 	return false;
 
       uint8_t *p = const_cast<uint8_t *>(m_ptr); // a teeny cop-out
-      writeH2N(p, IdSizeType(id.size())); // advances p
-      p = std::copy(id.begin(), id.end(), p); // advances p
+      writeH2N(p, IdSizeType(idSize)); // advances p
+      p = std::copy(id, id + idSize, p); // advances p
 
       uint8_t *hashPtr = p;
       p += sizeof(uint32_t)/sizeof(uint8_t); // advance p...write the hash last
@@ -92,10 +120,12 @@ namespace FileUtils {
       return true;
     }
 
-    bool Blob::getData(const BlobReader &br) const
+    // Returns a pointer to the Object and its size and stored hash
+    // code, or NULL if the Blob is nil or looks corrupt.
+    const uint8_t *Blob::findData(uint32_t &size, uint32_t &hashCode) const
     {
       if (isNil())
-	return false;
+	return NULL;
 
       const uint32_t recSize = m_rec.size();
       const uint8_t *p = m_ptr;
@@ -104,7 +134,7 @@ namespace FileUtils {
       readN2H(p, keySize); // advances p;
       
       if (keySize + overhead() > recSize)
-	return false;
+	return NULL;
 
       p += keySize; // move it passed the key
 
@@ -115,7 +145,20 @@ namespace FileUtils {
       readN2H(p, dataSize); // advances p
 
       if (dataSize > recSize - overhead() - keySize)
-	return false; // possible corruption
+	return NULL; // possible corruption
+
+      size = dataSize;
+      hashCode = storedHashCode;
+      return p;
+    }
+
+    bool Blob::getData(const BlobReader &br) const
+    {
+      uint32_t dataSize, storedHashCode;
+      const uint8_t *p = findData(dataSize, storedHashCode);
+
+      if (NULL == p)
+	return false;
 
       uint32_t hashCode = hash(p, dataSize);
 
@@ -126,6 +169,66 @@ namespace FileUtils {
       return true;
     }
 
+    bool Blob::getView(const MmapFile &file, BlobView &view) const
+    {
+      uint32_t dataSize, storedHashCode;
+      const uint8_t *p = findData(dataSize, storedHashCode);
+
+      if (NULL == p)
+	return false;
+
+      view = BlobView(file, p, dataSize, storedHashCode);
+      return true;
+    }
+
+    BlobView::BlobView()
+      : m_file(NULL), m_data(NULL), m_size(0), m_hash(0)
+    {}
+
+    BlobView::BlobView(const MmapFile &file, const uint8_t *data,
+		       uint32_t size, uint32_t hashCode)
+      : m_file(&file), m_data(data), m_size(size), m_hash(hashCode)
+    {
+      m_file->pin();
+    }
+
+    BlobView::BlobView(const BlobView &v)
+      : m_file(v.m_file), m_data(v.m_data), m_size(v.m_size), m_hash(v.m_hash)
+    {
+      if (NULL != m_file)
+	m_file->pin();
+    }
+
+    BlobView &BlobView::operator=(const BlobView &v)
+    {
+      if (NULL != v.m_file)
+	v.m_file->pin(); // first, in case it's the same file
+
+      release();
+      m_file = v.m_file;
+      m_data = v.m_data;
+      m_size = v.m_size;
+      m_hash = v.m_hash;
+      return *this;
+    }
+
+    BlobView::~BlobView()
+    {
+      release();
+    }
+
+    void BlobView::release()
+    {
+      if (NULL != m_file)
+	m_file->unpin();
+      m_file = NULL;
+    }
+
+    bool BlobView::verify() const
+    {
+      return not isNil() and hash(m_data, m_size) == m_hash;
+    }
+
     // djb2 hash fn w/ the XOR substitution
     uint32_t hash(const uint8_t *p, size_t size)
     {
@@ -2,7 +2,12 @@
 #include <algorithm>
 #include <byte_order.h>
 #include <cassert>
+#include <cstring>
+#include <ctime>
 #include <heap_blob.h>
+#include <heap_slab.h>
+#include <stdexcept>
+#include <unistd.h>
 
 using namespace EndianUtils;
 using namespace std;
@@ -40,62 +45,143 @@ namespace FileUtils {
 
 	return HeapIndexLocation(numRecords, ptr);
       }
+
+      // Reads the expiry section, if there is one, that follows the
+      // _numRecords_ Records of the HeapIndex (see
+      // HeapIndex::serialize()).
+      void findExpiries(const MmapFile &file, uint32_t numRecords,
+			const std::vector<Record *> &records, HeapIndex &index,
+			std::vector<const Record *> &expiring)
+      {
+	uint64_t end = n2h(file.readOrThrow<uint64_t>(0)) + sizeof(uint32_t) +
+	  uint64_t(numRecords) * Record::SERIALIZED_SIZE;
+	if (end >= static_cast<uint64_t>(file.size()))
+	  return; // there's none
+
+	const uint64_t size = file.size() - end;
+	const char *ptr = file.getReadPtr<char>(end, size);
+	index.deserializeExpiries(ptr, ptr + size, records, expiring);
+      }
+
+      // The write-ahead log isn't folded into the index before it's
+      // this big, however small the index is.
+      const uint64_t MIN_FOLDED_LOG_SIZE = 1 << 20;
+
+      // Seconds since the epoch, what Record::expiry() goes by.
+      uint64_t currentTime()
+      {
+	return time(NULL);
+      }
       
-      // Will write the location of the HeapIndex at the head of the file
-      // then return a ptr where serialization of HeapIndex Records can
-      // be written to.
-      char *prepForCommit(const HeapIndex &index, MmapFile &file)
+      // Where the HeapIndex at _offset_ ends in the file: past its
+      // expiry section, if it has one.
+      uint64_t findHeapIndexEnd(const MmapFile &file, uint64_t offset)
       {
-	assert(not index.allRecords().empty());
+	const uint32_t numRecords = n2h(file.readOrThrow<uint32_t>(offset));
+	const uint64_t end = offset + sizeof(uint32_t) +
+	  uint64_t(numRecords) * Record::SERIALIZED_SIZE;
+	if (end + 2 * sizeof(uint32_t) > static_cast<uint64_t>(file.size()))
+	  return end;
 
-	const Record *last = index.allRecords().back();
-	assert(NULL != last);
-	assert(not index.isFree(*last));
+	const uint32_t magic = n2h(file.readOrThrow<uint32_t>(end));
+	const uint32_t numExpiries = n2h(file.readOrThrow<uint32_t>(end + sizeof(uint32_t)));
+	const uint64_t sectionEnd = end + 2 * sizeof(uint32_t) +
+	  uint64_t(numExpiries) * (sizeof(uint32_t) + sizeof(uint64_t));
+	if (HeapIndex::EXPIRY_MAGIC != magic or
+	    sectionEnd > static_cast<uint64_t>(file.size()))
+	  return end;
+	return sectionEnd;
+      }
+
+      // The bytes the HeapIndex takes in the file once it's committed.
+      // W/o any expiries it ends in an empty expiry section, so the
+      // file can go on past it.
+      uint32_t committedSize(const HeapIndex &index)
+      {
+	return index.size() +
+	  (0 == index.numExpiringRecords() ? 2 * sizeof(uint32_t) : 0);
+      }
 
-	uint64_t indexOffset = last->offset() + last->size();
-	char *ptr = file.getWritePtr<char>(0);
-	writeH2N(ptr, indexOffset); // advances ptr;
+      // Is the index in the file at _committed_ the same as _index_?
+      // One written before commit() came along has no empty expiry
+      // section at its end, but then it's the last thing in the file.
+      bool isCommitted(const HeapIndex &index, const Record *committed,
+		       const MmapFile &file)
+      {
+	if (NULL == committed)
+	  return false;
 
-	const uint32_t numRecords = index.numAllocatedRecords();
+	uint32_t size = committedSize(index);
+	if (committed->size() < size) {
+	  if (committed->size() != index.size() or not index.isLast(*committed))
+	    return false;
+	  size = index.size();
+	}
 
-	ptr = file.getWritePtr<char>(indexOffset, index.size());
-	writeH2N(ptr, numRecords); // advances ptr
-	return ptr; // serialization can begin here
+	std::vector<char> buffer(size);
+	char *p = &buffer[0];
+	writeH2N(p, index.numSerializedRecords()); // advances p
+	index.serialize(p);
+	if (p != &buffer[0] + size) {
+	  writeH2N(p, HeapIndex::EXPIRY_MAGIC);
+	  writeH2N(p, uint32_t(0));
+	}
+	return 0 == memcmp(&buffer[0],
+			   file.getReadPtr<char>(committed->offset(), size), size);
       }
 
-      Blob findBlob(const vector<uint8_t> &id,
+      Blob findBlob(const uint8_t *id, std::size_t idSize,
 		    const HeapIndex &index,
 		    const MmapFile &file)
       {
-	typedef RecordMap::const_iterator Itr;
-	pair<Itr, Itr> range = index.allocRecords().equal_range(hash(id));
+	typedef RecordHashMap::const_iterator Itr;
+	pair<Itr, Itr> range = index.allocRecords().equal_range(hash(id, idSize));
 
 	for(; range.first != range.second; ++range.first) {
 	  const Record *r = range.first->second;
 	  assert( NULL != r);
 	  Blob b(*r, file);
-	  if (b.hasId(id)) {
+	  if (b.hasId(id, idSize)) {
+	    r->setReferenced(true);
 	    return b;
 	  }
 	}
 	return Blob();	
       }
 
-      void release(const Record &r, HeapIndex &index, MmapFile &file)
+      // Where the Blobs end and the HeapIndex would begin.
+      uint64_t dataEnd(const HeapIndex &index)
+      {
+	if (index.allRecords().empty())
+	  return sizeof(uint64_t);
+
+	const Record *last = index.allRecords().back();
+	return last->offset() + last->size();
+      }
+
+      // W/ a Snapshot open, r is only retired (see HeapIndex::retire()),
+      // and so is a Blob in the committed index, unless it's _evicted_
+      // to make room.
+      void release(const Record &r, HeapIndex &index, MmapFile &file,
+		   bool evicted = false)
       {
-	bool isLast = index.isLast(r);
-	uint64_t offset = r.offset();
+	// The Blob may be the last one in a Slab at the end of the file,
+	// so don't go by r alone to tell if the file shrinks.
+	uint64_t end = dataEnd(index);
 
-	index.deallocate(r);
+	if (evicted and not index.isPinned())
+	  index.deallocate(r);
+	else
+	  index.retire(r);
 
-	if (isLast)
-	  file.trim(offset + index.size());
+	if (dataEnd(index) < end)
+	  file.trim(dataEnd(index) + index.size());
       }
 
-      bool eraseBlobEncryptedId(const std::vector<uint8_t> &id,
+      bool eraseBlobEncryptedId(const uint8_t *id, std::size_t idSize,
 				HeapIndex &index, MmapFile &file)
       {
-	const Blob &b = findBlob(id, index, file);
+	const Blob &b = findBlob(id, idSize, index, file);
 	
 	if (b.isNil())
 	  return true;
@@ -105,56 +191,266 @@ namespace FileUtils {
 	return true;
       }
 
+      // Moves the Blob described by _r_ to free space nearer the front
+      // of the file, copying it through _buffer_ since the old and
+      // new places may not both be mapped at once.  Returns false,
+      // moving nothing, if there's no such space.
+      bool relocate(const Record &r, HeapIndex &index, MmapFile &file,
+		    std::vector<uint8_t> &buffer)
+      {
+	const Record *to = index.allocate(r.size(), r.key());
+	if (NULL == to)
+	  return false;
+	if (to->offset() > r.offset()) {
+	  index.deallocate(*to);
+	  return false;
+	}
+
+	const uint8_t *src = file.getReadPtr<uint8_t>(r.offset(), r.size());
+	buffer.assign(src, src + r.size());
+	std::copy(buffer.begin(), buffer.end(),
+		  file.getWritePtr<uint8_t>(to->offset(), r.size()));
+
+	to->setReferenced(r.isReferenced());
+	index.setExpiry(*to, r.expiry());
+	release(r, index, file);
+	return true;
+      }
+
+      // Where a Blob of _blobSize_ bytes w/ ObjectId _id_ can go w/o
+      // growing the file: right over the old one if it's a good fit for
+      // the new one (which leaves the index alone), no Snapshot can see
+      // it, and either the committed index doesn't have it or the write
+      // is _logged_; otherwise wherever allocate() finds room, after the
+      // old one is erased.  NULL if the file has to grow.
+      const Record *placeBlob(const uint8_t *id, std::size_t idSize,
+			      uint32_t blobSize, bool logged,
+			      HeapIndex &index, MmapFile &file)
+      {
+	const Blob &old = findBlob(id, idSize, index, file);
+	if (not old.isNil()) {
+	  const Record &r = old.record();
+	  if (index.isGoodFit(r, blobSize) and not index.isPinned() and
+	      (logged or not r.isCommitted()))
+	    return &r;
+	  release(r, index, file);
+	}
+	return index.allocate(blobSize, hash(id, idSize));
+      }
+
+      // Writes a Blob w/ ObjectId _id_ and object _data_ into the
+      // space described by _r_, which is released again if that fails.
+      template<class EP>
+      bool writeBlobAt(const Record &r, const uint8_t *id, std::size_t idSize,
+		       const uint8_t *data, std::size_t dataSize, const EP &key,
+		       HeapIndex &index, MmapFile &file)
+      {
+	Blob b(file.getWritePtr<uint8_t>(r.offset(), r.size()), r);
+	if (not b.writeData(id, idSize, EncryptingWriter<EP>(data, dataSize, key))) {
+	  release(r, index, file);
+	  return false;
+	}
+	r.setReferenced(true);
+	index.setExpiry(r, 0); // it may have been an expiring one's
+	return true;
+      }
+
+      // Decrypts an object into _dataOut_.
+      template<class EP>
+      struct Reader : public BlobReader
+      {
+	Reader(std::vector<uint8_t> &dataOut,
+	       const EP &key)
+	  : m_dataOut(dataOut), m_key(key)
+	{}
+
+	virtual void readBlob(uint32_t size, const uint8_t *src) const
+	{
+	  m_dataOut.resize(size);
+	  m_key.decrypt(src, &m_dataOut[0], size);
+	}
+
+	std::vector<uint8_t> &m_dataOut;
+	const EP &m_key;
+      };
+
+      // Orders ObjectIds in a batch by their value, then by their
+      // position in the batch.
+      template<class Batch>
+      struct ById
+      {
+	ById(const Batch &batch) : m_batch(batch) {}
+
+	bool operator()(std::size_t a, std::size_t b) const
+	{
+	  if (m_batch[a].first != m_batch[b].first)
+	    return m_batch[a].first < m_batch[b].first;
+	  return a < b;
+	}
+
+	const Batch &m_batch;
+      };
+
+      // Orders (Record, whatever) pairs by where the Record is in the file.
+      struct ByOffset
+      {
+	template<class T>
+	bool operator()(const std::pair<const Record *, T> &a,
+			const std::pair<const Record *, T> &b) const
+	{
+	  return a.first->offset() < b.first->offset();
+	}
+
+	bool operator()(const Record *a, const Record *b) const
+	{
+	  return a->offset() < b->offset();
+	}
+      };
+
+      // What compaction moves next out of _r_: r itself, or the first
+      // slot still in use if it's a Slab.  NULL if there's nothing in
+      // it to move: free space, or a Blob that's moved out already.
+      const Record *nextToMove(const Record &r, const HeapIndex &index)
+      {
+	if (index.isFree(r) or r.isRetired())
+	  return NULL;
+
+	const Slab *slab = index.findSlab(r);
+	if (NULL == slab)
+	  return &r;
+	for(std::size_t i = 0; i < slab->slots().size(); ++i) {
+	  const Record *slot = slab->slots()[i];
+	  if (NULL != slot and not slot->isRetired())
+	    return slot;
+	}
+	return NULL;
+      }
+
     } // end namespace <anonymous>
 
+    void WriteBatch::writeBlob(const uint8_t *id, std::size_t idSize,
+			       const uint8_t *blob, std::size_t blobSize,
+			       uint64_t expiry)
+    {
+      Op &op = m_ops[std::vector<uint8_t>(id, id + idSize)];
+      op.erase = false;
+      op.blob.assign(blob, blob + blobSize);
+      op.expiry = expiry;
+    }
+
+    void WriteBatch::eraseBlob(const uint8_t *id, std::size_t idSize)
+    {
+      Op &op = m_ops[std::vector<uint8_t>(id, id + idSize)];
+      op.erase = true;
+      op.blob.clear();
+      op.expiry = 0;
+    }
+
+    // Encrypts the ObjectId into _id_, which has room for
+    // Blob::MAX_ID_SIZE bytes.  Returns false if it won't fit.
+    template<class EP>
+    bool HeapFileT<EP>::encryptId(const uint8_t *clearId, std::size_t idSize,
+				  uint8_t *id) const
+    {
+      if (idSize > Blob::MAX_ID_SIZE)
+	return false;
+      m_key.encrypt(clearId, id, idSize);
+      return true;
+    }
+
+    template<class EP>
+    void HeapFileT<EP>::checkWritable() const
+    {
+      if (m_file.isReadOnly())
+	throw std::runtime_error("HeapFile is open read-only");
+    }
+
     template<>
     HeapFileT<>::HeapFileT(const string &path,
-			   const std::vector<uint8_t> &key)
-      : m_index(), m_file(path), m_key(key), m_maxSize(-1)
+			   const std::vector<uint8_t> &key,
+			   const MmapFile::Options &fileOptions)
+      : m_index(), m_file(path, fileOptions), m_key(key), m_maxSize(-1),
+	m_eviction(EVICT_TAIL), m_clockHand(0), m_numEvictions(0),
+	m_sketch(), m_numRejections(0), m_wheel(currentTime()), m_cache(),
+	m_committed(NULL), m_logPath(path + ".wal"), m_durability(DURABLE_NONE),
+	m_log(), m_lock(), m_numOperations(), m_mutex(),
+	m_maintenanceThread(), m_isMaintenanceRunning(false), m_stopMaintenance(false),
+	m_maintenanceWakeUp(), m_maintenanceOptions(), m_maintenanceStats(),
+	m_numOperationsSeen(0), m_scrubSlot(0)
     {
-      if (0 == m_file.size())
+      if (0 == m_file.size()) {
+	if (not m_file.isReadOnly())
+	  unlink(m_logPath.c_str()); // whatever it has is gone w/ the file
 	return;
+      }
     
       try {
 
-	HeapIndexLocation loc = findHeapIndex(m_file);
-	for(uint32_t i = 0; i < loc.numRecs(); ++i) {
-	  std::auto_ptr<Record> p(new Record(loc.recsRefPtr()));
-	  m_index.addAllocatedBlock(p);
+	// W/o an index yet, only a log can say what's in the file.
+	const uint64_t indexOffset = n2h(m_file.readOrThrow<uint64_t>(0));
+	uint64_t indexSize = 0;
+	if (0 != indexOffset) {
+	  indexSize = findHeapIndexEnd(m_file, indexOffset) - indexOffset;
+	  HeapIndexLocation loc = findHeapIndex(m_file); // last, as it maps the Records
+
+	  // The index itself is kept where it is until the next commit,
+	  // in between the Records on either side of it.
+	  std::vector<Record *> records(loc.numRecs());
+	  for(uint32_t i = 0; i < loc.numRecs(); ++i) {
+	    std::auto_ptr<Record> p(new Record(loc.recsRefPtr()));
+	    if (NULL == m_committed and p->offset() > indexOffset)
+	      m_committed = m_index.reserveAt(indexOffset, indexSize);
+	    records[i] = m_index.addAllocatedBlock(p);
+	  }
+	  if (NULL == m_committed)
+	    m_committed = m_index.reserveAt(indexOffset, indexSize);
+	  m_index.markCommitted();
+
+	  // only the expiring Records go back on the wheel
+	  std::vector<const Record *> expiring;
+	  findExpiries(m_file, loc.numRecs(), records, m_index, expiring);
+	  for(std::size_t i = 0; i < expiring.size(); ++i)
+	    m_wheel.schedule(expiring[i]->key(), expiring[i]->expiry());
 	}
 
+	replayLog(indexOffset, indexSize);
+
       }catch(const std::exception &e)
       {
 	m_index.clear();
-	m_file.clear();
+	m_committed = NULL;
+	m_wheel.clear(currentTime());
+	if (not m_file.isReadOnly()) {
+	  m_file.clear();
+	  unlink(m_logPath.c_str());
+	}
       }
     }
 
     template<>
     HeapFileT<>::~HeapFileT()
     {
+      stopMaintenance();
+      assert(not m_index.isPinned() and "A Snapshot outlived its HeapFile");
+
+      if (m_file.isReadOnly())
+	return; // nothing to commit
+
       try {
 	if (0 == m_index.numAllocatedRecords()) {
 	  m_file.clear();
-	  return;
+	}else {
+	  if (not isCommitted(m_index, m_committed, m_file))
+	    commitIndex();
+	  m_file.trim(dataEnd(m_index)); // the index needs no room past the end
 	}
-	char *ptr = prepForCommit(m_index, m_file);
 
-	typedef RecordList::const_iterator ConstItr;
-	const RecordList &list = m_index.allRecords();
-
-	uint32_t numSerialized = 0;
-	for(ConstItr itr = list.begin(), itrEnd = list.end(); 
-	    itr != itrEnd; ++itr) {
-	  const Record *e = *itr;
-	  assert( NULL != e);
-	  if (m_index.isFree(*e))
-	    continue;
-	  e->serialize(ptr); // serialize advances ptr;
-	  ++numSerialized;
+	// everything in the log is in the file now
+	if (NULL != m_log.get()) {
+	  m_index.setJournal(NULL);
+	  m_log.reset();
+	  unlink(m_logPath.c_str());
 	}
-
-	assert(numSerialized == m_index.numAllocatedRecords());	
       }
       catch(const std::exception &e) // don't let exceptions escape destructors.
       {
@@ -163,108 +459,390 @@ namespace FileUtils {
     }
 
     template<>
-    bool HeapFileT<>::hasBlob(const std::vector<uint8_t> &clearId) const
+    bool HeapFileT<>::hasBlob(const uint8_t *clearId, std::size_t idSize) const
     {
-      std::vector<uint8_t> id(clearId);
-      m_key.encrypt(id, id);
-      const Blob &b = findBlob(id, m_index, m_file);
-      return not b.isNil();
+      Operation op(*this, SHARED);
+      uint8_t id[Blob::MAX_ID_SIZE];
+      if (not encryptId(clearId, idSize, id))
+	return false;
+      countAccess(hash(id, idSize));
+      const Blob &b = findBlob(id, idSize, m_index, m_file);
+      return not b.isNil() and not b.record().isExpired(currentTime());
     }
 
     template<class EP>
-    bool HeapFileT<EP>::getBlob(const std::vector<uint8_t> &clearId,
+    bool HeapFileT<EP>::getBlob(const uint8_t *clearId, std::size_t idSize,
 				std::vector<uint8_t> &data) const
     {
-      std::vector<uint8_t> id(clearId);
-      m_key.encrypt(id, id);
-      const Blob &b = findBlob(id, m_index, m_file);
+      Operation op(*this, SHARED);
+      uint8_t id[Blob::MAX_ID_SIZE];
+      if (not encryptId(clearId, idSize, id))
+	return false;
+      const uint32_t hashCode = hash(id, idSize);
+      countAccess(hashCode);
+
+      if (NULL != m_cache.get() and
+	  m_cache->get(id, idSize, hashCode, currentTime(), data)) {
+	reference(hashCode);
+	return true;
+      }
+
+      const Blob &b = findBlob(id, idSize, m_index, m_file);
 
-      if (b.isNil())
+      if (b.isNil() or b.record().isExpired(currentTime()))
 	return false;
 
+      if (not b.getData(Reader<EP>(data, m_key)))
+	return false;
+
+      if (NULL != m_cache.get())
+	m_cache->put(id, idSize, hashCode, bytes(data), data.size(),
+		     b.record().expiry());
+      return true;
+    }
+
+    template<class EP>
+    std::size_t HeapFileT<EP>::getBlobs(const std::vector<std::vector<uint8_t> > &ids,
+					const MultiBlobReader &reader,
+					std::vector<bool> &found) const
+    {
+      Operation op(*this, SHARED);
+      found.assign(ids.size(), false);
+
+      // Every Record that might hold one of the ObjectIds, along w/
+      // the position of that ObjectId in _ids_.  Only the index is
+      // read to find these; the file isn't touched until they're in
+      // file order.
+      typedef std::pair<const Record *, std::size_t> Candidate;
+      std::vector<Candidate> candidates;
+      candidates.reserve(ids.size());
+
+      std::vector<uint8_t> scratch; // reused for every object
+      std::size_t numFound = 0;
+      const uint64_t now = currentTime();
+
+      uint8_t id[Blob::MAX_ID_SIZE];
+      for(std::size_t i = 0; i < ids.size(); ++i) {
+	if (not encryptId(bytes(ids[i]), ids[i].size(), id))
+	  continue;
+
+	const uint32_t hashCode = hash(id, ids[i].size());
+	countAccess(hashCode);
+
+	// cached ones go to _reader_ right away
+	if (NULL != m_cache.get() and 
+	    m_cache->get(id, ids[i].size(), hashCode, now, scratch)) {
+	  reference(hashCode);
+	  reader.readBlob(i, bytes(scratch), scratch.size());
+	  found[i] = true;
+	  ++numFound;
+	  continue;
+	}
+
+	typedef RecordHashMap::const_iterator Itr;
+	pair<Itr, Itr> range = m_index.allocRecords().equal_range(hashCode);
+	for(; range.first != range.second; ++range.first)
+	  candidates.push_back(Candidate(range.first->second, i));
+      }
+
+      std::sort(candidates.begin(), candidates.end(), ByOffset());
+
+      // ask for the pages, coalescing neighbours
+      const uint64_t pageSize = getpagesize();
+      for(std::size_t i = 0; i < candidates.size(); ) {
+	const uint64_t begin = candidates[i].first->offset();
+	uint64_t end = begin + candidates[i].first->size();
+	for(++i; i < candidates.size(); ++i) {
+	  const Record *r = candidates[i].first;
+	  if (r->offset() > end + pageSize)
+	    break;
+	  end = std::max(end, r->offset() + r->size());
+	}
+	m_file.willNeed(begin, end - begin);
+      }
+
       struct Reader : public BlobReader
       {
-	Reader(std::vector<uint8_t> &dataOut,
-	       const EP &key)
-	  : m_dataOut(dataOut), m_key(key)
+	Reader(std::vector<uint8_t> &scratch, const EP &key,
+	       const MultiBlobReader &reader, std::size_t i)
+	  : m_scratch(scratch), m_key(key), m_reader(reader), m_i(i)
 	{}
 
 	virtual void readBlob(uint32_t size, const uint8_t *src) const
 	{
-	  m_dataOut.resize(size);
-	  m_key.decrypt(src, &m_dataOut[0], size);
+	  m_scratch.resize(size);
+	  m_key.decrypt(src, &m_scratch[0], size);
+	  m_reader.readBlob(m_i, bytes(m_scratch), size);
 	}
 
-	std::vector<uint8_t> &m_dataOut;
+	std::vector<uint8_t> &m_scratch;
 	const EP &m_key;
+	const MultiBlobReader &m_reader;
+	std::size_t m_i;
       };
 
-      return b.getData(Reader(data, m_key));
+      for(std::size_t c = 0; c < candidates.size(); ++c) {
+	const std::size_t i = candidates[c].second;
+	if (found[i])
+	  continue; // already found under another Record w/ the same hash
+
+	encryptId(bytes(ids[i]), ids[i].size(), id);
+	Blob b(*candidates[c].first, m_file);
+	if (not b.hasId(id, ids[i].size()))
+	  continue;
+	if (candidates[c].first->isExpired(now))
+	  continue; // a miss, but no other Record has it
+	candidates[c].first->setReferenced(true);
+
+	if (b.getData(Reader(scratch, m_key, reader, i))) {
+	  found[i] = true;
+	  ++numFound;
+	  if (NULL != m_cache.get())
+	    m_cache->put(id, ids[i].size(), b.record().key(),
+			 bytes(scratch), scratch.size(), b.record().expiry());
+	}
+      }
+      return numFound;
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::getBlobView(const uint8_t *id, std::size_t idSize,
+				    BlobView &view) const
+    {
+      Operation op(*this, SHARED);
+      if (not m_key.isIdentity())
+	throw std::runtime_error("Can't view encrypted Blobs");
+
+      if (idSize > Blob::MAX_ID_SIZE)
+	return false;
+
+      countAccess(hash(id, idSize));
+      const Blob &b = findBlob(id, idSize, m_index, m_file);
+      if (not b.isNil() and b.record().isExpired(currentTime()))
+	return false;
+      return b.getView(m_file, view);
+    }
+
+    template<>
+    bool HeapFileT<>::doEraseBlob(const uint8_t *clearId, std::size_t idSize)
+    {
+      uint8_t id[Blob::MAX_ID_SIZE];
+      if (not encryptId(clearId, idSize, id))
+	return true; // it can't be in here
+      invalidate(hash(id, idSize));
+      return eraseBlobEncryptedId(id, idSize, m_index, m_file);
     }
 
+    // W/ DURABLE_SYNC, the wait for the log is outside of the lock, so
+    // writers waiting on the same sync don't hold each other up.
     template<>
-    bool HeapFileT<>::eraseBlob(const std::vector<uint8_t> &clearId)
+    bool HeapFileT<>::eraseBlob(const uint8_t *clearId, std::size_t idSize)
     {
-      std::vector<uint8_t> id(clearId);
-      m_key.encrypt(id, id);
-      return eraseBlobEncryptedId(id, m_index, m_file);
+      uint64_t position = 0;
+      bool erased = false;
+      {
+	Operation op(*this);
+	checkWritable();
+	erased = doEraseBlob(clearId, idSize);
+	position = logChanges();
+      }
+      syncLog(position);
+      return erased;
     }
 
+    // Counts a lookup or write of the ObjectId hashing to _hashCode_
+    // for the admission filter, if there is one.
     template<class EP>
-    bool HeapFileT<EP>::writeBlob(const std::vector<uint8_t> &clearId,
-				  const std::vector<uint8_t> &blob)
+    void HeapFileT<EP>::countAccess(uint32_t hashCode) const
     {
-      std::vector<uint8_t> id(clearId);
-      m_key.encrypt(id, id);
-      if (not eraseBlobEncryptedId(id, m_index, m_file))
-	return false;
+      if (NULL != m_sketch.get())
+	m_sketch->increment(hashCode);
+    }
 
-      uint32_t blobSize = Blob::blobSize(id.size(), blob.size());
-      uint32_t hashCode = hash(id);
-      
-      Record *r = m_index.allocate(blobSize, hashCode);
-
-      if (NULL == r) {
-	// grab more from the disk
-	uint64_t offset = sizeof(uint64_t);
-	if (not m_index.allRecords().empty()) {
-	  Record *last = m_index.allRecords().back();
-	  offset = last->offset() + last->size();
-	}
-	auto_ptr<Record> allocated(new Record(offset, hashCode, blobSize, true));
-	r = allocated.get();
-	m_index.addAllocatedBlock(allocated);
-	uint64_t proposedSize = r->offset() + r->size() + m_index.size();
-	if (proposedSize > m_maxSize) {
-	  m_index.deallocate(*r);
-	  return false;
+    // Sets the reference bit of the Blobs w/ ObjectIds that hash to
+    // _hashCode_ on a cache hit.  The cache keeps no Records, so it
+    // can't say which one it was, and telling would mean reading the
+    // file; a collision just keeps one more Blob from the clock.
+    template<class EP>
+    void HeapFileT<EP>::reference(uint32_t hashCode) const
+    {
+      typedef RecordHashMap::const_iterator Itr;
+      pair<Itr, Itr> range = m_index.allocRecords().equal_range(hashCode);
+      for(; range.first != range.second; ++range.first)
+	range.first->second->setReferenced(true);
+    }
+
+    // Drops whatever the cache has under ObjectIds that hash to
+    // _hashCode_, before their Blobs change or go away.
+    template<class EP>
+    void HeapFileT<EP>::invalidate(uint32_t hashCode)
+    {
+      if (NULL != m_cache.get())
+	m_cache->invalidate(hashCode);
+    }
+
+    // The same, for the Blob of _r_, or for every Blob in it if it's
+    // a Slab, before it's deallocated.
+    template<class EP>
+    void HeapFileT<EP>::invalidate(const Record &r)
+    {
+      if (NULL == m_cache.get())
+	return;
+
+      const Slab *slab = m_index.findSlab(r);
+      if (NULL == slab) {
+	m_cache->invalidate(r.key());
+	return;
+      }
+      for(std::size_t i = 0; i < slab->slots().size(); ++i) {
+	if (NULL != slab->slots()[i])
+	  m_cache->invalidate(slab->slots()[i]->key());
+      }
+    }
+
+    // The first Blob the clock hand comes to w/ a clear reference
+    // bit, clearing the bits it passes on the way and stopping just
+    // past it.  Returns NULL if there's none.
+    template<class EP>
+    const Record *HeapFileT<EP>::clockVictim()
+    {
+      const RecordHashMap &records = m_index.allocRecords();
+
+      // twice around clears every bit, if need be
+      for(std::size_t n = 0; n < 2 * records.capacity() + 1; ++n) {
+	RecordHashMap::const_iterator itr = records.at(m_clockHand);
+	if (records.end() == itr) {
+	  if (records.empty())
+	    return NULL;
+	  itr = records.at(0);
 	}
-	m_file.trim(proposedSize);
+	m_clockHand = itr.slot() + 1;
+
+	const Record *r = itr->second;
+	if (not r->isReferenced())
+	  return r;
+	r->setReferenced(false);
+      }
+      return NULL;
+    }
+
+    // Returns the size of the evicted Record.
+    template<class EP>
+    uint32_t HeapFileT<EP>::evict(const Record &victim)
+    {
+      const uint32_t size = victim.size();
+      invalidate(victim.key());
+      release(victim, m_index, m_file, true); // a miss after a crash
+      ++m_numEvictions;
+      return size;
+    }
+
+    // Evicts the clock's victim.  Returns the size of the evicted
+    // Record, or zero if there's none.
+    template<class EP>
+    uint32_t HeapFileT<EP>::evictOne()
+    {
+      const Record *victim = clockVictim();
+      return (NULL == victim) ? 0 : evict(*victim);
+    }
+
+    // Makes room at the end of the file for a Blob of _blobSize_ bytes
+    // when allocate() found none.  If that would make the file too
+    // big, EVICT_TAIL gives up and EVICT_CLOCK evicts Blobs until
+    // there's room, either in what they leave behind or at the end,
+    // once compacting the file by as much as was evicted frees it.
+    // W/ admission on, each victim is only evicted if the new Blob's
+    // ObjectId has been seen more often than the victim's; otherwise
+    // the write is refused.  Returns NULL if there's no room.
+    template<class EP>
+    const Record *HeapFileT<EP>::grow(uint32_t blobSize, uint32_t hashCode)
+    {
+      uint64_t evicted = 0; // since the last compaction
+
+      for(;;) {
+	Record *r = m_index.extend(dataEnd(m_index), blobSize, hashCode);
+	uint64_t proposedSize = dataEnd(m_index) + m_index.size();
+	if (proposedSize <= m_maxSize) {
+	  m_file.trim(proposedSize);
+	  return r;
+	}
+	m_index.deallocate(*r);
+
+	// w/ a Snapshot open, evicting wouldn't make any room
+	if (EVICT_CLOCK != m_eviction or m_index.isPinned())
+	  return NULL;
+
+	const Record *victim = clockVictim();
+	if (NULL == victim)
+	  return NULL;
+
+	if (NULL != m_sketch.get() and 
+	    m_sketch->frequency(hashCode) <= m_sketch->frequency(victim->key())) {
+	  ++m_numRejections;
+	  return NULL;
+	}
+	evicted += evict(*victim);
+
+	if (NULL != (r = m_index.allocate(blobSize, hashCode)))
+	  return r;
+
+	// no more is moved than was evicted, so a write never pays for
+	// compacting the whole file; what's left of it carries over
+	if (evicted >= blobSize)
+	  evicted -= doCompact(evicted).bytesMoved;
+      }
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::writeBlob(const uint8_t *clearId, std::size_t idSize,
+				  const uint8_t *data, std::size_t dataSize,
+				  uint64_t expiry)
+    {
+      uint64_t position = 0;
+      bool written = false;
+      {
+	Operation op(*this);
+	checkWritable();
+	written = doWriteBlob(clearId, idSize, data, dataSize, expiry);
+	position = logChanges();
       }
+      syncLog(position);
+      return written;
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::doWriteBlob(const uint8_t *clearId, std::size_t idSize,
+				    const uint8_t *data, std::size_t dataSize,
+				    uint64_t expiry)
+    {
+      uint8_t id[Blob::MAX_ID_SIZE];
+      if (not encryptId(clearId, idSize, id))
+	return false;
+
+      uint32_t blobSize = Blob::blobSize(idSize, dataSize);
+      uint32_t hashCode = hash(id, idSize);
+      countAccess(hashCode);
+      invalidate(hashCode);
+
+      const Record *r = placeBlob(id, idSize, blobSize, NULL != m_log.get(),
+				  m_index, m_file);
+
+      if (NULL == r)
+	r = grow(blobSize, hashCode); // grab more from the disk
+      if (NULL == r)
+	return false;
 
       uint8_t *writePtr = m_file.getWritePtr<uint8_t>(r->offset(), 
 						      r->size());
       Blob b(writePtr, *r);
       
-      struct Writer : public BlobWriter
-      {
-	Writer(const std::vector<uint8_t>& data,
-	       EP &key)
-	  : m_data(data), m_key(key)
-	{}
-	
-	virtual uint32_t size() const { return m_data.size(); }
-	virtual void writeBlob(uint8_t *dest) const
-	{
-	  m_key.encrypt(&m_data[0], dest, m_data.size());
-	}
-	
-	const std::vector<uint8_t> &m_data;
-	const EP &m_key;
-      };
-
-      if (b.writeData(id, Writer(blob, m_key)))
+      if (b.writeData(id, idSize, EncryptingWriter<EP>(data, dataSize, m_key))) {
+	r->setReferenced(true);
+	m_index.setExpiry(*r, expiry);
+	if (0 != expiry)
+	  m_wheel.schedule(hashCode, expiry);
 	return true;
+      }
 
       // well, if we made it here, something went horribly wrong.
       // so let's clean up.
@@ -273,49 +851,1076 @@ namespace FileUtils {
       return false;
     }
     
-    template<>
-    void HeapFileT<>::clear()
+    template<class EP>
+    std::size_t HeapFileT<EP>::writeBlobs(const Batch &batch,
+					  std::vector<bool> &written)
     {
-      m_index.clear();
-      m_file.clear();
-      m_maxSize = -1;
+      uint64_t position = 0;
+      std::size_t numWritten = 0;
+      {
+	Operation op(*this);
+	checkWritable();
+	numWritten = doWriteBlobs(batch, written);
+	position = logChanges();
+      }
+      syncLog(position);
+      return numWritten;
     }
 
-    // To guarantee that the HeapFile will shrink in size
-    // we have to remove entries from the end of the file, which could
-    // end up erasing recently added entries....depending on overall
-    // available space and how often we remove an entry from the heap file.
-    template<>
-    void HeapFileT<>::setMaxSize(uint64_t maxSize)
+    template<class EP>
+    std::size_t HeapFileT<EP>::doWriteBlobs(const Batch &batch,
+					    std::vector<bool> &written)
     {
-      m_maxSize = maxSize;
+      written.assign(batch.size(), false);
 
-      if (static_cast<uint64_t>(m_file.size()) < m_maxSize)
-	return;
+      // Only the last object under each ObjectId is written; the others
+      // take its status.  Sorting positions by ObjectId finds them.
+      std::vector<std::size_t> lastOf(batch.size());
+      {
+	std::vector<std::size_t> byId(batch.size());
+	for(std::size_t i = 0; i < batch.size(); ++i)
+	  byId[i] = lastOf[i] = i;
+	std::sort(byId.begin(), byId.end(), ById<Batch>(batch));
 
-      if (0 == m_index.numAllocatedRecords()) {
-	clear();
-	return;
+	for(std::size_t j = batch.size(); j-- > 1; ) {
+	  if (batch[byId[j - 1]].first == batch[byId[j]].first)
+	    lastOf[byId[j - 1]] = lastOf[byId[j]];
+	}
       }
-      
-      const Record *rec = m_index.allRecords().back();
-      uint64_t currentSize = m_file.size();
 
-      // remove blobs from the end; it's a sure-fire way
-      // to shrink the heap file
-      do {
-	m_index.deallocate(*rec);
+      // First, everything that fits in the file as it is.  The rest is
+      // left for later, in order.
+      typedef std::pair<const Record *, std::size_t> Placement;
+      std::vector<Placement> pending;
 
-	if (0 == m_index.numAllocatedRecords()) {
-	  clear();
-	  return;
+      uint8_t id[Blob::MAX_ID_SIZE];
+      for(std::size_t i = 0; i < batch.size(); ++i) {
+	const std::vector<uint8_t> &clearId = batch[i].first;
+	const std::vector<uint8_t> &data = batch[i].second;
+	if (lastOf[i] != i or not encryptId(bytes(clearId), clearId.size(), id))
+	  continue;
+	countAccess(hash(id, clearId.size()));
+	invalidate(hash(id, clearId.size()));
+
+	const uint32_t blobSize = Blob::blobSize(clearId.size(), data.size());
+	const Record *r = placeBlob(id, clearId.size(), blobSize,
+				    NULL != m_log.get(), m_index, m_file);
+	if (NULL == r)
+	  pending.push_back(Placement(NULL, i));
+	else
+	  written[i] = writeBlobAt(*r, id, clearId.size(), bytes(data),
+				   data.size(), m_key, m_index, m_file);
+      }
+
+      // Then the rest goes past the end of the data, all of it at once.
+      const uint64_t begin = dataEnd(m_index);
+      std::size_t numPending = 0;
+      for(std::size_t j = 0; j < pending.size(); ++j) {
+	const std::size_t i = pending[j].second;
+	const std::vector<uint8_t> &clearId = batch[i].first;
+	const std::vector<uint8_t> &data = batch[i].second;
+	const uint32_t blobSize = Blob::blobSize(clearId.size(), data.size());
+	encryptId(bytes(clearId), clearId.size(), id);
+	const uint32_t hashCode = hash(id, clearId.size());
+
+	// A Slab started by an earlier one may have room.  So may the
+	// space a later one moved out of in the first pass, and that's
+	// written where it is, as it's no part of what gets mapped below.
+	const Record *r = m_index.allocate(blobSize, hashCode);
+	if (NULL != r and r->offset() < begin) {
+	  written[i] = writeBlobAt(*r, id, clearId.size(), bytes(data),
+				   data.size(), m_key, m_index, m_file);
+	  continue;
+	}
+	if (NULL == r)
+	  r = m_index.extend(dataEnd(m_index), blobSize, hashCode);
+	assert(r->offset() >= begin);
+	pending[numPending++] = Placement(r, i);
+      }
+      pending.resize(numPending);
+
+      uint64_t proposedSize = dataEnd(m_index) + m_index.size();
+
+      // EVICT_CLOCK makes room for them one at a time instead
+      if (EVICT_CLOCK == m_eviction and proposedSize > m_maxSize) {
+	for(std::size_t j = pending.size(); j-- > 0; )
+	  m_index.deallocate(*pending[j].first);
+
+	for(std::size_t j = 0; j < pending.size(); ++j) {
+	  const std::size_t i = pending[j].second;
+	  const std::vector<uint8_t> &clearId = batch[i].first;
+	  const std::vector<uint8_t> &data = batch[i].second;
+	  encryptId(bytes(clearId), clearId.size(), id);
+
+	  const Record *r = grow(Blob::blobSize(clearId.size(), data.size()),
+				 hash(id, clearId.size()));
+	  if (NULL != r)
+	    written[i] = writeBlobAt(*r, id, clearId.size(), bytes(data),
+				     data.size(), m_key, m_index, m_file);
+	}
+	pending.clear();
+      }
+
+      while (not pending.empty() and proposedSize > m_maxSize) {
+	m_index.deallocate(*pending.back().first);
+	pending.pop_back();
+	proposedSize = dataEnd(m_index) + m_index.size();
+      }
+
+      if (not pending.empty()) {
+	m_file.trim(proposedSize);
+
+	const uint64_t end = dataEnd(m_index);
+	uint8_t *base = m_file.getWritePtr<uint8_t>(begin, end - begin);
+
+	for(std::size_t j = 0; j < pending.size(); ++j) {
+	  const Record *r = pending[j].first;
+	  const std::size_t i = pending[j].second;
+	  const std::vector<uint8_t> &clearId = batch[i].first;
+	  const std::vector<uint8_t> &data = batch[i].second;
+	  encryptId(bytes(clearId), clearId.size(), id);
+
+	  Blob b(base + (r->offset() - begin), *r);
+	  written[i] = b.writeData(id, clearId.size(),
+				   EncryptingWriter<EP>(bytes(data), data.size(), m_key));
+	  r->setReferenced(written[i]);
+	}
+
+	// well, if any of these failed, something went horribly wrong
+	for(std::size_t j = pending.size(); j-- > 0; ) {
+	  if (not written[pending[j].second])
+	    release(*pending[j].first, m_index, m_file);
+	}
+      }
+
+      std::size_t numWritten = 0;
+      for(std::size_t i = 0; i < batch.size(); ++i) {
+	written[i] = written[lastOf[i]];
+	if (written[i])
+	  ++numWritten;
+      }
+      return numWritten;
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::commit(const WriteBatch &batch)
+    {
+      Operation op(*this);
+      checkWritable();
+
+      // Whatever the batch replaces is only retired, so neither it nor
+      // the index the header points at now is written over until the
+      // new index is in its place.
+      const uint64_t epoch = m_index.pin();
+      bool applied = false;
+      try {
+	applied = applyBatch(batch);
+	if (applied)
+	  commitIndex();
+      }catch(...) {
+	unpin(epoch);
+	throw;
+      }
+      unpin(epoch);
+      logChanges(); // what the unpin let go, if the batch wasn't applied
+      return applied;
+    }
+
+    // Everything in _batch_ or nothing at all, w/ an epoch pinned.
+    // Every ObjectId is looked up first, then room is made for every
+    // object and they're all written, and only then does anything
+    // replaced or erased go.
+    template<class EP>
+    bool HeapFileT<EP>::applyBatch(const WriteBatch &batch)
+    {
+      typedef WriteBatch::Ops::const_iterator Itr;
+      std::vector<const Record *> olds;  // NULL if there's none
+      std::vector<const Record *> news;  // NULL for erasures
+      olds.reserve(batch.size());
+      news.reserve(batch.size());
+
+      uint8_t id[Blob::MAX_ID_SIZE];
+      for(Itr itr = batch.m_ops.begin(); itr != batch.m_ops.end(); ++itr) {
+	const std::vector<uint8_t> &clearId = itr->first;
+	if (not encryptId(bytes(clearId), clearId.size(), id)) {
+	  if (not itr->second.erase)
+	    return false;
+	  olds.push_back(NULL); // it can't be in here
+	  continue;
+	}
+	const Blob &old = findBlob(id, clearId.size(), m_index, m_file);
+	olds.push_back(old.isNil() ? NULL : &old.record());
+      }
+
+      bool fits = true;
+      for(Itr itr = batch.m_ops.begin(); fits and itr != batch.m_ops.end(); ++itr) {
+	const std::vector<uint8_t> &clearId = itr->first;
+	if (itr->second.erase) {
+	  news.push_back(NULL);
+	  continue;
+	}
+	encryptId(bytes(clearId), clearId.size(), id);
+	const uint32_t blobSize = Blob::blobSize(clearId.size(), itr->second.blob.size());
+	const uint32_t hashCode = hash(id, clearId.size());
+	countAccess(hashCode);
+
+	const Record *r = m_index.allocate(blobSize, hashCode);
+	if (NULL == r)
+	  r = grow(blobSize, hashCode);
+	news.push_back(r);
+	if (NULL == r)
+	  fits = false;
+      }
+
+      std::size_t i = 0;
+      for(Itr itr = batch.m_ops.begin(); fits and itr != batch.m_ops.end(); ++itr, ++i) {
+	if (NULL == news[i])
+	  continue;
+	const std::vector<uint8_t> &clearId = itr->first;
+	const std::vector<uint8_t> &data = itr->second.blob;
+	encryptId(bytes(clearId), clearId.size(), id);
+
+	Blob b(m_file.getWritePtr<uint8_t>(news[i]->offset(), news[i]->size()), *news[i]);
+	fits = b.writeData(id, clearId.size(),
+			   EncryptingWriter<EP>(bytes(data), data.size(), m_key));
+      }
+
+      if (not fits) {
+	const uint64_t end = dataEnd(m_index);
+	for(std::size_t j = news.size(); j-- > 0; ) {
+	  if (NULL != news[j])
+	    m_index.deallocate(*news[j]); // never seen, so not retired
+	}
+	if (dataEnd(m_index) < end)
+	  m_file.trim(dataEnd(m_index) + m_index.size());
+	return false;
+      }
+
+      i = 0;
+      for(Itr itr = batch.m_ops.begin(); itr != batch.m_ops.end(); ++itr, ++i) {
+	if (NULL != olds[i]) {
+	  invalidate(olds[i]->key());
+	  release(*olds[i], m_index, m_file);
+	}
+	if (NULL == news[i])
+	  continue;
+
+	news[i]->setReferenced(true);
+	m_index.setExpiry(*news[i], itr->second.expiry);
+	if (0 != itr->second.expiry)
+	  m_wheel.schedule(news[i]->key(), itr->second.expiry);
+      }
+      return true;
+    }
+
+    // Writes the index to a place of its own, syncs, points the header
+    // at it and syncs again; only then is the place of the index the
+    // header pointed at before let go.  So the file has a whole index
+    // in it all along: the old one until the header's written and the
+    // new one after.  W/ _onlyIfLower_ it's only committed if that
+    // moves it nearer the front of the file.  Returns whether it was.
+    template<class EP>
+    bool HeapFileT<EP>::commitIndex(bool onlyIfLower)
+    {
+      const uint32_t size = committedSize(m_index);
+      Record *r = m_index.reserve(size, dataEnd(m_index));
+      if (onlyIfLower and
+	  (NULL == m_committed or r->offset() > m_committed->offset())) {
+	m_index.unreserve(r);
+	return false;
+      }
+
+      const uint64_t fileSize = dataEnd(m_index) + m_index.size();
+      if (static_cast<uint64_t>(m_file.size()) < fileSize)
+	m_file.trim(fileSize);
+
+      char *ptr = m_file.getWritePtr<char>(r->offset(), size);
+      writeH2N(ptr, m_index.numSerializedRecords()); // advances ptr
+      m_index.serialize(ptr);
+      if (0 == m_index.numExpiringRecords()) {
+	writeH2N(ptr, HeapIndex::EXPIRY_MAGIC);
+	writeH2N(ptr, uint32_t(0));
+      }
+      m_file.flush();
+
+      ptr = m_file.getWritePtr<char>(0, sizeof(uint64_t));
+      writeH2N(ptr, r->offset());
+      m_file.flush();
+
+      const uint64_t end = dataEnd(m_index);
+      m_index.markCommitted(); // what only the old index had is free
+      if (NULL != m_committed)
+	m_index.unreserve(m_committed);
+      m_committed = r;
+      if (dataEnd(m_index) < end)
+	m_file.trim(dataEnd(m_index) + m_index.size());
+      resetLog(); // it's all in the index now
+      return true;
+    }
+
+    // Queues the changes made to the index in the log, if there is
+    // one, and returns the position to sync it to for them (see
+    // syncLog()).  Once the log's bigger than the index, committing
+    // the index is cheaper than replaying it.
+    template<class EP>
+    uint64_t HeapFileT<EP>::logChanges()
+    {
+      if (NULL == m_log.get())
+	return 0;
+
+      const uint64_t position = m_log->append();
+      if (m_log->size() > std::max(MIN_FOLDED_LOG_SIZE,
+				   uint64_t(committedSize(m_index))))
+	commitIndex();
+      return position;
+    }
+
+    // W/ DURABLE_SYNC, waits for the log to be on disk up to
+    // _position_.  Called w/o the lock, so writers can share a sync.
+    template<class EP>
+    void HeapFileT<EP>::syncLog(uint64_t position)
+    {
+      if (DURABLE_SYNC == m_durability and 0 != position)
+	m_log->sync(position);
+    }
+
+    // Starts the log over once the index it follows on from changes.
+    template<class EP>
+    void HeapFileT<EP>::resetLog()
+    {
+      if (NULL != m_log.get())
+	m_log->reset(NULL == m_committed ? 0 : m_committed->offset());
+    }
+
+    // Brings the index just read from the file, committed at
+    // _indexOffset_, up to date w/ the log of the changes made since,
+    // if there is one.  The Records are rebuilt in file order, w/ the
+    // place of the committed index reserved again in between, and
+    // committed, so the log can go.  Records the file no longer
+    // reaches, since it was trimmed before a crash, are left out.
+    template<class EP>
+    void HeapFileT<EP>::replayLog(uint64_t indexOffset, uint64_t indexSize)
+    {
+      std::vector<char> entries;
+      WriteAheadLog::read(m_logPath, indexOffset, entries);
+      if (entries.empty()) {
+	if (not m_file.isReadOnly())
+	  unlink(m_logPath.c_str()); // stale, if it's there at all
+	return;
+      }
+
+      WriteAheadLog::Records records;
+      for(const Record *r = m_index.allRecords().front(); NULL != r;
+	  r = RecordList::next(r)) {
+	if (m_index.isFree(*r) or r->isRetired())
+	  continue;
+	records[std::make_pair(r->offset(), not r->isSlab())] =
+	  std::make_pair(*r, r->expiry());
+
+	const Slab *slab = m_index.findSlab(*r);
+	for(std::size_t i = 0; NULL != slab and i < slab->slots().size(); ++i) {
+	  const Record *slot = slab->slots()[i];
+	  if (NULL != slot)
+	    records[std::make_pair(slot->offset(), true)] =
+	      std::make_pair(*slot, slot->expiry());
+	}
+      }
+      WriteAheadLog::replay(entries, records);
+
+      m_index.clear();
+      m_committed = NULL;
+      m_wheel.clear(currentTime());
+
+      // each one goes through serialize() for a Record of its own
+      std::vector<char> buffer(Record::SERIALIZED_SIZE);
+      const uint64_t fileSize = m_file.size();
+      uint64_t skipped = 0; // the end of the last Slab left out
+      typedef WriteAheadLog::Records::const_iterator Itr;
+      for(Itr itr = records.begin(); itr != records.end(); ++itr) {
+	const Record &r = itr->second.first;
+	if (r.offset() < skipped or r.offset() + r.size() > fileSize) {
+	  if (r.isSlab())
+	    skipped = r.offset() + r.size();
+	  continue;
+	}
+	if (0 != indexOffset and NULL == m_committed and r.offset() > indexOffset)
+	  m_committed = m_index.reserveAt(indexOffset, indexSize);
+
+	char *p = &buffer[0];
+	r.serialize(p);
+	const char *q = &buffer[0];
+	std::auto_ptr<Record> copy(new Record(q));
+	const Record *added = m_index.addAllocatedBlock(copy);
+
+	const uint64_t expiry = itr->second.second;
+	if (0 != expiry) {
+	  m_index.setExpiry(*added, expiry);
+	  m_wheel.schedule(added->key(), expiry);
+	}
+      }
+      if (0 != indexOffset and NULL == m_committed)
+	m_committed = m_index.reserveAt(indexOffset, indexSize);
+
+      if (m_file.isReadOnly())
+	return; // the writer that opens it next will fold the log in
+      commitIndex();
+      unlink(m_logPath.c_str());
+    }
+
+    template<class EP>
+    void HeapFileT<EP>::setDurability(Durability durability,
+				      unsigned intervalMillis)
+    {
+      Operation op(*this);
+      checkWritable();
+
+      // Either way, the index in the file has to be up to date: a log
+      // only goes on from there, and w/o one it's all there is.
+      if ((DURABLE_NONE == durability) != (NULL == m_log.get()) and
+	  0 != m_file.size() and not isCommitted(m_index, m_committed, m_file))
+	commitIndex();
+
+      if (DURABLE_NONE == durability) {
+	if (NULL != m_log.get()) {
+	  m_index.setJournal(NULL);
+	  m_log.reset();
+	  unlink(m_logPath.c_str());
+	}
+	m_durability = durability;
+	return;
+      }
+
+      if (NULL == m_log.get()) {
+	m_log.reset(new WriteAheadLog(m_logPath, m_file, NULL == m_committed ?
+				      0 : m_committed->offset()));
+	m_index.setJournal(m_log.get());
+      }
+      m_durability = durability;
+      m_log->syncEvery(DURABLE_PERIODIC == durability ?
+		       std::max(1u, intervalMillis) : 0);
+    }
+
+    template<class EP>
+    uint64_t HeapFileT<EP>::size() const
+    {
+      Operation op(*this, SHARED);
+      return m_file.size();
+    }
+
+    template<class EP>
+    typename HeapFileT<EP>::Durability HeapFileT<EP>::durability() const
+    {
+      Operation op(*this, SHARED);
+      return m_durability;
+    }
+
+    template<class EP>
+    uint64_t HeapFileT<EP>::numLogSyncs() const
+    {
+      Operation op(*this, SHARED);
+      return (NULL == m_log.get()) ? 0 : m_log->numSyncs();
+    }
+
+    template<>
+    void HeapFileT<>::doClear()
+    {
+      m_index.clear();
+      m_committed = NULL;
+      m_file.clear();
+      resetLog();
+      m_wheel.clear(currentTime());
+      m_maxSize = -1;
+      if (NULL != m_cache.get())
+	m_cache->clear();
+      if (NULL != m_sketch.get())
+	m_sketch->clear();
+    }
+
+    template<>
+    HeapFileT<>::Compaction HeapFileT<>::doCompact(uint64_t budget,
+						   std::size_t maxMoves)
+    {
+      Compaction result;
+      if (m_index.isPinned())
+	return result; // what it moves couldn't be reclaimed yet
+
+      const uint64_t oldSize = m_file.size();
+      std::vector<uint8_t> buffer; // a bounce buffer
+
+      // W/ a log, the places Blobs move out of are only retired until
+      // the log has them in their new ones, or a crash could find them
+      // written over.  So the end of the file is further back each time.
+      const bool isLogged = NULL != m_log.get();
+      for(;;) {
+	bool isOverBudget = false;
+	const uint64_t epoch = isLogged ? m_index.pin() : 0;
+	try {
+	  bool moved = true;
+	  const Record *last = m_index.allRecords().back();
+	  while (moved and NULL != last) {
+	    if (last == m_committed) {
+	      moved = commitIndex(true);
+	      last = m_index.allRecords().back();
+	      continue;
+	    }
+
+	    // a Slab goes a slot at a time, and it's gone w/ its last one
+	    const Record *r = nextToMove(*last, m_index);
+	    if (NULL == r) {
+	      last = RecordList::prev(last);
+	      continue;
+	    }
+
+	    const uint32_t size = r->size();
+	    if (result.bytesMoved + size > budget or 0 == maxMoves) {
+	      isOverBudget = true;
+	      break;
+	    }
+
+	    // relocate() releases r, and what's released leaves the cache,
+	    // as w/ every other release()
+	    invalidate(r->key());
+
+	    moved = relocate(*r, m_index, m_file, buffer);
+	    if (moved) {
+	      result.bytesMoved += size;
+	      --maxMoves;
+	    }
+	    if (not isLogged)
+	      last = m_index.allRecords().back(); // r's place is free, maybe gone
+	  }
+
+	  if (isLogged) {
+	    const uint64_t end = dataEnd(m_index);
+	    m_log->sync(m_log->append());
+	    m_index.unpin(epoch);
+	    if (dataEnd(m_index) < end)
+	      m_file.trim(dataEnd(m_index) + m_index.size());
+	  }
+	}catch(...) {
+	  if (isLogged)
+	    m_index.unpin(epoch); // the file shrinks the next time
+	  throw;
+	}
+
+	// The places Blobs in the committed index moved out of (or were
+	// erased from) are only freed by committing it again, which may
+	// make room to move more.  A step at a time, that waits for the
+	// last step.
+	if (0 == maxMoves or 0 == m_index.numHeldBytes())
+	  break;
+	commitIndex();
+	commitIndex(true); // the index itself may go lower now
+	if (isOverBudget)
+	  break;
+      }
+
+      result.bytesReclaimed = oldSize - m_file.size();
+      return result;
+    }
+
+    // Releases the Blobs whose timers are due.  A timer may have
+    // outlived its Blob, or the Blob may since have been written w/
+    // another expiry, so only Records still w/ the timer's expiry go.
+    template<>
+    std::size_t HeapFileT<>::doExpire()
+    {
+      const uint64_t now = currentTime();
+      std::vector<TimerWheel::Timer> due;
+      m_wheel.advance(now, due);
+
+      std::vector<const Record *> expired;
+      for(std::size_t i = 0; i < due.size(); ++i) {
+	typedef RecordHashMap::const_iterator Itr;
+	pair<Itr, Itr> range = m_index.allocRecords().equal_range(due[i].first);
+	for(; range.first != range.second; ++range.first) {
+	  const Record *r = range.first->second;
+	  if (r->expiry() == due[i].second and r->isExpired(now))
+	    expired.push_back(r);
+	}
+      }
+
+      // The same Record can turn up under two timers w/ the same
+      // expiry.  Last to first, so the file shrinks as much as it can.
+      std::sort(expired.begin(), expired.end(), ByOffset());
+      expired.erase(std::unique(expired.begin(), expired.end()), expired.end());
+      for(std::size_t i = expired.size(); i-- > 0; ) {
+	invalidate(expired[i]->key());
+	release(*expired[i], m_index, m_file);
+      }
+      return expired.size();
+    }
+
+    template<>
+    std::size_t HeapFileT<>::expireBlobs()
+    {
+      Operation op(*this);
+      checkWritable();
+      const std::size_t numExpired = doExpire();
+      logChanges();
+      return numExpired;
+    }
+
+    template<>
+    void HeapFileT<>::clear()
+    {
+      Operation op(*this);
+      checkWritable();
+      if (m_index.isPinned())
+	throw std::runtime_error("Can't clear a HeapFile w/ Snapshots open");
+      doClear();
+    }
+
+    // To guarantee that the HeapFile will shrink in size
+    // we have to remove entries from the end of the file, which could
+    // end up erasing recently added entries....depending on overall
+    // available space and how often we remove an entry from the heap file.
+    template<>
+    void HeapFileT<>::setMaxSize(uint64_t maxSize)
+    {
+      Operation op(*this);
+      checkWritable();
+      m_maxSize = maxSize;
+      if (NULL != m_cache.get())
+	m_cache->clear();
+
+      if (not m_index.isPinned())
+	shrinkToMaxSize(); // otherwise releaseSnapshot() will
+      logChanges();
+    }
+
+    template<class EP>
+    void HeapFileT<EP>::shrinkToMaxSize()
+    {
+      const uint64_t maxSize = m_maxSize;
+
+      if (EVICT_CLOCK == m_eviction) {
+	uint64_t evicted = 0; // since the last compaction
+	while (static_cast<uint64_t>(m_file.size()) > m_maxSize) {
+	  const uint32_t size = evictOne();
+	  if (0 == size) {
+	    doClear();
+	    m_maxSize = maxSize;
+	    return;
+	  }
+
+	  evicted += size;
+	  if (evicted >= m_file.size() - m_maxSize) {
+	    doCompact(uint64_t(-1));
+	    evicted = 0;
+	  }
+	}
+	if (static_cast<uint64_t>(m_file.physicalSize()) > m_maxSize)
+	  m_file.shrinkToFit();
+	return;
+      }
+
+      if (static_cast<uint64_t>(m_file.size()) < m_maxSize) {
+	// preallocated slack counts too
+	if (static_cast<uint64_t>(m_file.physicalSize()) > m_maxSize)
+	  m_file.shrinkToFit();
+	return;
+      }
+
+      if (0 == m_index.numAllocatedRecords()) {
+	doClear();
+	return;
+      }
+
+      // the Blobs dropped here go at once, and what the committed
+      // index holds can only go w/ a commit
+      if (0 != m_index.numHeldRecords())
+	commitIndex();
+      
+      const Record *rec = m_index.allRecords().back();
+      uint64_t currentSize = m_file.size();
+
+      // remove blobs from the end; it's a sure-fire way
+      // to shrink the heap file
+      do {
+	if (rec != m_committed) {
+	  invalidate(*rec);
+	  m_index.deallocate(*rec);
+	}else if (not commitIndex(true)) {
+	  // the index needs room nearer the front to move to
+	  const Record *prev = RecordList::prev(rec);
+	  while (m_index.isFree(*prev))
+	    prev = RecordList::prev(prev);
+	  invalidate(*prev);
+	  m_index.deallocate(*prev); // there's a Blob left, or we'd be clear
+	}
+
+	if (0 == m_index.numAllocatedRecords()) {
+	  doClear();
+	  return;
 	}
 
 	rec = m_index.allRecords().back();
-	currentSize = rec->offset() + rec->size() + m_index.size();
+	currentSize = dataEnd(m_index) + m_index.size();
       }while(currentSize > maxSize);
       
       m_file.trim(currentSize); // the real deallcation happens here
+      m_file.shrinkToFit();
+    }
+
+    template<>
+    HeapFileT<>::Compaction HeapFileT<>::compact(uint64_t budget)
+    {
+      Operation op(*this);
+      checkWritable();
+      const Compaction &result = doCompact(budget);
+      logChanges();
+      return result;
+    }
+
+    template<>
+    void HeapFileT<>::setEviction(Eviction eviction)
+    {
+      Operation op(*this);
+      m_eviction = eviction;
+    }
+
+    template<>
+    uint64_t HeapFileT<>::numEvictions() const
+    {
+      Operation op(*this, SHARED);
+      return m_numEvictions;
+    }
+
+    template<>
+    void HeapFileT<>::setAdmission(std::size_t sketchMemory)
+    {
+      Operation op(*this);
+      m_sketch.reset(0 == sketchMemory ? NULL : new FrequencySketch(sketchMemory));
+    }
+
+    template<>
+    std::size_t HeapFileT<>::admissionMemory() const
+    {
+      Operation op(*this, SHARED);
+      return (NULL == m_sketch.get()) ? 0 : m_sketch->memoryUsage();
+    }
+
+    template<>
+    uint64_t HeapFileT<>::numRejections() const
+    {
+      Operation op(*this, SHARED);
+      return m_numRejections;
+    }
+
+    template<>
+    void HeapFileT<>::setCache(std::size_t capacity, unsigned numShards)
+    {
+      Operation op(*this);
+      m_cache.reset(0 == capacity ? NULL : new BlobCache(capacity, numShards));
+    }
+
+    template<>
+    HeapFileT<>::CacheStats HeapFileT<>::cacheStats() const
+    {
+      Operation op(*this, SHARED);
+      return (NULL == m_cache.get()) ? CacheStats() : m_cache->stats();
+    }
+
+    template<>
+    void HeapFileT<>::setSlabThreshold(uint32_t size)
+    {
+      Operation op(*this);
+      m_index.setSlabThreshold(size);
+    }
+
+    template<class EP>
+    std::auto_ptr<typename HeapFileT<EP>::Snapshot> HeapFileT<EP>::snapshot()
+    {
+      return std::auto_ptr<Snapshot>(new Snapshot(*this));
+    }
+
+    template<class EP>
+    uint64_t HeapFileT<EP>::pinnedBytes() const
+    {
+      Operation op(*this, SHARED);
+      return m_index.numRetiredBytes();
+    }
+
+    template<class EP>
+    void HeapFileT<EP>::releaseSnapshot(uint64_t epoch)
+    {
+      Operation op(*this);
+      unpin(epoch);
+      logChanges();
+    }
+
+    // Frees whatever only _epoch_ kept retired, then catches up on
+    // what was put off while it was pinned.
+    template<class EP>
+    void HeapFileT<EP>::unpin(uint64_t epoch)
+    {
+      const uint64_t end = dataEnd(m_index);
+      m_index.unpin(epoch);
+      if (m_index.isPinned() or isReadOnly())
+	return;
+
+      if (0 == m_index.numAllocatedRecords() and
+	  0 == m_index.numHeldRecords()) {
+	m_index.clear(); // the committed index, if there's one, goes too
+	m_committed = NULL;
+	m_file.clear();
+	resetLog();
+      }else if (dataEnd(m_index) < end)
+	m_file.trim(dataEnd(m_index) + m_index.size());
+
+      if (static_cast<uint64_t>(m_file.size()) > m_maxSize)
+	shrinkToMaxSize();
+    }
+
+    // Copies the Records in file order, as serialize() has them.
+    template<class EP>
+    HeapFileT<EP>::Snapshot::Snapshot(HeapFileT &file)
+      : m_file(file), m_epoch(0), m_records(), m_byKey()
+    {
+      Operation op(file);
+      const HeapIndex &index = file.m_index;
+      m_records.reserve(index.numAllocatedRecords());
+      for(const Record *r = index.allRecords().front(); NULL != r;
+	  r = RecordList::next(r)) {
+	if (index.isFree(*r) or r->isRetired())
+	  continue;
+	const Slab *slab = index.findSlab(*r);
+	if (NULL == slab) {
+	  m_records.push_back(*r);
+	  continue;
+	}
+	for(std::size_t i = 0; i < slab->slots().size(); ++i) {
+	  const Record *slot = slab->slots()[i];
+	  if (NULL != slot and not slot->isRetired())
+	    m_records.push_back(*slot);
+	}
+      }
+
+      m_byKey.reserve(m_records.size());
+      for(std::size_t i = 0; i < m_records.size(); ++i)
+	m_byKey.push_back(std::make_pair(m_records[i].key(), uint32_t(i)));
+      std::sort(m_byKey.begin(), m_byKey.end());
+
+      m_epoch = file.m_index.pin();
+    }
+
+    template<class EP>
+    HeapFileT<EP>::Snapshot::~Snapshot()
+    {
+      try {
+	m_file.releaseSnapshot(m_epoch);
+      }
+      catch(const std::exception &e) // don't let exceptions escape destructors.
+      {
+	assert(!"Caught an exception in ~Snapshot()");
+      }
+    }
+
+    template<class EP>
+    const Record *HeapFileT<EP>::Snapshot::findRecord(const uint8_t *id,
+						      std::size_t idSize) const
+    {
+      const uint32_t hashCode = hash(id, idSize);
+      std::vector<std::pair<uint32_t, uint32_t> >::const_iterator itr =
+	std::lower_bound(m_byKey.begin(), m_byKey.end(), std::make_pair(hashCode, 0u));
+      for(; m_byKey.end() != itr and itr->first == hashCode; ++itr) {
+	const Record &r = m_records[itr->second];
+	if (Blob(r, m_file.m_file).hasId(id, idSize))
+	  return r.isExpired(currentTime()) ? NULL : &r;
+      }
+      return NULL;
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::Snapshot::hasBlob(const uint8_t *clearId,
+					  std::size_t idSize) const
+    {
+      Operation op(m_file, SHARED);
+      uint8_t id[Blob::MAX_ID_SIZE];
+      return m_file.encryptId(clearId, idSize, id) and
+	NULL != findRecord(id, idSize);
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::Snapshot::getBlob(const uint8_t *clearId,
+					  std::size_t idSize,
+					  std::vector<uint8_t> &data) const
+    {
+      Operation op(m_file, SHARED);
+      uint8_t id[Blob::MAX_ID_SIZE];
+      if (not m_file.encryptId(clearId, idSize, id))
+	return false;
+
+      const Record *r = findRecord(id, idSize);
+      return NULL != r and
+	Blob(*r, m_file.m_file).getData(Reader<EP>(data, m_file.m_key));
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::Snapshot::getBlobAt(std::size_t i,
+					    std::vector<uint8_t> &id,
+					    std::vector<uint8_t> &data) const
+    {
+      Operation op(m_file, SHARED);
+      const Record &r = m_records.at(i);
+      if (r.isExpired(currentTime()))
+	return false;
+
+      Blob b(r, m_file.m_file);
+      if (not b.getId(id) or not b.getData(Reader<EP>(data, m_file.m_key)))
+	return false;
+      if (not id.empty())
+	m_file.m_key.decrypt(&id[0], &id[0], id.size());
+      return true;
+    }
+
+    // What the maintenance thread does each time it wakes up, w/
+    // m_mutex held: a pass, unless the HeapFile was used since the
+    // last time.
+    template<class EP>
+    void HeapFileT<EP>::wakeUp(const MaintenanceOptions &options)
+    {
+      // stay out of the way while the HeapFile's in use
+      const uint64_t numOperations = m_numOperations.value();
+      if (numOperations != m_numOperationsSeen) {
+	m_numOperationsSeen = numOperations;
+	++m_maintenanceStats.pauses;
+	return;
+      }
+
+      try {
+	maintain(options);
+      }catch(const std::exception &e) {
+	++m_maintenanceStats.errors;
+      }
+    }
+
+    // One pass of maintenance, w/ m_mutex held.  m_lock is taken for
+    // each step, and compaction moves one Blob a step, so calls into
+    // the HeapFile get their turn in between.
+    template<class EP>
+    void HeapFileT<EP>::maintain(const MaintenanceOptions &options)
+    {
+      MaintenanceStats &stats = m_maintenanceStats;
+      uint64_t budget = std::max(uint64_t(1), options.bytesPerSecond *
+				 options.intervalMillis / 1000);
+      ++stats.passes;
+
+      if (options.expire and not isReadOnly()) {
+	ThreadUtils::RWLockGuard exclusive(m_lock, false);
+	stats.blobsExpired += doExpire();
+      }
+
+      while (options.compact and not isReadOnly() and 0 != budget) {
+	ThreadUtils::RWLockGuard exclusive(m_lock, false);
+	const Compaction &c = doCompact(budget, 1);
+	stats.bytesMoved += c.bytesMoved;
+	stats.bytesReclaimed += c.bytesReclaimed;
+	budget -= std::min(budget, c.bytesMoved);
+	if (0 == c.bytesMoved)
+	  break;
+      }
+
+      if (options.scrub) {
+	ThreadUtils::RWLockGuard exclusive(m_lock, false);
+	struct Verifier : public BlobReader
+	{
+	  virtual void readBlob(uint32_t, const uint8_t *) const {}
+	};
+
+	const RecordHashMap &records = m_index.allocRecords();
+	RecordHashMap::const_iterator itr = records.at(m_scrubSlot);
+	for(uint64_t scrubbed = 0; 
+	    itr != records.end() and scrubbed < budget; ++itr) {
+	  const Record &r = *itr->second;
+	  if (not Blob(r, m_file).getData(Verifier()))
+	    ++stats.corruptBlobs;
+	  scrubbed += r.size();
+	  stats.bytesScrubbed += r.size();
+	}
+	m_scrubSlot = (records.end() == itr) ? 0 : itr.slot(); // wrap around
+      }
+
+      ThreadUtils::RWLockGuard exclusive(m_lock, false);
+      if (options.flush and not isReadOnly()) {
+	m_file.flush();
+	++stats.flushes;
+      }
+      logChanges(); // the syncing thread, if there is one, syncs it
+    }
+
+    template<class EP>
+    void *HeapFileT<EP>::runMaintenance(void *heapFile)
+    {
+      HeapFileT &file = *static_cast<HeapFileT *>(heapFile);
+      ThreadUtils::MutexLock lock(file.m_mutex);
+
+      while (not file.m_stopMaintenance) {
+	// woken up early means we're being stopped (or nothing at all)
+	if (not file.m_maintenanceWakeUp.wait(file.m_mutex,
+					      file.m_maintenanceOptions.intervalMillis))
+	  file.wakeUp(file.m_maintenanceOptions);
+      }
+      return NULL;
+    }
+
+    template<class EP>
+    void HeapFileT<EP>::startMaintenance(const MaintenanceOptions &options)
+    {
+      stopMaintenance();
+
+      ThreadUtils::MutexLock lock(m_mutex);
+      m_maintenanceOptions = options;
+      m_maintenanceOptions.intervalMillis = std::max(1u, options.intervalMillis);
+      m_maintenanceStats = MaintenanceStats();
+      m_numOperationsSeen = m_numOperations.value();
+      m_stopMaintenance = false;
+
+      if (0 != pthread_create(&m_maintenanceThread, NULL,
+			      &HeapFileT::runMaintenance, this))
+	throw std::runtime_error("Failed to start the maintenance thread");
+      m_isMaintenanceRunning = true;
+    }
+
+    template<class EP>
+    void HeapFileT<EP>::stopMaintenance()
+    {
+      {
+	ThreadUtils::MutexLock lock(m_mutex);
+	if (not m_isMaintenanceRunning)
+	  return;
+	m_stopMaintenance = true;
+	m_maintenanceWakeUp.signal();
+      }
+
+      pthread_join(m_maintenanceThread, NULL);
+
+      ThreadUtils::MutexLock lock(m_mutex);
+      m_isMaintenanceRunning = false;
+    }
+
+    template<class EP>
+    bool HeapFileT<EP>::isMaintenanceRunning() const
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      return m_isMaintenanceRunning;
+    }
+
+    template<class EP>
+    typename HeapFileT<EP>::MaintenanceStats HeapFileT<EP>::maintenanceStats() const
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      return m_maintenanceStats;
+    }
+
+    template<class EP>
+    typename HeapFileT<EP>::MaintenanceStats
+    HeapFileT<EP>::maintainNow(const MaintenanceOptions &options)
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      wakeUp(options);
+      return m_maintenanceStats;
     }
 
     template class HeapFileT<DefaultEncryptionPolicy>;
@@ -0,0 +1,161 @@
+#include <heap_file_builder.h>
+#include <algorithm>
+#include <byte_order.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <heap_blob.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace EndianUtils;
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+      void raise(const string &path, const char *action)
+      {
+	throw runtime_error("Failed " + string(action) + " " + path +
+			    " with error: " + strerror(errno));
+      }
+
+      // All of it, unless there's an error.
+      void writeAll(int fd, const uint8_t *p, size_t size, const string &path)
+      {
+	while (size > 0) {
+	  ssize_t n = write(fd, p, size);
+	  if (n < 0 and EINTR == errno)
+	    continue;
+	  if (n < 0)
+	    raise(path, "writing");
+	  p += n;
+	  size -= n;
+	}
+      }
+    } // end namespace <anonymous>
+
+    template<class EP>
+    HeapFileBuilderT<EP>::HeapFileBuilderT(const string &path,
+					   const vector<uint8_t> &key,
+					   size_t bufferSize)
+      : m_path(path), m_fd(-1), m_key(key), m_index(),
+	m_buffer(max(bufferSize, size_t(Record::MIN_SIZE))),
+	m_buffered(0), m_size(0)
+    {
+      // S_IRUSR - Read bit for file owner
+      // S_IWUSR - Write bit for file owner
+      if (0 > (m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+			   S_IRUSR | S_IWUSR)))
+	raise(m_path, "opening");
+
+      // a header of zero puts the index at the start of the file,
+      // which says there are no Records until finish() says otherwise
+      uint8_t *p = reserve(sizeof(uint64_t));
+      memset(p, 0, sizeof(uint64_t));
+    }
+
+    template<class EP>
+    HeapFileBuilderT<EP>::~HeapFileBuilderT()
+    {
+      try {
+	finish();
+      }
+      catch(const std::exception &e) // don't let exceptions escape destructors.
+      {
+	if (not isFinished())
+	  close(m_fd);
+      }
+    }
+
+    // Room for _size_ more bytes at the end of the buffer.
+    template<class EP>
+    uint8_t *HeapFileBuilderT<EP>::reserve(size_t size)
+    {
+      if (m_buffered + size > m_buffer.size())
+	flush();
+      if (size > m_buffer.size())
+	m_buffer.resize(size);
+
+      uint8_t *p = &m_buffer[m_buffered];
+      m_buffered += size;
+      m_size += size;
+      return p;
+    }
+
+    template<class EP>
+    void HeapFileBuilderT<EP>::flush()
+    {
+      if (0 != m_buffered)
+	writeAll(m_fd, &m_buffer[0], m_buffered, m_path);
+      m_buffered = 0;
+    }
+
+    template<class EP>
+    bool HeapFileBuilderT<EP>::add(const uint8_t *clearId, size_t idSize,
+				   const uint8_t *data, size_t dataSize)
+    {
+      if (isFinished() or idSize > Blob::MAX_ID_SIZE)
+	return false;
+
+      uint8_t id[Blob::MAX_ID_SIZE];
+      m_key.encrypt(clearId, id, idSize);
+
+      const Record *r = m_index.extend(m_size, Blob::blobSize(idSize, dataSize),
+				       hash(id, idSize));
+      assert(r->offset() == m_size);
+
+      uint8_t *p = reserve(r->size());
+      memset(p, 0, r->size()); // whatever doesn't hold the Blob
+
+      Blob b(p, *r);
+      if (b.writeData(id, idSize, EncryptingWriter<EP>(data, dataSize, m_key)))
+	return true;
+
+      // it's the last thing in the buffer, so take it back out
+      m_buffered -= r->size();
+      m_size -= r->size();
+      m_index.deallocate(*r);
+      return false;
+    }
+
+    template<class EP>
+    void HeapFileBuilderT<EP>::finish()
+    {
+      if (isFinished())
+	return;
+
+      if (0 == m_index.numAllocatedRecords()) {
+	// HeapFileT keeps an empty HeapFile as an empty file
+	m_buffered = 0;
+	m_size = 0;
+	if (0 != ftruncate(m_fd, 0))
+	  raise(m_path, "truncating");
+      }else {
+	const uint64_t indexOffset = m_size;
+	char *p = reinterpret_cast<char *>(reserve(m_index.size()));
+	writeH2N(p, m_index.numSerializedRecords()); // advances p
+	m_index.serialize(p); // advances p
+	flush();
+	if (0 != fdatasync(m_fd))
+	  raise(m_path, "syncing");
+
+	// only now, w/ the index on disk, does the header point at it
+	uint8_t header[sizeof(uint64_t)];
+	uint8_t *h = header;
+	writeH2N(h, indexOffset);
+	if (ssize_t(sizeof(header)) != pwrite(m_fd, header, sizeof(header), 0))
+	  raise(m_path, "writing");
+      }
+
+      if (0 != fdatasync(m_fd))
+	raise(m_path, "syncing");
+      close(m_fd);
+      m_fd = -1;
+    }
+
+    template class HeapFileBuilderT<DefaultEncryptionPolicy>;
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
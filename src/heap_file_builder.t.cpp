@@ -0,0 +1,128 @@
+#include <heap_file_builder.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <heap_blob.h>
+#include <heap_file.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unit_test.h>
+#include <vector>
+
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+using namespace std;
+
+namespace { // <anonymous>
+  typedef vector<uint8_t> Vec;
+
+  Vec makeKey(uint32_t i)
+  {
+    Vec key(sizeof(i));
+    memcpy(&key[0], &i, sizeof(i));
+    return key;
+  }
+
+  Vec makeBlob(uint32_t i)
+  {
+    return Vec((i * 37) % 1500, static_cast<uint8_t>(i));
+  }
+
+  void testBuildHeapFile(UnitTestControl &utc)
+  {
+    const string tmpFileName = tmpnam(NULL);
+    Vec encryptionKey(16);
+    for(size_t i = 0; i < encryptionKey.size(); ++i)
+      encryptionKey[i] = static_cast<uint8_t>(rand());
+
+    const uint32_t numBlobs = 3000;
+    uint64_t builtSize = 0;
+    {
+      // a small buffer, so some Blobs don't fit in it
+      HeapFileBuilder builder(tmpFileName, encryptionKey, 1000);
+      for(uint32_t i = 0; i < numBlobs; ++i)
+	TEST_ASSERT(utc, builder.add(makeKey(i), makeBlob(i)));
+      TEST_ASSERT(utc, not builder.add(Vec(Blob::MAX_ID_SIZE + 1, 'x'), Vec(1, 1)));
+      TEST_ASSERT(utc, numBlobs == builder.numBlobs());
+
+      builder.finish();
+      TEST_ASSERT(utc, builder.isFinished());
+      TEST_ASSERT(utc, not builder.add(makeKey(numBlobs), Vec(1, 1)));
+      builder.finish(); // does nothing
+      builtSize = builder.size();
+
+      struct stat st;
+      TEST_ASSERT(utc, 0 == stat(tmpFileName.c_str(), &st));
+      TEST_ASSERT(utc, builtSize == static_cast<uint64_t>(st.st_size));
+    }
+
+    {
+      HeapFile file(tmpFileName, encryptionKey);
+      TEST_ASSERT(utc, builtSize == file.size());
+      TEST_ASSERT(utc, numBlobs == file.getIndex().numAllocatedRecords());
+      TEST_ASSERT(utc, 0 == file.getIndex().numFreeRecords());
+
+      for(uint32_t i = 0; i < numBlobs; ++i) {
+	Vec dataOut;
+	TEST_ASSERT(utc, file.getBlob(makeKey(i), dataOut));
+	TEST_ASSERT(utc, makeBlob(i) == dataOut);
+      }
+
+      // it's a HeapFile like any other
+      TEST_ASSERT(utc, file.eraseBlob(makeKey(7)));
+      TEST_ASSERT(utc, file.writeBlob(makeKey(numBlobs), Vec(10, 1)));
+    }
+
+    {
+      HeapFile file(tmpFileName, encryptionKey);
+      Vec dataOut;
+      TEST_ASSERT(utc, not file.hasBlob(makeKey(7)));
+      TEST_ASSERT(utc, file.getBlob(makeKey(numBlobs), dataOut));
+      TEST_ASSERT(utc, Vec(10, 1) == dataOut);
+      TEST_ASSERT(utc, file.getBlob(makeKey(numBlobs - 1), dataOut));
+      TEST_ASSERT(utc, makeBlob(numBlobs - 1) == dataOut);
+    }
+
+    unlink(tmpFileName.c_str());
+  }
+
+  void testBuildEmptyHeapFile(UnitTestControl &utc)
+  {
+    const string tmpFileName = tmpnam(NULL);
+
+    { // the destructor finishes it
+      HeapFileBuilder builder(tmpFileName);
+    }
+    struct stat st;
+    TEST_ASSERT(utc, 0 == stat(tmpFileName.c_str(), &st));
+    TEST_ASSERT(utc, 0 == st.st_size);
+
+    {
+      HeapFile file(tmpFileName);
+      TEST_ASSERT(utc, 0 == file.size());
+      TEST_ASSERT(utc, 0 == file.getIndex().numAllocatedRecords());
+    }
+
+    { // a file that's there already is started over
+      HeapFile file(tmpFileName);
+      TEST_ASSERT(utc, file.writeBlob(makeKey(1), makeBlob(1)));
+    }
+    {
+      HeapFileBuilder builder(tmpFileName);
+      TEST_ASSERT(utc, builder.add(makeKey(2), makeBlob(2)));
+    }
+    {
+      HeapFile file(tmpFileName);
+      TEST_ASSERT(utc, not file.hasBlob(makeKey(1)));
+      TEST_ASSERT(utc, file.hasBlob(makeKey(2)));
+    }
+
+    unlink(tmpFileName.c_str());
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testBuildHeapFile, &::testBuildHeapFile)
+REGISTER_TEST(testBuildEmptyHeapFile, &::testBuildEmptyHeapFile)
@@ -1,5 +1,7 @@
 #include <heap_index.h>
 #include <byte_order.h>
+#include <heap_slab.h>
+#include <limits>
 #include <ostream>
 #include <stdexcept>
 
@@ -11,57 +13,62 @@ namespace FileUtils {
 
     const std::size_t Record::SERIALIZED_SIZE = sizeof(uint64_t) + 2*sizeof(uint32_t);
     const uint32_t Record::MIN_SIZE = 256;
+    const uint32_t HeapIndex::EXPIRY_MAGIC = 0x54544c31; // "TTL1"
 
     namespace { // <anonymous>
 
-      RecordMap::value_type toFreeKey(Record *p)
-      {
-	return make_pair(p->size(), p);
-      }
-      
-      RecordMap::value_type toAllocKey(Record *p)
+      RecordHashMap::value_type toAllocKey(Record *p)
       {
 	return make_pair(p->key(), p);
       }
 
-      bool recordPtrCmp(const Record *lhs, const Record *rhs)
-      {
-	return lhs->offset() < rhs->offset();
-      }
+      const uint32_t NOT_FREE = numeric_limits<uint32_t>::max();
 
-      bool removeIfFree(RecordMap &map, Record *r)
-      {
-	typedef RecordMap::iterator Itr;
-	pair<Itr, Itr> range = map.equal_range(r->size());
-
-	for(; range.first != range.second; ++range.first) {
-	  if (range.first->second != r)
-	    continue;
-	  map.erase(range.first);
-	  return true;
-	}
-	return false;
-      }
+      // the top bit of a serialized size marks a Slab
+      const uint32_t SLAB_BIT = uint32_t(1) << 31;
 
     } // end namespace <anonymous>
 
     Record::Record()
-      : m_offset(0), m_key(0), m_size(0)
+      : m_offset(0), m_key(0), m_size(0), m_prev(NULL), m_next(NULL), m_freeSlot(NOT_FREE), m_kind(BLOCK), m_referenced(0), m_retired(0), m_committed(0),
+	m_expiry(0)
     {}
   
     Record::Record(uint64_t off, uint32_t key, uint32_t size, bool toMinSize)
-      : m_offset(off), m_key(key), m_size(std::max(size, toMinSize ? MIN_SIZE: 0))
+      : m_offset(off), m_key(key), m_size(std::max(size, toMinSize ? MIN_SIZE: 0)),
+	m_prev(NULL), m_next(NULL), m_freeSlot(NOT_FREE), m_kind(BLOCK), m_referenced(0), m_retired(0), m_committed(0),
+	m_expiry(0)
     {}
 
     Record::Record(const char *&p)
-      : m_offset(0), m_key(0), m_size(0)
+      : m_offset(0), m_key(0), m_size(0), m_prev(NULL), m_next(NULL), m_freeSlot(NOT_FREE), m_kind(BLOCK), m_referenced(0), m_retired(0), m_committed(0),
+	m_expiry(0)
     {
       deserialize(p);
     }
 
+    Record::Record(const Record &r)
+      : m_offset(r.m_offset), m_key(r.m_key), m_size(r.m_size),
+	m_prev(NULL), m_next(NULL), m_freeSlot(NOT_FREE), m_kind(r.m_kind),
+	m_referenced(r.m_referenced), m_retired(0), m_committed(0),
+	m_expiry(r.m_expiry)
+    {}
+
+    Record &Record::operator=(const Record &r)
+    {
+      m_offset = r.m_offset;
+      m_key    = r.m_key;
+      m_size   = r.m_size;
+      m_kind   = r.m_kind;
+      m_referenced = r.m_referenced;
+      m_expiry = r.m_expiry;
+      return *this;
+    }
+
     Record::Record(const Record &lhs, const Record &rhs)
       : m_offset(lhs.m_offset + lhs.m_size), m_key(0), 
-	m_size(rhs.m_offset - m_offset)
+	m_size(rhs.m_offset - m_offset), m_prev(NULL), m_next(NULL), m_freeSlot(NOT_FREE), m_kind(BLOCK), m_referenced(0), m_retired(0), m_committed(0),
+	m_expiry(0)
     {
       if( lhs.m_offset + lhs.m_size >=  rhs.m_offset ) {
 	throw runtime_error("Attempt to construct empty Record failed");
@@ -70,16 +77,22 @@ namespace FileUtils {
 
     uint32_t Record::serialize(char *&p) const 
     {
+      assert(0 == (m_size & SLAB_BIT));
+
       return writeH2N(p, m_offset)
 	+ writeH2N(p, m_key)
-	+ writeH2N(p, m_size);
+	+ writeH2N(p, isSlab() ? m_size | SLAB_BIT : m_size);
     }
 
     uint32_t Record::deserialize(const char *&s)
     {
-      return readN2H(s, m_offset)
+      uint32_t numRead = readN2H(s, m_offset)
 	+ readN2H(s, m_key)
 	+ readN2H(s, m_size);
+
+      m_kind = (m_size & SLAB_BIT) ? SLAB : BLOCK;
+      m_size &= ~SLAB_BIT;
+      return numRead;
     }
   
     bool Record::sharesRightBoundaryWith(const Record &rhs) const
@@ -136,54 +149,183 @@ namespace FileUtils {
       return strm;
     }
 
+    void RecordList::push_back(Record *r)
+    {
+      assert(NULL != r and NULL == r->m_prev and NULL == r->m_next);
+
+      r->m_prev = m_tail;
+      if (NULL != m_tail)
+	m_tail->m_next = r;
+      else
+	m_head = r;
+      m_tail = r;
+      ++m_size;
+    }
+
+    void RecordList::insert(Record *pos, Record *r)
+    {
+      assert(NULL != pos and NULL != r);
+      assert(NULL == r->m_prev and NULL == r->m_next);
+
+      r->m_next = pos;
+      r->m_prev = pos->m_prev;
+      if (NULL != pos->m_prev)
+	pos->m_prev->m_next = r;
+      else
+	m_head = r;
+      pos->m_prev = r;
+      ++m_size;
+    }
+
+    void RecordList::erase(Record *r)
+    {
+      assert(NULL != r and 0 != m_size);
+
+      if (NULL != r->m_prev)
+	r->m_prev->m_next = r->m_next;
+      else
+	m_head = r->m_next;
+
+      if (NULL != r->m_next)
+	r->m_next->m_prev = r->m_prev;
+      else
+	m_tail = r->m_prev;
+
+      r->m_prev = r->m_next = NULL;
+      --m_size;
+    }
+
+    Record *RecordList::pop_back()
+    {
+      Record *r = m_tail;
+      erase(r);
+      return r;
+    }
+
+    void RecordList::clear()
+    {
+      m_head = m_tail = NULL;
+      m_size = 0;
+    }
+
+    HeapIndex::HeapIndex()
+      : m_list(), m_alloc(), m_free(), m_slabThreshold(0),
+	m_numExpiring(0), m_slabs(), m_partialSlabs(), m_epoch(0), m_pins(),
+	m_retired(), m_retiredBytes(0), m_held(), m_heldBytes(0),
+	m_numReserved(0), m_journal(NULL)
+    {}
+
     HeapIndex::~HeapIndex()
     {
+      m_journal = NULL; // the index is going, not changing
       clear();
     }
 
     void HeapIndex::clear()
     {
+      for(SlabMap::iterator itr = m_slabs.begin(); itr != m_slabs.end(); ++itr)
+	delete itr->second;
+      m_slabs.clear();
+      m_partialSlabs.clear();
+
       m_alloc.clear();
       m_free.clear();
+      m_numExpiring = 0;
+      m_retired.clear(); // the epochs stay pinned
+      m_retiredBytes = 0;
+      m_held.clear();
+      m_heldBytes = 0;
+      m_numReserved = 0;
+
+      for(Record *p = m_list.front(), *q = NULL; NULL != p; p = q) {
+	q = RecordList::next(p);
+	delete p;
+      }
+      m_list.clear();
+
+      if (NULL != m_journal)
+	m_journal->cleared();
+    }
+
+    void HeapIndex::setSlabThreshold(uint32_t size)
+    {
+      m_slabThreshold = std::min(size, Slab::MAX_SLOT_SIZE);
+    }
 
-      typedef RecordList::iterator Itr;
-      for(Itr p = m_list.begin(), q = m_list.end(); p != q; ++p)
-	delete *p;
+    bool HeapIndex::usesSlab(uint32_t size) const
+    {
+      return size <= m_slabThreshold;
     }
 
     // I'm keeping this pointer
-    void HeapIndex::addAllocatedBlock(std::auto_ptr<Record> p)
+    Record *HeapIndex::appendBlock(std::auto_ptr<Record> p)
     {
       if (not m_list.empty()) {
 	const Record &last = *m_list.back();
 	if (not last.sharesRightBoundaryWith(*p)) {
 	  m_list.push_back(new Record(last, *p)); // empty record
-	  m_free.insert(toFreeKey(m_list.back()));
+	  m_free.insert(m_list.back());
 	}
       }
 
       m_list.push_back(p.release());
-      m_alloc.insert(toAllocKey(m_list.back()));
+      return m_list.back();
     }
 
-    // Worst-case scenario here is all free records
-    // are of the same size!  So this degrades to O(n)
-    // run-time cost from O(log n) + O(_num_collisions_)
-    // where n is the number of free records and
-    // _num_collisions_ is the number of Records with 
-    // the same size.
-    bool HeapIndex::isFree(const Record &p) const
+    Record *HeapIndex::addAllocatedBlock(std::auto_ptr<Record> p)
     {
-      typedef RecordMap::const_iterator Itr;
-      pair<Itr, Itr> range = m_free.equal_range(p.size());
-      for(; range.first != range.second; ++range.first) {
-	const Record *q = range.first->second;
-	assert(NULL != q);
-	if (*q == p)
-	  return true;
+      Record *last = m_list.back();
+      if (NULL != last and last->isSlab() and 
+	  p->offset() < last->offset() + last->size()) {
+	Slab *slab = m_slabs[last->offset()];
+	Record *r = slab->adopt(p);
+	if (NULL == r)
+	  throw runtime_error("Record does not fit a slot of its Slab");
+	m_alloc.insert(toAllocKey(r));
+	if (NULL != m_journal)
+	  m_journal->added(*r);
+	if (slab->isFull())
+	  m_partialSlabs.erase(make_pair(slab->slotSize(), last->offset()));
+	return r;
       }
 
-      return false;
+      if (p->isSlab()) {
+	const uint32_t slotSize = p->key();
+	if (0 == slotSize or slotSize > Slab::MAX_SLOT_SIZE or
+	    slotSize != Slab::slotSizeFor(slotSize))
+	  throw runtime_error("Slab with an invalid slot size");
+	Record *r = appendBlock(p);
+	newSlab(*r, slotSize);
+	return r;
+      }
+
+      Record *r = appendBlock(p);
+      m_alloc.insert(toAllocKey(r));
+      if (NULL != m_journal)
+	m_journal->added(*r);
+      return r;
+    }
+
+    Record *HeapIndex::extend(uint64_t offset, uint32_t size, uint32_t key)
+    {
+      if (usesSlab(size)) {
+	const uint32_t slotSize = Slab::slotSizeFor(size);
+	auto_ptr<Record> p(new Record(offset, slotSize, Slab::SIZE));
+	newSlab(*appendBlock(p), slotSize);
+	return allocateSlot(size, key);
+      }
+
+      auto_ptr<Record> p(new Record(offset, key, size, true));
+      Record *r = appendBlock(p);
+      m_alloc.insert(toAllocKey(r));
+      if (NULL != m_journal)
+	m_journal->added(*r);
+      return r;
+    }
+
+    bool HeapIndex::isFree(const Record &p) const
+    {
+      return m_free.contains(p);
     }
 
     bool HeapIndex::isLast(const Record &r) const
@@ -194,52 +336,46 @@ namespace FileUtils {
       return r == *(m_list.back());
     }
 
-    bool HeapIndex::coalesce(Record *r)
+    // Both neighbours are a link away and telling whether they're free
+    // is constant time, so this is too.
+    void HeapIndex::coalesce(Record *r)
     {
-      typedef RecordList::iterator Itr;
-      pair<Itr, Itr> range = std::equal_range(m_list.begin(), 
-					      m_list.end(),
-					      r,
-					      recordPtrCmp);
-      for(; range.first != range.second; ++range.first)
-      {
-	if (**(range.first) != *r)
-	  continue;
-	assert((*range.first) == r);
-	  
-	// coalesce left
-	if (m_list.begin() != range.first) { // not the front
-	  Itr leftItr(range.first); 
-	  --leftItr;
-	  Record *leftRec = *leftItr;
-	  assert(NULL != leftRec);
-	  if (removeIfFree(m_free, leftRec)) {
-	    std::auto_ptr<Record> release(leftRec);
-	    m_list.erase(leftItr);
-	    r->coalesce(*release);
-	  }
-	}
+      assert(NULL != r);
+
+      // coalesce left
+      Record *leftRec = RecordList::prev(r);
+      if (NULL != leftRec and m_free.erase(leftRec)) {
+	m_list.erase(leftRec);
+	std::auto_ptr<Record> release(leftRec);
+	r->coalesce(*release);
+      }
 
-	// coalesce right
-	if (m_list.back() != *range.first) { // not the back
-	  Itr rightItr(range.first);
-	  ++rightItr;
-	  Record *rightRec = *rightItr;
-	  assert(NULL != rightRec);
-	  if (removeIfFree(m_free, rightRec)) {
-	    std::auto_ptr<Record> release(rightRec);
-	    m_list.erase(rightItr);
-	    r->coalesce(*release);
-	  }
-	}
-	return true;
+      // coalesce right
+      Record *rightRec = RecordList::next(r);
+      if (NULL != rightRec and m_free.erase(rightRec)) {
+	m_list.erase(rightRec);
+	std::auto_ptr<Record> release(rightRec);
+	r->coalesce(*release);
+      }
+    }
+
+    void HeapIndex::freeBlock(Record *r)
+    {
+      r->m_committed = 0;
+      coalesce(r);
+
+      if (m_list.back() == r) {
+	std::auto_ptr<Record> release(m_list.pop_back());
+      }else {
+	m_free.insert(r);
       }
-      return false;
     }
    
-    bool HeapIndex::deallocate(const Record &rec)
+    // Takes the allocated Record matching _rec_ out of m_alloc.
+    // Returns NULL if there's none.
+    Record *HeapIndex::takeAllocated(const Record &rec)
     {
-      typedef RecordMap::iterator Itr;
+      typedef RecordHashMap::const_iterator Itr;
       pair<Itr, Itr> range = m_alloc.equal_range(rec.key());
       
       for(; range.first != range.second; ++range.first) {
@@ -249,19 +385,164 @@ namespace FileUtils {
 	  continue;
 
 	m_alloc.erase(range.first);
-	  
-	coalesce(r);
-
-	if (*m_list.back() == *r) {
-	  std::auto_ptr<Record> release(m_list.back());
-	  m_list.pop_back();
-	}else {
-	  m_free.insert(toFreeKey(r));
+	clearExpiry(*r);
+	if (NULL != m_journal)
+	  m_journal->dropped(*r);
+	return r;
+      }
+						 
+      return NULL;
+    }
+
+    bool HeapIndex::deallocate(const Record &rec)
+    {
+      if (rec.isSlab())
+	return freeSlab(rec.offset());
+
+      Record *r = takeAllocated(rec);
+      if (NULL == r)
+	return false;
+
+      if (r->isSlabSlot())
+	releaseSlot(r);
+      else
+	freeBlock(r);
+      return true;
+    }
+
+    uint64_t HeapIndex::pin()
+    {
+      m_pins.insert(m_epoch);
+      return m_epoch++;
+    }
+
+    // Frees what was retired while nothing older than the oldest
+    // epoch still pinned was, which is everything if none is.
+    void HeapIndex::unpin(uint64_t epoch)
+    {
+      std::multiset<uint64_t>::iterator itr = m_pins.find(epoch);
+      assert(m_pins.end() != itr);
+      if (m_pins.end() != itr)
+	m_pins.erase(itr);
+
+      const uint64_t oldest = m_pins.empty() ? m_epoch : *m_pins.begin();
+      while (not m_retired.empty() and m_retired.front().first <= oldest) {
+	Record *r = m_retired.front().second;
+	m_retired.pop_front();
+	m_retiredBytes -= r->size();
+	r->m_retired = 0;
+	freeOrHold(r);
+      }
+    }
+
+    void HeapIndex::retireRecord(Record *r)
+    {
+      r->m_retired = 1;
+      m_retired.push_back(Retired(m_epoch, r));
+      m_retiredBytes += r->size();
+    }
+
+    // Frees _r_, out of m_alloc already, unless the committed index
+    // has it; then it's held until markCommitted().
+    void HeapIndex::freeOrHold(Record *r)
+    {
+      if (r->isCommitted()) {
+	r->m_retired = 1;
+	m_held.push_back(r);
+	m_heldBytes += r->size();
+      }else if (r->isSlabSlot())
+	releaseSlot(r);
+      else
+	freeBlock(r);
+    }
+
+    bool HeapIndex::retire(const Record &rec)
+    {
+      if (rec.isSlab()) {
+	SlabMap::iterator itr = m_slabs.find(rec.offset());
+	if (m_slabs.end() == itr)
+	  return false;
+
+	// Freeing the last slot deletes the Slab, so it's all freed at
+	// once unless a committed slot keeps it.
+	const std::vector<Record *> &slots = itr->second->slots();
+	bool isKept = isPinned();
+	for(size_t i = 0; i < slots.size() and not isKept; ++i)
+	  isKept = NULL != slots[i] and slots[i]->isCommitted();
+	if (not isKept)
+	  return freeSlab(rec.offset());
+
+	for(size_t i = 0; i < slots.size(); ++i) {
+	  if (NULL == slots[i] or slots[i]->isRetired())
+	    continue;
+	  Record *slot = takeAllocated(*slots[i]);
+	  if (isPinned())
+	    retireRecord(slot);
+	  else
+	    freeOrHold(slot);
 	}
 	return true;
       }
-						 
-      return false;
+
+      Record *r = takeAllocated(rec);
+      if (NULL == r)
+	return false;
+      if (isPinned())
+	retireRecord(r);
+      else
+	freeOrHold(r);
+      return true;
+    }
+
+    // The Records retired now are in no committed index any more, and
+    // whatever the one just committed has is.
+    void HeapIndex::markCommitted()
+    {
+      for(size_t i = 0; i < m_held.size(); ++i) {
+	Record *r = m_held[i];
+	r->m_retired = 0;
+	if (r->isSlabSlot())
+	  releaseSlot(r);
+	else
+	  freeBlock(r);
+      }
+      m_held.clear();
+      m_heldBytes = 0;
+
+      for(size_t i = 0; i < m_retired.size(); ++i)
+	m_retired[i].second->m_committed = 0;
+      for(RecordHashMap::const_iterator itr = m_alloc.begin();
+	  itr != m_alloc.end(); ++itr)
+	itr->second->m_committed = 1;
+    }
+
+    Record *HeapIndex::reserve(uint32_t size, uint64_t end)
+    {
+      Record *r = takeFreeBlock(size);
+      if (NULL == r)
+	return reserveAt(end, size);
+
+      r->setKey(0);
+      r->m_retired = 1;
+      ++m_numReserved;
+      return r;
+    }
+
+    Record *HeapIndex::reserveAt(uint64_t offset, uint32_t size)
+    {
+      auto_ptr<Record> p(new Record(offset, 0, size));
+      Record *r = appendBlock(p);
+      r->m_retired = 1;
+      ++m_numReserved;
+      return r;
+    }
+
+    void HeapIndex::unreserve(Record *r)
+    {
+      assert(NULL != r and r->isRetired() and 0 != m_numReserved);
+      r->m_retired = 0;
+      --m_numReserved;
+      freeBlock(r);
     }
 
     // On the call to allocate(), we search for an empty record.
@@ -280,48 +561,273 @@ namespace FileUtils {
     // be at least in the hundreds of bytes.  So as to keep the
     // metadata-to-payload ratio low, I've set the minimum size to 256
     // bytes which puts said ratio at about .13 in the worst case.
+    // Blobs smaller than that can go into the slots of a Slab instead
+    // if the slab threshold is set.
     Record *HeapIndex::allocate(uint32_t size, uint32_t key)
     {
+      if (usesSlab(size))
+	return allocateSlot(size, key);
+
+      Record *r = takeFreeBlock(size);
+      if (NULL == r)
+	return NULL;
+
+      r->setKey(key);
+      m_alloc.insert(toAllocKey(r));
+      if (NULL != m_journal)
+	m_journal->added(*r);
+      return r;
+    }
+
+    bool HeapIndex::isGoodFit(const Record &r, uint32_t size) const
+    {
+      if (size > r.size())
+	return false;
+
+      if (r.isSlabSlot())
+	return usesSlab(size) and Slab::slotSizeFor(size) == r.size();
+
+      if (usesSlab(size))
+	return false; // it belongs in a Slab
 
+      // see takeFreeBlock()
+      return r.size() - std::max(size, Record::MIN_SIZE) < Record::MIN_SIZE;
+    }
+
+    // Returns a block of at least _size_ bytes that's in m_list but
+    // neither free nor allocated yet, or NULL.
+    Record *HeapIndex::takeFreeBlock(uint32_t size)
+    {
       size = std::max(size, Record::MIN_SIZE);
 
-      RecordMap::iterator freeItr = m_free.lower_bound(size);
+      Record *r = m_free.takeFit(size); // removes it from the free blocks
       
-      if (m_free.end() == freeItr)
+      if (NULL == r)
 	return NULL;
-      
-      Record *r = freeItr->second;
-      m_free.erase(freeItr); // remove it from the free blocks container
 
-      if (size > r->size() - Record::MIN_SIZE) {
-	r->setKey(key);
-	m_alloc.insert(toAllocKey(r));
+      if (size > r->size() - Record::MIN_SIZE)
 	return r; // allocate the whole block
-      }
       // else, split'er up
 
       auto_ptr<Record> left = r->splitOffLeft(size);
-      m_free.insert(toFreeKey(r)); // add _r_ back in w/ a new size
+      m_free.insert(r); // add _r_ back in w/ a new size
 
+      // _r_ is already linked in the block list; put _left_ in front of it.
+      m_list.insert(r, left.get());
+      return left.release();
+    }
+
+    Record *HeapIndex::allocateSlot(uint32_t size, uint32_t key)
+    {
+      const uint32_t slotSize = Slab::slotSizeFor(size);
+
+      Slab *slab = NULL;
+      SlabSet::iterator itr = m_partialSlabs.lower_bound(make_pair(slotSize, uint64_t(0)));
+      if (m_partialSlabs.end() != itr and slotSize == itr->first) {
+	slab = m_slabs[itr->second];
+      }else {
+	Record *r = takeFreeBlock(Slab::SIZE);
+	if (NULL == r)
+	  return NULL;
+	slab = newSlab(*r, slotSize);
+      }
 
-      // now find _r_ in the block list and insert _left_ in front of it.
-      typedef RecordList::iterator Itr;
-      Itr itr = std::lower_bound(m_list.begin(), m_list.end(), 
-				 r, recordPtrCmp);
-      assert(itr != m_list.end());
-      assert(*itr == r);
+      Record *slot = slab->allocate(key);
+      assert(NULL != slot);
+      m_alloc.insert(toAllocKey(slot));
+      if (NULL != m_journal)
+	m_journal->added(*slot);
 
-      m_list.insert(itr, left.get());
-      left->setKey(key);
-      m_alloc.insert(toAllocKey(left.get()));
-      return left.release();
+      if (slab->isFull())
+	m_partialSlabs.erase(make_pair(slotSize, slab->record().offset()));
+      return slot;
+    }
+
+    Slab *HeapIndex::newSlab(Record &r, uint32_t slotSize)
+    {
+      Slab *slab = new Slab(r, slotSize);
+      m_slabs[r.offset()] = slab;
+      m_partialSlabs.insert(make_pair(slotSize, r.offset()));
+      if (NULL != m_journal)
+	m_journal->added(r);
+      return slab;
+    }
+
+    void HeapIndex::releaseSlot(Record *r)
+    {
+      r->m_committed = 0;
+      SlabMap::iterator itr = m_slabs.upper_bound(r->offset());
+      assert(m_slabs.begin() != itr);
+      --itr;
+
+      Slab *slab = itr->second;
+      assert(slab->contains(r->offset()));
+      slab->release(r);
+
+      if (slab->isEmpty())
+	deleteSlab(itr);
+      else
+	m_partialSlabs.insert(make_pair(slab->slotSize(), itr->first));
+    }
+
+    bool HeapIndex::freeSlab(uint64_t offset)
+    {
+      SlabMap::iterator itr = m_slabs.find(offset);
+      if (m_slabs.end() == itr)
+	return false;
+
+      typedef RecordHashMap::const_iterator Itr;
+      const std::vector<Record *> &slots = itr->second->slots();
+      for(size_t i = 0; i < slots.size(); ++i) {
+	if (NULL == slots[i])
+	  continue;
+	pair<Itr, Itr> range = m_alloc.equal_range(slots[i]->key());
+	while(range.first->second != slots[i])
+	  ++range.first;
+	m_alloc.erase(range.first);
+	clearExpiry(*slots[i]);
+      }
+
+      deleteSlab(itr);
+      return true;
+    }
+
+    // Deletes the Slab and its slot Records and frees its block.
+    void HeapIndex::deleteSlab(SlabMap::iterator itr)
+    {
+      Slab *slab = itr->second;
+      Record *r = &slab->record();
+
+      m_partialSlabs.erase(make_pair(slab->slotSize(), itr->first));
+      m_slabs.erase(itr);
+      if (NULL != m_journal)
+	m_journal->dropped(*r); // while it's still a Slab
+      delete slab;
+
+      freeBlock(r);
+    }
+
+    const Slab *HeapIndex::findSlab(const Record &r) const
+    {
+      if (not r.isSlab())
+	return NULL;
+      SlabMap::const_iterator itr = m_slabs.find(r.offset());
+      return m_slabs.end() == itr ? NULL : itr->second;
+    }
+
+    uint32_t HeapIndex::numSerializedRecords() const
+    {
+      return m_alloc.size() + m_slabs.size();
     }
 
     uint32_t HeapIndex::size() const 
     {
-      return sizeof(uint32_t) + Record::SERIALIZED_SIZE * numAllocatedRecords();
+      uint32_t expiries = 0;
+      if (0 != m_numExpiring)
+	expiries = 2 * sizeof(uint32_t) + 
+	  m_numExpiring * (sizeof(uint32_t) + sizeof(uint64_t));
+
+      return sizeof(uint32_t) + Record::SERIALIZED_SIZE * numSerializedRecords() +
+	expiries;
     }
-    
-    
+
+    uint32_t HeapIndex::serialize(char *&p) const
+    {
+      uint32_t numSerialized = 0;
+      std::vector<std::pair<uint32_t, uint64_t> > expiries;
+      expiries.reserve(m_numExpiring);
+
+      for(const Record *r = m_list.front(); NULL != r; r = RecordList::next(r)) {
+	if (isFree(*r) or r->isRetired())
+	  continue;
+	if (0 != r->expiry())
+	  expiries.push_back(make_pair(numSerialized, r->expiry()));
+	r->serialize(p); // serialize advances p
+	++numSerialized;
+
+	if (not r->isSlab())
+	  continue;
+
+	const Slab &slab = *m_slabs.find(r->offset())->second;
+	for(size_t i = 0; i < slab.slots().size(); ++i) {
+	  const Record *slot = slab.slots()[i];
+	  if (NULL == slot or slot->isRetired())
+	    continue;
+	  if (0 != slot->expiry())
+	    expiries.push_back(make_pair(numSerialized, slot->expiry()));
+	  slot->serialize(p);
+	  ++numSerialized;
+	}
+      }
+
+      assert(expiries.size() == m_numExpiring);
+      if (not expiries.empty()) {
+	writeH2N(p, EXPIRY_MAGIC);
+	writeH2N(p, static_cast<uint32_t>(expiries.size()));
+	for(size_t i = 0; i < expiries.size(); ++i) {
+	  writeH2N(p, expiries[i].first);
+	  writeH2N(p, expiries[i].second);
+	}
+      }
+
+      return numSerialized;
+    }
+
+    uint32_t HeapIndex::deserializeExpiries(const char *&p, const char *end,
+					    const std::vector<Record *> &records,
+					    std::vector<const Record *> &expiring)
+    {
+      const size_t entrySize = sizeof(uint32_t) + sizeof(uint64_t);
+      if (end - p < ptrdiff_t(2 * sizeof(uint32_t)))
+	return 0;
+
+      const char *q = p;
+      uint32_t magic = 0, numExpiries = 0;
+      readN2H(q, magic);
+      readN2H(q, numExpiries);
+      if (EXPIRY_MAGIC != magic or 
+	  uint64_t(end - q) < uint64_t(numExpiries) * entrySize)
+	return 0;
+
+      for(uint32_t i = 0; i < numExpiries; ++i) {
+	uint32_t ordinal = 0;
+	uint64_t expiry = 0;
+	readN2H(q, ordinal);
+	readN2H(q, expiry);
+	if (ordinal >= records.size() or records[ordinal]->isSlab())
+	  throw runtime_error("Expiry of a Record that doesn't exist");
+	setExpiry(*records[ordinal], expiry);
+	expiring.push_back(records[ordinal]);
+      }
+
+      p = q;
+      return numExpiries;
+    }
+
+    void HeapIndex::setExpiry(const Record &rec, uint64_t expiry)
+    {
+      assert(not isFree(rec));
+      Record &r = const_cast<Record &>(rec); // it's one of ours
+
+      if (r.m_expiry == expiry)
+	return;
+
+      if (0 == r.m_expiry)
+	++m_numExpiring;
+      else if (0 == expiry)
+	--m_numExpiring;
+      r.m_expiry = expiry;
+
+      if (NULL != m_journal)
+	m_journal->expiryChanged(r);
+    }
+
+    void HeapIndex::clearExpiry(Record &r)
+    {
+      if (0 != r.m_expiry)
+	--m_numExpiring;
+      r.m_expiry = 0;
+    }
+
   } // end namespace StructuredFiles
 } // end namespace FileUtils
@@ -1,4 +1,5 @@
 #include <heap_file.h>
+#include <cstring>
 #include <unit_test.h>
 
 using namespace std;
@@ -82,6 +83,61 @@ namespace { // <anonymous>
     TEST_ASSERT(utc, mce2 == Record(q));
   }
 
+  void testRecordList(UnitTestControl &utc)
+  {
+    Record a(0, 0x0, 10), b(10, 0x1, 10), c(20, 0x2, 10), d(30, 0x3, 10);
+    RecordList list;
+
+    TEST_ASSERT(utc, list.empty());
+    TEST_ASSERT(utc, list.begin() == list.end());
+
+    list.push_back(&a);
+    list.push_back(&c);
+    list.push_back(&d);
+    list.insert(&c, &b); // in front of c
+
+    TEST_ASSERT(utc, list.size() == 4);
+    TEST_ASSERT(utc, list.front() == &a);
+    TEST_ASSERT(utc, list.back() == &d);
+    TEST_ASSERT(utc, RecordList::prev(&a) == NULL);
+    TEST_ASSERT(utc, RecordList::next(&a) == &b);
+    TEST_ASSERT(utc, RecordList::prev(&c) == &b);
+    TEST_ASSERT(utc, RecordList::next(&d) == NULL);
+
+    // a copy is not linked anywhere
+    Record copy(b);
+    TEST_ASSERT(utc, copy == b);
+    TEST_ASSERT(utc, RecordList::prev(&copy) == NULL);
+    TEST_ASSERT(utc, RecordList::next(&copy) == NULL);
+
+    typedef RecordList::const_iterator Itr;
+    Itr right = list.begin();
+    ++right;
+    for(Itr left = list.begin(); right != list.end(); ++left, ++right)
+      TEST_ASSERT(utc, (**left).sharesRightBoundaryWith(**right));
+
+    Itr last = list.end();
+    --last;
+    TEST_ASSERT(utc, *last == &d);
+    TEST_ASSERT(utc, *list.rbegin() == &d);
+    TEST_ASSERT(utc, *(++list.rbegin()) == &c);
+
+    list.erase(&b);
+    TEST_ASSERT(utc, list.size() == 3);
+    TEST_ASSERT(utc, RecordList::next(&a) == &c);
+    TEST_ASSERT(utc, RecordList::prev(&c) == &a);
+    TEST_ASSERT(utc, RecordList::prev(&b) == NULL);
+
+    TEST_ASSERT(utc, list.pop_back() == &d);
+    TEST_ASSERT(utc, list.back() == &c);
+    list.erase(&a);
+    TEST_ASSERT(utc, list.front() == &c);
+    TEST_ASSERT(utc, list.pop_back() == &c);
+    TEST_ASSERT(utc, list.empty());
+    TEST_ASSERT(utc, list.front() == NULL);
+    TEST_ASSERT(utc, list.back() == NULL);
+  }
+
   void testHeapIndexOps(UnitTestControl &utc)
   {
     HeapIndex heap;
@@ -260,8 +316,289 @@ namespace { // <anonymous>
     TEST_ASSERT(utc, heap.allocRecords().size() == 0);
     
   }
+
+  void testHeapIndexExpiries(UnitTestControl &utc)
+  {
+    HeapIndex heap;
+    const Record *a = heap.extend(8, 300, 0xa);
+    const Record *b = heap.extend(8 + 300, 300, 0xb);
+    const Record *c = heap.extend(8 + 600, 300, 0xc);
+    const uint32_t plainSize = heap.size();
+
+    heap.setExpiry(*b, 1000);
+    heap.setExpiry(*c, 2000);
+    TEST_ASSERT(utc, 2 == heap.numExpiringRecords());
+    TEST_ASSERT(utc, b->isExpired(1000) and not b->isExpired(999));
+    TEST_ASSERT(utc, not a->isExpired(uint64_t(-1)));
+    TEST_ASSERT(utc, plainSize + 8 + 2 * 12 == heap.size());
+
+    vector<char> buffer(heap.size());
+    char *p = &buffer[sizeof(uint32_t)]; // after the number of Records
+    TEST_ASSERT(utc, 3 == heap.serialize(p));
+    TEST_ASSERT(utc, &buffer[0] + buffer.size() == p);
+
+    // the expiries come back w/ the Records
+    HeapIndex copy;
+    vector<Record *> records;
+    const char *q = &buffer[sizeof(uint32_t)];
+    for(int i = 0; i < 3; ++i)
+      records.push_back(copy.addAllocatedBlock(auto_ptr<Record>(new Record(q))));
+    vector<const Record *> expiring;
+    TEST_ASSERT(utc, 2 == copy.deserializeExpiries(q, p, records, expiring));
+    TEST_ASSERT(utc, p == q);
+    TEST_ASSERT(utc, 2 == expiring.size());
+    TEST_ASSERT(utc, 0 == records[0]->expiry());
+    TEST_ASSERT(utc, 1000 == records[1]->expiry());
+    TEST_ASSERT(utc, 2000 == records[2]->expiry());
+    TEST_ASSERT(utc, heap.size() == copy.size());
+
+    // nor is there a section w/o the magic
+    q = p = &buffer[0] + plainSize;
+    memset(p, 0, sizeof(uint32_t));
+    TEST_ASSERT(utc, 0 == copy.deserializeExpiries(q, &buffer[0] + buffer.size(),
+						  records, expiring));
+    TEST_ASSERT(utc, p == q);
+
+    // freeing or clearing one forgets its expiry
+    TEST_ASSERT(utc, heap.deallocate(*b));
+    heap.setExpiry(*c, 0);
+    TEST_ASSERT(utc, 0 == heap.numExpiringRecords());
+    TEST_ASSERT(utc, plainSize - Record::SERIALIZED_SIZE == heap.size());
+    const Record *d = heap.allocate(300, 0xd);
+    TEST_ASSERT(utc, NULL != d and 0 == d->expiry());
+  }
+
+  void testHeapIndexEpochs(UnitTestControl &utc)
+  {
+    HeapIndex heap;
+    const Record *a = heap.extend(8, 300, 0xa);
+    const Record *b = heap.extend(8 + 300, 300, 0xb);
+    const Record *c = heap.extend(8 + 600, 300, 0xc);
+    const Record *d = heap.extend(8 + 900, 300, 0xd);
+
+    // nothing pinned, nothing retired
+    TEST_ASSERT(utc, not heap.isPinned());
+    TEST_ASSERT(utc, heap.retire(*a));
+    TEST_ASSERT(utc, heap.isFree(*a) and 0 == heap.numRetiredRecords());
+    a = heap.allocate(300, 0xa);
+    TEST_ASSERT(utc, NULL != a and 8 == a->offset());
+
+    const uint64_t first = heap.pin();
+    TEST_ASSERT(utc, heap.isPinned());
+    TEST_ASSERT(utc, heap.retire(*b));
+    TEST_ASSERT(utc, not heap.retire(*b)); // it's gone already
+    TEST_ASSERT(utc, b->isRetired() and not heap.isFree(*b));
+    TEST_ASSERT(utc, 3 == heap.numAllocatedRecords());
+    TEST_ASSERT(utc, 1 == heap.numRetiredRecords());
+    TEST_ASSERT(utc, 300 == heap.numRetiredBytes());
+    TEST_ASSERT(utc, NULL == heap.allocate(300, 0xe)); // not reused
+
+    // retired Records aren't serialized
+    vector<char> buffer(heap.size());
+    char *p = &buffer[sizeof(uint32_t)];
+    TEST_ASSERT(utc, 3 == heap.serialize(p));
+    TEST_ASSERT(utc, &buffer[0] + buffer.size() == p);
+
+    const uint64_t second = heap.pin();
+    TEST_ASSERT(utc, second > first);
+    TEST_ASSERT(utc, heap.retire(*c));
+
+    // the first still sees both
+    heap.unpin(second);
+    TEST_ASSERT(utc, 2 == heap.numRetiredRecords());
+    TEST_ASSERT(utc, NULL == heap.allocate(300, 0xe));
+
+    heap.unpin(first);
+    TEST_ASSERT(utc, not heap.isPinned());
+    TEST_ASSERT(utc, 0 == heap.numRetiredRecords() and 0 == heap.numRetiredBytes());
+    TEST_ASSERT(utc, 1 == heap.numFreeRecords()); // coalesced
+    TEST_ASSERT(utc, heap.freeRecords().begin()->second->size() == 600);
+
+    // releasing the older one first frees only what it alone kept
+    const uint64_t third = heap.pin();
+    TEST_ASSERT(utc, heap.retire(*a));
+    const uint64_t fourth = heap.pin();
+    TEST_ASSERT(utc, heap.retire(*d));
+    heap.unpin(third);
+    TEST_ASSERT(utc, heap.isFree(*a));
+    TEST_ASSERT(utc, 1 == heap.numRetiredRecords() and d->isRetired());
+    heap.unpin(fourth);
+    TEST_ASSERT(utc, 0 == heap.numAllocatedRecords());
+    TEST_ASSERT(utc, heap.allRecords().empty()); // the last one's dropped
+
+    // retiring a Slab retires the Blobs in its slots
+    heap.setSlabThreshold(64);
+    const Record *s1 = heap.extend(8, 50, 0x51);
+    const Record *s2 = heap.allocate(50, 0x52);
+    TEST_ASSERT(utc, s1->isSlabSlot() and s2->isSlabSlot());
+    const Record *slab = heap.allRecords().back();
+    TEST_ASSERT(utc, slab->isSlab());
+
+    const uint64_t fifth = heap.pin();
+    TEST_ASSERT(utc, heap.retire(*slab));
+    TEST_ASSERT(utc, 0 == heap.numAllocatedRecords());
+    TEST_ASSERT(utc, 2 == heap.numRetiredRecords());
+    TEST_ASSERT(utc, 1 == heap.numSlabs());
+    heap.unpin(fifth);
+    TEST_ASSERT(utc, 0 == heap.numSlabs() and heap.allRecords().empty());
+  }
+
+  void testHeapIndexReserve(UnitTestControl &utc)
+  {
+    HeapIndex heap;
+    const Record *a = heap.extend(8, 300, 0xa);
+    heap.extend(8 + 300, 600, 0xb);
+    const uint32_t plainSize = heap.size();
+
+    // past the end, w/ a gap in between
+    Record *r = heap.reserveAt(8 + 1000, 100);
+    TEST_ASSERT(utc, r->isRetired() and not heap.isFree(*r));
+    TEST_ASSERT(utc, heap.isLast(*r));
+    TEST_ASSERT(utc, 1 == heap.numReservedRecords());
+    TEST_ASSERT(utc, 1 == heap.numFreeRecords());
+    TEST_ASSERT(utc, 2 == heap.numAllocatedRecords());
+    TEST_ASSERT(utc, plainSize == heap.size()); // not serialized
+
+    // from free space if there's room, past _end_ if not
+    TEST_ASSERT(utc, heap.deallocate(*a));
+    Record *s = heap.reserve(100, 8 + 1100);
+    TEST_ASSERT(utc, 8 == s->offset() and s->size() >= 100);
+    Record *t = heap.reserve(400, 8 + 1100);
+    TEST_ASSERT(utc, 8 + 1100 == t->offset() and 400 == t->size());
+    TEST_ASSERT(utc, 3 == heap.numReservedRecords());
+    TEST_ASSERT(utc, NULL == heap.allocate(300, 0xc)); // taken
+
+    // let go, it's free again, and coalesced
+    heap.unreserve(s);
+    TEST_ASSERT(utc, not s->isRetired() and heap.isFree(*s));
+    TEST_ASSERT(utc, NULL != heap.allocate(300, 0xc));
+    heap.unreserve(t);
+    TEST_ASSERT(utc, heap.isLast(*r)); // the last one's dropped
+    heap.unreserve(r);
+    TEST_ASSERT(utc, 0 == heap.numReservedRecords());
+    TEST_ASSERT(utc, 8 + 900 == heap.allRecords().back()->offset() +
+		heap.allRecords().back()->size());
+  }
+
+  void testHeapIndexCommitted(UnitTestControl &utc)
+  {
+    HeapIndex heap;
+    const Record *a = heap.extend(8, 300, 0xa);
+    const Record *b = heap.extend(8 + 300, 300, 0xb);
+    heap.markCommitted();
+    const Record *c = heap.extend(8 + 600, 300, 0xc);
+    TEST_ASSERT(utc, a->isCommitted() and b->isCommitted());
+    TEST_ASSERT(utc, not c->isCommitted());
+
+    // retiring a committed Record holds it, even w/ nothing pinned
+    TEST_ASSERT(utc, heap.retire(*a));
+    TEST_ASSERT(utc, a->isRetired() and not heap.isFree(*a));
+    TEST_ASSERT(utc, 1 == heap.numHeldRecords() and 300 == heap.numHeldBytes());
+    TEST_ASSERT(utc, 0 == heap.numRetiredRecords());
+    TEST_ASSERT(utc, NULL == heap.allocate(300, 0xd)); // not reused
+    TEST_ASSERT(utc, heap.retire(*c)); // not committed, so freed
+    TEST_ASSERT(utc, 1 == heap.numHeldRecords() and heap.isLast(*b));
+
+    // and the end of an epoch doesn't free it either
+    const uint64_t epoch = heap.pin();
+    TEST_ASSERT(utc, heap.retire(*b));
+    heap.unpin(epoch);
+    TEST_ASSERT(utc, 0 == heap.numRetiredRecords());
+    TEST_ASSERT(utc, 2 == heap.numHeldRecords() and 600 == heap.numHeldBytes());
+
+    // the next commit frees what it doesn't have
+    const Record *d = heap.extend(8 + 600, 300, 0xd);
+    heap.markCommitted();
+    TEST_ASSERT(utc, 0 == heap.numHeldRecords() and 0 == heap.numHeldBytes());
+    TEST_ASSERT(utc, 1 == heap.numFreeRecords()); // coalesced
+    TEST_ASSERT(utc, d->isCommitted());
+
+    // deallocate() holds nothing
+    TEST_ASSERT(utc, heap.deallocate(*d));
+    TEST_ASSERT(utc, 0 == heap.numHeldRecords() and heap.allRecords().empty());
+
+    // a Slab w/ a committed slot is held a slot at a time
+    heap.setSlabThreshold(64);
+    const Record *s1 = heap.extend(8, 50, 0x51);
+    heap.markCommitted();
+    const Record *s2 = heap.allocate(50, 0x52);
+    TEST_ASSERT(utc, s1->isCommitted() and not s2->isCommitted());
+    const Record *slab = heap.allRecords().back();
+    TEST_ASSERT(utc, heap.retire(*slab));
+    TEST_ASSERT(utc, 0 == heap.numAllocatedRecords());
+    TEST_ASSERT(utc, 1 == heap.numHeldRecords() and 1 == heap.numSlabs());
+    heap.markCommitted();
+    TEST_ASSERT(utc, 0 == heap.numSlabs() and heap.allRecords().empty());
+  }
+
+  // Notes what it's told as '+', '-', 'e' or 'c', and the Record.
+  struct TestJournal : public HeapIndex::Journal
+  {
+    typedef std::vector<std::pair<char, Record> > Changes;
+
+    virtual void added(const Record &r)         { changes.push_back(make_pair('+', r)); }
+    virtual void dropped(const Record &r)       { changes.push_back(make_pair('-', r)); }
+    virtual void expiryChanged(const Record &r) { changes.push_back(make_pair('e', r)); }
+    virtual void cleared()                      { changes.push_back(make_pair('c', Record())); }
+
+    Changes changes;
+  };
+
+  void testHeapIndexJournal(UnitTestControl &utc)
+  {
+    TestJournal journal;
+    HeapIndex heap;
+    heap.setSlabThreshold(100);
+    heap.setJournal(&journal);
+    const TestJournal::Changes &c = journal.changes;
+
+    const Record *a = heap.extend(8, 300, 0xa);
+    const Record *slot = heap.extend(8 + 300, 50, 0xb); // w/ a new Slab
+    TEST_ASSERT(utc, 3 == c.size());
+    TEST_ASSERT(utc, '+' == c[0].first and *a == c[0].second);
+    TEST_ASSERT(utc, '+' == c[1].first and c[1].second.isSlab());
+    TEST_ASSERT(utc, 8 + 300 == c[1].second.offset());
+    TEST_ASSERT(utc, '+' == c[2].first and *slot == c[2].second);
+
+    heap.setExpiry(*a, 100);
+    heap.setExpiry(*a, 100); // no change
+    TEST_ASSERT(utc, 4 == c.size());
+    TEST_ASSERT(utc, 'e' == c[3].first and 100 == c[3].second.expiry());
+
+    // the Slab goes w/ its last slot
+    const Record slotCopy = *slot;
+    TEST_ASSERT(utc, heap.deallocate(*slot));
+    TEST_ASSERT(utc, 6 == c.size());
+    TEST_ASSERT(utc, '-' == c[4].first and slotCopy == c[4].second);
+    TEST_ASSERT(utc, '-' == c[5].first and c[5].second.isSlab());
+
+    // retiring drops it right away, freeing it later changes nothing
+    const uint64_t epoch = heap.pin();
+    TEST_ASSERT(utc, heap.retire(*a));
+    TEST_ASSERT(utc, 7 == c.size() and '-' == c[6].first);
+    heap.unpin(epoch);
+    TEST_ASSERT(utc, 7 == c.size());
+
+    // nor does reserving
+    heap.unreserve(heap.reserve(100, 8));
+    TEST_ASSERT(utc, 7 == c.size());
+
+    heap.extend(8, 300, 0xc);
+    heap.clear();
+    TEST_ASSERT(utc, 9 == c.size() and 'c' == c[8].first);
+
+    heap.setJournal(NULL);
+    heap.extend(8, 300, 0xd);
+    TEST_ASSERT(utc, 9 == c.size());
+  }
 } // end namespace
 
 REGISTER_TEST(testHeapFileRecord, &::testHeapFileRecord)
 REGISTER_TEST(testHeapFileRecordSerialization, &::testSerialization)
+REGISTER_TEST(testRecordList, &::testRecordList)
 REGISTER_TEST(testHeapIndexOperations, &::testHeapIndexOps)
+REGISTER_TEST(testHeapIndexExpiries, &::testHeapIndexExpiries)
+REGISTER_TEST(testHeapIndexEpochs, &::testHeapIndexEpochs)
+REGISTER_TEST(testHeapIndexReserve, &::testHeapIndexReserve)
+REGISTER_TEST(testHeapIndexCommitted, &::testHeapIndexCommitted)
+REGISTER_TEST(testHeapIndexJournal, &::testHeapIndexJournal)
@@ -0,0 +1,121 @@
+#include <heap_slab.h>
+#include <algorithm>
+#include <cassert>
+#include <heap_index.h>
+
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+      const uint32_t BITS_PER_WORD = 64;
+    } // end namespace <anonymous>
+
+    const uint32_t Slab::SIZE = 4096;
+    const uint32_t Slab::SLOT_ALIGNMENT = 16;
+    const uint32_t Slab::MAX_SLOT_SIZE = 256 - 16; // just under Record::MIN_SIZE
+
+    uint32_t Slab::slotSizeFor(uint32_t size)
+    {
+      size = std::max(size, uint32_t(1));
+      return (size + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+    }
+
+    Slab::Slab(Record &rec, uint32_t slotSize)
+      : m_rec(rec), m_slotSize(slotSize), m_numUsed(0),
+	m_bitmap(), m_slots(rec.size() / slotSize, static_cast<Record *>(NULL))
+    {
+      assert(0 != slotSize and slotSize <= MAX_SLOT_SIZE);
+      m_bitmap.resize((m_slots.size() + BITS_PER_WORD - 1) / BITS_PER_WORD, 0);
+
+      m_rec.m_kind = Record::SLAB;
+      m_rec.setKey(slotSize);
+    }
+
+    Slab::~Slab()
+    {
+      for(size_t i = 0; i < m_slots.size(); ++i)
+	delete m_slots[i];
+
+      // it goes back to being a plain old block
+      m_rec.m_kind = Record::BLOCK;
+      m_rec.setKey(0);
+    }
+
+    bool Slab::contains(uint64_t offset) const
+    {
+      return m_rec.offset() <= offset and offset < m_rec.offset() + m_rec.size();
+    }
+
+    uint32_t Slab::slotIndex(uint64_t offset) const
+    {
+      assert(contains(offset));
+      return (offset - m_rec.offset()) / m_slotSize;
+    }
+
+    bool Slab::isUsed(uint32_t i) const
+    {
+      return 0 != (m_bitmap[i / BITS_PER_WORD] & (uint64_t(1) << (i % BITS_PER_WORD)));
+    }
+
+    void Slab::setUsed(uint32_t i, bool used)
+    {
+      const uint64_t bit = uint64_t(1) << (i % BITS_PER_WORD);
+      if (used)
+	m_bitmap[i / BITS_PER_WORD] |= bit;
+      else
+	m_bitmap[i / BITS_PER_WORD] &= ~bit;
+    }
+
+    Record *Slab::allocate(uint32_t key)
+    {
+      for(uint32_t w = 0; w < m_bitmap.size(); ++w) {
+	uint64_t freeBits = ~m_bitmap[w];
+	const uint32_t slotsInWord = std::min(BITS_PER_WORD, numSlots() - w * BITS_PER_WORD);
+	if (slotsInWord < BITS_PER_WORD)
+	  freeBits &= (uint64_t(1) << slotsInWord) - 1;
+	if (0 == freeBits)
+	  continue;
+
+	const uint32_t i = w * BITS_PER_WORD + __builtin_ctzll(freeBits);
+	Record *slot = new Record(m_rec.offset() + uint64_t(i) * m_slotSize,
+				  key, m_slotSize);
+	slot->m_kind = Record::SLAB_SLOT;
+	m_slots[i] = slot;
+	setUsed(i, true);
+	++m_numUsed;
+	return slot;
+      }
+      return NULL;
+    }
+
+    Record *Slab::adopt(std::auto_ptr<Record> slot)
+    {
+      if (not contains(slot->offset()) or m_slotSize != slot->size() or
+	  0 != (slot->offset() - m_rec.offset()) % m_slotSize)
+	return NULL;
+
+      const uint32_t i = slotIndex(slot->offset());
+      if (i >= numSlots() or isUsed(i))
+	return NULL;
+
+      slot->m_kind = Record::SLAB_SLOT;
+      m_slots[i] = slot.release();
+      setUsed(i, true);
+      ++m_numUsed;
+      return m_slots[i];
+    }
+
+    void Slab::release(Record *slot)
+    {
+      const uint32_t i = slotIndex(slot->offset());
+      assert(m_slots[i] == slot and isUsed(i));
+
+      delete slot;
+      m_slots[i] = NULL;
+      setUsed(i, false);
+      --m_numUsed;
+    }
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
@@ -0,0 +1,163 @@
+#include <heap_slab.h>
+#include <heap_index.h>
+#include <unit_test.h>
+#include <vector>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  void testSlabSizeClasses(UnitTestControl &utc)
+  {
+    TEST_ASSERT(utc, 16 == Slab::slotSizeFor(0));
+    TEST_ASSERT(utc, 16 == Slab::slotSizeFor(1));
+    TEST_ASSERT(utc, 16 == Slab::slotSizeFor(16));
+    TEST_ASSERT(utc, 32 == Slab::slotSizeFor(17));
+    TEST_ASSERT(utc, Slab::MAX_SLOT_SIZE == Slab::slotSizeFor(Slab::MAX_SLOT_SIZE));
+    TEST_ASSERT(utc, Slab::MAX_SLOT_SIZE < Record::MIN_SIZE);
+  }
+
+  void testSlabSlots(UnitTestControl &utc)
+  {
+    Record page(1024, 0, Slab::SIZE);
+    {
+      Slab slab(page, 48);
+      TEST_ASSERT(utc, page.isSlab());
+      TEST_ASSERT(utc, 48 == page.key());
+      TEST_ASSERT(utc, Slab::SIZE / 48 == slab.numSlots());
+      TEST_ASSERT(utc, slab.isEmpty());
+      TEST_ASSERT(utc, slab.contains(1024));
+      TEST_ASSERT(utc, not slab.contains(1024 + Slab::SIZE));
+
+      // slots are handed out lowest offset first
+      Record *first = slab.allocate(7);
+      Record *second = slab.allocate(8);
+      TEST_ASSERT(utc, first->isSlabSlot());
+      TEST_ASSERT(utc, 1024 == first->offset());
+      TEST_ASSERT(utc, 48 == first->size());
+      TEST_ASSERT(utc, 7 == first->key());
+      TEST_ASSERT(utc, 1024 + 48 == second->offset());
+
+      slab.release(first);
+      TEST_ASSERT(utc, 1 == slab.numUsed());
+      TEST_ASSERT(utc, NULL == slab.slots()[0]);
+      TEST_ASSERT(utc, 1024 == slab.allocate(9)->offset()); // reused
+
+      while(not slab.isFull())
+	TEST_ASSERT(utc, NULL != slab.allocate(10));
+      TEST_ASSERT(utc, NULL == slab.allocate(11));
+    }
+    TEST_ASSERT(utc, not page.isSlab());
+    TEST_ASSERT(utc, 0 == page.key());
+  }
+
+  void testSlabAdopt(UnitTestControl &utc)
+  {
+    Record page(0, 0, Slab::SIZE);
+    Slab slab(page, 32);
+
+    TEST_ASSERT(utc, NULL != slab.adopt(auto_ptr<Record>(new Record(64, 1, 32))));
+    TEST_ASSERT(utc, 1 == slab.numUsed());
+    TEST_ASSERT(utc, slab.slots()[2]->isSlabSlot());
+
+    // taken, misaligned, wrong size, and outside the Slab
+    TEST_ASSERT(utc, NULL == slab.adopt(auto_ptr<Record>(new Record(64, 2, 32))));
+    TEST_ASSERT(utc, NULL == slab.adopt(auto_ptr<Record>(new Record(65, 3, 32))));
+    TEST_ASSERT(utc, NULL == slab.adopt(auto_ptr<Record>(new Record(96, 4, 48))));
+    TEST_ASSERT(utc, NULL == slab.adopt(auto_ptr<Record>(new Record(Slab::SIZE, 5, 32))));
+    TEST_ASSERT(utc, 1 == slab.numUsed());
+
+    // the lowest free slot is still 0
+    TEST_ASSERT(utc, 0 == slab.allocate(6)->offset());
+  }
+
+  void testHeapIndexSlabs(UnitTestControl &utc)
+  {
+    HeapIndex index;
+    index.setSlabThreshold(1000);
+    TEST_ASSERT(utc, Slab::MAX_SLOT_SIZE == index.slabThreshold());
+
+    // the first small Blob grows the index by a whole Slab
+    Record *a = index.extend(8, 40, 1);
+    TEST_ASSERT(utc, NULL != a and a->isSlabSlot());
+    TEST_ASSERT(utc, 1 == index.numSlabs());
+    TEST_ASSERT(utc, 1 == index.allRecords().size());
+    TEST_ASSERT(utc, 8 == a->offset());
+
+    // the rest of that size class fills the Slab
+    vector<Record *> slots;
+    slots.push_back(a);
+    for(Record *r = NULL; NULL != (r = index.allocate(40, slots.size() + 1)); )
+      slots.push_back(r);
+    TEST_ASSERT(utc, Slab::SIZE / 48 == slots.size());
+    TEST_ASSERT(utc, slots.size() == index.numAllocatedRecords());
+    TEST_ASSERT(utc, slots.size() + 1 == index.numSerializedRecords());
+
+    // a different class gets a Slab of its own
+    TEST_ASSERT(utc, NULL == index.allocate(100, 99));
+    Record *b = index.extend(8 + Slab::SIZE, 100, 99);
+    TEST_ASSERT(utc, 8 + Slab::SIZE == b->offset());
+    TEST_ASSERT(utc, 2 == index.numSlabs());
+
+    // serialize and read back
+    vector<char> buf(index.size());
+    char *p = &buf[0];
+    TEST_ASSERT(utc, index.numSerializedRecords() == index.serialize(p));
+    TEST_ASSERT(utc, &buf[0] + index.size() - sizeof(uint32_t) == p);
+
+    HeapIndex copy;
+    const char *q = &buf[0];
+    for(uint32_t i = 0; i < index.numSerializedRecords(); ++i)
+      copy.addAllocatedBlock(auto_ptr<Record>(new Record(q)));
+    TEST_ASSERT(utc, 2 == copy.numSlabs());
+    TEST_ASSERT(utc, index.numAllocatedRecords() == copy.numAllocatedRecords());
+    TEST_ASSERT(utc, copy.allocRecords().find(99)->second->offset() == b->offset());
+
+    // freeing a slot of a full Slab makes room in it again
+    Record freed(*slots[3]);
+    TEST_ASSERT(utc, index.deallocate(freed));
+    TEST_ASSERT(utc, freed.offset() == index.allocate(33, 1000)->offset());
+
+    // emptying a Slab frees its block
+    TEST_ASSERT(utc, index.deallocate(Record(*b)));
+    TEST_ASSERT(utc, 1 == index.numSlabs());
+    TEST_ASSERT(utc, 1 == index.allRecords().size());
+
+    // and deallocating the Slab deallocates all its slots
+    TEST_ASSERT(utc, index.deallocate(*index.allRecords().back()));
+    TEST_ASSERT(utc, 0 == index.numSlabs());
+    TEST_ASSERT(utc, 0 == index.numAllocatedRecords());
+    TEST_ASSERT(utc, index.allRecords().empty());
+  }
+
+  void testHeapIndexBadSlabs(UnitTestControl &utc)
+  {
+    HeapIndex index;
+    vector<char> buf(Record::SERIALIZED_SIZE);
+    char *p = &buf[0];
+    {
+      HeapIndex other;
+      other.setSlabThreshold(40);
+      other.extend(8, 40, 1);
+      other.allRecords().front()->setKey(40); // 40 is no slot size
+      other.allRecords().front()->serialize(p);
+    }
+    const char *q = &buf[0];
+    bool threw = false;
+    try {
+      index.addAllocatedBlock(auto_ptr<Record>(new Record(q)));
+    }catch(const std::exception &) {
+      threw = true;
+    }
+    TEST_ASSERT(utc, threw);
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testSlabSizeClasses, &::testSlabSizeClasses)
+REGISTER_TEST(testSlabSlots, &::testSlabSlots)
+REGISTER_TEST(testSlabAdopt, &::testSlabAdopt)
+REGISTER_TEST(testHeapIndexSlabs, &::testHeapIndexSlabs)
+REGISTER_TEST(testHeapIndexBadSlabs, &::testHeapIndexBadSlabs)
@@ -37,7 +37,10 @@ namespace { // <anonymous>
     // It's possible to mmap more bytes than exist in the file
     // if the file size is not a multiple of g_pageSize bytes.
 
-    assert( windowOffset <= fileSize ); // INVARIANT
+    // The window may lie past the end of the file if the file was
+    // trimmed and not yet shrunk on disk.
+    if (windowOffset > fileSize)
+      return 0;
     return std::min(windowSize, fileSize - windowOffset);
   }
 
@@ -59,45 +62,86 @@ namespace { // <anonymous>
     return size;
   }
 
-  off_t growFile(int fd, off_t size)
+  // Grows the file to _size_ bytes, allocating the new blocks on disk.
+  off_t allocateFile(int fd, off_t oldSize, off_t size)
   {
-    assert( statFileSize(fd) < size );    
-    return setFileSize(fd, size);
+    assert( oldSize < size );
+    int err = posix_fallocate(fd, oldSize, size - oldSize);
+    if (EOPNOTSUPP == err or EINVAL == err)
+      return setFileSize(fd, size); // no such thing on this file system
+    if (0 != err)
+      ::raise(fd, err, "allocating");
+
+    assert( statFileSize(fd) == size );
+    return size;
+  }
+
+  off_t roundUpToPage(off_t size)
+  {
+    return (size + g_pageSize - 1) / g_pageSize * g_pageSize;
   }
 
-  char *mmapFile(int fd, off_t offset, off_t size)
+  // Maps _size_ bytes at _offset_ in the file w/ protection _prot_.
+  // If _addr_ isn't NULL the mapping goes exactly there, replacing
+  // whatever was mapped.
+  char *mmapFile(int fd, int prot, off_t offset, off_t size, char *addr=NULL)
   {
     // MAP_FILE   - map a regular file to virtual memory
     // MAP_SHARED - writes are public (don't copy on-write)
     const int g_mmapFlags = MAP_FILE | MAP_SHARED;
     
-    // PROT_READ  - mapped memory may be read
-    // PROT_WRITE - mapped memory may be written to
-    const int g_protectionFlags = PROT_READ | PROT_WRITE;
-
 
     assert( 0 == (offset % g_pageSize) );
     assert( 0 == (size % g_pageSize) );
 
-    void *ptr = mmap(NULL, size, g_protectionFlags, g_mmapFlags, fd, offset);
+    const int fixed = (NULL == addr) ? 0 : MAP_FIXED;
+    void *ptr = mmap(addr, size, prot, g_mmapFlags | fixed, 
+		     fd, offset);
 
     if (MAP_FAILED == ptr)
       ::raise(fd, errno, "mmap'ing");
 
     return static_cast<char *>(ptr);
   }
+
+  // Reserves _size_ bytes of address space without backing it with
+  // anything.  If _addr_ isn't NULL, the pages there are given back
+  // to the reservation instead, which unmaps what was there.
+  char *reserve(off_t size, char *addr=NULL)
+  {
+    const int fixed = (NULL == addr) ? 0 : MAP_FIXED;
+    void *ptr = mmap(addr, size, PROT_NONE, 
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | fixed, 
+		     -1, 0);
+
+    if (MAP_FAILED == ptr)
+      ::raise(string("Failed to reserve address space w/ error: ") + 
+	      strerror(errno));
+
+    return static_cast<char *>(ptr);
+  }
 } // end namespace <anonymous>
 
 
 namespace FileUtils {
 
-  MmapFile::MmapFile(const string &path)
-    : m_path(path), m_fd(0), m_fileSize(0), m_offset(0),
-      m_windowSize(g_pageSize), m_begin(NULL)
+  MmapFile::Options::Options()
+    : mapping(SLIDING_WINDOW), reserveSize(off_t(1) << 30),
+      chunkSize(off_t(1) << 20), cacheBudget(off_t(64) << 20),
+      maxPreallocation(0), readOnly(false)
+  {}
+
+  MmapFile::MmapFile(const string &path, const Options &options)
+    : m_path(path), m_options(options), m_fd(0), m_fileSize(0), 
+      m_physicalSize(0), m_offset(0),
+      m_windowSize(g_pageSize), m_begin(NULL), m_reserved(0),
+      m_chunks(), m_lru(), m_mappedBytes(0), m_stats(),
+      m_pinMutex(), m_pins(0), m_retired()
   {
     // O_RDWR   - open file for reading and writing
     // O_CREAT  - create the file if it does not exist
-    const int flags = O_RDWR | O_CREAT;
+    // O_RDONLY - open file for reading only, and it better exist
+    const int flags = m_options.readOnly ? O_RDONLY : O_RDWR | O_CREAT;
 
     // S_IRUSR - Read bit for file owner
     // S_IWUSR - Write bit for file owner
@@ -106,24 +150,233 @@ namespace FileUtils {
     if (0 > (m_fd = open(m_path.c_str(), flags, privs)))
       ::raise("Failed to open " + m_path + " with error: " + strerror(errno));
       
-    m_fileSize = statFileSize(m_fd);
+    m_physicalSize = m_fileSize = statFileSize(m_fd);
     
-    m_begin = mmapFile(m_fd, m_offset, m_windowSize);
+    if (isWholeFile()) {
+      m_windowSize = 0;
+      try {
+	mapWholeFile(m_physicalSize);
+      }catch(...) {
+	close(m_fd);
+	throw;
+      }
+      return;
+    }
+
+    if (isChunkCache()) {
+      m_options.chunkSize = roundUpToPage(std::max(m_options.chunkSize, off_t(1)));
+      m_windowSize = 0;
+      return;
+    }
+
+    m_begin = mmapFile(m_fd, protection(), m_offset, m_windowSize);
 
   }
 
   MmapFile::~MmapFile()
   {
     // block until we write the mapped pages back to disk
-    msync(m_begin, m_windowSize, MS_SYNC);
-    munmap(m_begin, m_windowSize);
+    if (isChunkCache()) {
+      for(ChunkMap::iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr) {
+	msync(itr->second.begin, itr->second.size, MS_SYNC);
+	munmap(itr->second.begin, itr->second.size);
+      }
+    }else {
+      msync(m_begin, m_windowSize, MS_SYNC);
+      munmap(m_begin, isWholeFile() ? m_reserved : m_windowSize);
+    }
+    for(size_t i = 0; i < m_retired.size(); ++i)
+      munmap(m_retired[i].first, m_retired[i].second);
+
+    // don't leave preallocated slack behind
+    if (not isReadOnly() and m_physicalSize != m_fileSize)
+      ftruncate(m_fd, m_fileSize);
     close(m_fd);
   }
+
+  // Sets size() to _size_ bytes.  The file on disk is grown ahead of
+  // it by up to Options::maxPreallocation bytes and only shrunk when
+  // the slack would be more than that.
+  void MmapFile::resize(off_t size)
+  {
+    const off_t maxSlack = m_options.maxPreallocation;
+
+    if (size > m_physicalSize) {
+      off_t physical = size;
+      if (0 < maxSlack)
+	physical = std::max(size, std::min(2*m_physicalSize, size + maxSlack));
+      setPhysicalSize(physical);
+    }else if (m_physicalSize - size > maxSlack) {
+      setPhysicalSize(size);
+    }
+
+    m_fileSize = size;
+  }
+
+  void MmapFile::setPhysicalSize(off_t size)
+  {
+    ThreadUtils::atomicAdd(m_stats.resizes, uint64_t(1));
+
+    if (size > m_physicalSize) {
+      if (0 < m_options.maxPreallocation)
+	m_physicalSize = allocateFile(m_fd, m_physicalSize, size);
+      else
+	m_physicalSize = setFileSize(m_fd, size);
+
+      if (isWholeFile())
+	mapWholeFile(m_physicalSize);
+      return;
+    }
+
+    // nothing may stay mapped past the new end of the file
+    if (isWholeFile()) {
+      m_physicalSize = setFileSize(m_fd, size);
+      mapWholeFile(m_physicalSize);
+    }else if (isChunkCache()) {
+      unmapChunks();
+      m_physicalSize = setFileSize(m_fd, size);
+    }else {
+      unmap();
+      m_physicalSize = setFileSize(m_fd, size);
+      m_windowSize = g_pageSize;
+      m_begin = mmapFile(m_fd, protection(), m_offset, m_windowSize);
+    }
+  }
+
+  // Makes the mapping cover the first _size_ bytes of the file, rounded
+  // up to a page.  m_offset stays 0 and m_windowSize is the number
+  // of bytes mapped.
+  void MmapFile::mapWholeFile(off_t size) const
+  {
+    size = roundUpToPage(size);
+
+    if (size > m_reserved) {
+      // outgrew the reservation; move to a bigger one
+      if (NULL != m_begin) {
+	msync(m_begin, m_windowSize, MS_SYNC);
+	release(m_begin, m_reserved);
+	ThreadUtils::atomicAdd(m_stats.remaps, uint64_t(1));
+      }
+      m_begin = NULL;
+      m_windowSize = 0;
+
+      off_t reserved = std::max(std::max(m_reserved, m_options.reserveSize),
+				g_pageSize);
+      while (reserved < size)
+	reserved *= 2;
+      m_begin = reserve(reserved);
+      m_reserved = reserved;
+    }
+
+    if (size > m_windowSize) {
+      mmapFile(m_fd, protection(), m_windowSize, size - m_windowSize, m_begin + m_windowSize);
+    }else if (size < m_windowSize) {
+      ThreadUtils::MutexLock lock(m_pinMutex);
+      if (0 != m_pins)
+	return; // the tail is pinned; leave it mapped until it grows again
+      reserve(m_windowSize - size, m_begin + size);
+    }
+
+    m_windowSize = size;
+  }
   
-  void MmapFile::unmap() const
+  // The Chunk starting at the chunk boundary at or before _offset_, if
+  // it covers all of the _size_ bytes at _offset_.
+  const MmapFile::Chunk *MmapFile::findChunk(off_t offset, off_t size) const
   {
-    if( 0 != munmap(m_begin, m_windowSize) ) 
+    const off_t start = offset - (offset % m_options.chunkSize);
+    ChunkMap::const_iterator itr = m_chunks.find(start);
+    if (m_chunks.end() == itr or start + itr->second.size < offset + size)
+      return NULL;
+    return &itr->second;
+  }
+
+  // Maps the chunks under the _size_ bytes at _offset_ as one window,
+  // unmapping the least recently used ones until we're in budget.
+  char *MmapFile::mapChunk(off_t offset, off_t size)
+  {
+    const off_t chunkSize = m_options.chunkSize;
+    const off_t start = offset - (offset % chunkSize);
+    const off_t length = (offset + size - start + chunkSize - 1) / chunkSize * chunkSize;
+
+    bool evicted = false;
+
+    // a window too small for this range gets replaced by a bigger one
+    ChunkMap::iterator itr = m_chunks.find(start);
+    if (m_chunks.end() != itr) {
+      unmapChunk(itr);
+      evicted = true;
+    }
+
+    while (not m_lru.empty() and m_mappedBytes + length > m_options.cacheBudget) {
+      unmapChunk(m_chunks.find(m_lru.back()));
+      evicted = true;
+    }
+
+    Chunk chunk;
+    chunk.begin = mmapFile(m_fd, protection(), start, length);
+    chunk.size = length;
+    chunk.lruPos = m_lru.insert(m_lru.begin(), start);
+    m_chunks.insert(std::make_pair(start, chunk));
+    m_mappedBytes += length;
+
+    ThreadUtils::atomicAdd(m_stats.misses, uint64_t(1));
+    if (evicted)
+      ThreadUtils::atomicAdd(m_stats.remaps, uint64_t(1));
+
+    return chunk.begin + (offset - start);
+  }
+
+  void MmapFile::unmapChunk(ChunkMap::iterator itr) const
+  {
+    release(itr->second.begin, itr->second.size);
+
+    m_mappedBytes -= itr->second.size;
+    m_lru.erase(itr->second.lruPos);
+    m_chunks.erase(itr);
+  }
+
+  void MmapFile::unmapChunks() const
+  {
+    while (not m_chunks.empty())
+      unmapChunk(m_chunks.begin());
+  }
+
+  // Unmaps _size_ bytes at _begin_ or, while pinned, retires them to
+  // be unmapped by the last unpin().
+  void MmapFile::release(char *begin, off_t size) const
+  {
+    ThreadUtils::MutexLock lock(m_pinMutex);
+    if (0 != m_pins) {
+      m_retired.push_back(std::make_pair(begin, size));
+      return;
+    }
+
+    if( 0 != munmap(begin, size) ) 
       ::raise(string("Failed to unmap memory w/ error: ") + strerror(errno));
+  }
+
+  void MmapFile::pin() const
+  {
+    ThreadUtils::MutexLock lock(m_pinMutex);
+    ++m_pins;
+  }
+
+  void MmapFile::unpin() const
+  {
+    ThreadUtils::MutexLock lock(m_pinMutex);
+    assert(0 != m_pins);
+    if (0 != --m_pins)
+      return;
+
+    for(size_t i = 0; i < m_retired.size(); ++i)
+      munmap(m_retired[i].first, m_retired[i].second);
+    m_retired.clear();
+  }
+
+  void MmapFile::unmap() const
+  {
+    release(m_begin, m_windowSize);
 
     // these guys are mutable
     m_begin      = NULL;
@@ -131,24 +384,93 @@ namespace FileUtils {
     m_windowSize = 0;
   }
 
+  int MmapFile::protection() const
+  {
+    // PROT_READ  - mapped memory may be read
+    // PROT_WRITE - mapped memory may be written to
+    return isReadOnly() ? PROT_READ : PROT_READ | PROT_WRITE;
+  }
+
+  void MmapFile::checkWritable() const
+  {
+    if (isReadOnly())
+      ::raise(m_path + " is open read-only");
+  }
+
   void MmapFile::clear()
   {
-    unmap();
-    m_fileSize   = setFileSize(m_fd, 0);
-    m_windowSize = g_pageSize;
-    m_begin = mmapFile(m_fd, m_offset, m_windowSize);
+    trim(0);
+    shrinkToFit();
   }
 
   void MmapFile::trim(off_t numBytesToKeep)
   {
-    unmap();
-    m_fileSize = setFileSize(m_fd, numBytesToKeep);
-    m_windowSize = g_pageSize;
-    m_begin = mmapFile(m_fd, m_offset, m_windowSize);
+    checkWritable();
+    resize(numBytesToKeep);
+  }
+
+  void MmapFile::shrinkToFit()
+  {
+    checkWritable();
+    if (m_physicalSize != m_fileSize)
+      setPhysicalSize(m_fileSize);
+  }
+
+  void MmapFile::flush()
+  {
+    checkWritable();
+
+    if (isChunkCache()) {
+      for(ChunkMap::iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr) {
+	if (0 != msync(itr->second.begin, itr->second.size, MS_SYNC))
+	  ::raise(m_fd, errno, "syncing");
+      }
+    }else if (NULL != m_begin and 0 != m_windowSize) {
+      if (0 != msync(m_begin, m_windowSize, MS_SYNC))
+	::raise(m_fd, errno, "syncing");
+    }
+
+    if (0 != fdatasync(m_fd))
+      ::raise(m_fd, errno, "syncing");
+  }
+
+  void MmapFile::sync() const
+  {
+    checkWritable();
+    if (0 != fdatasync(m_fd))
+      ::raise(m_fd, errno, "syncing");
+  }
+
+  void MmapFile::willNeed(off_t offset, off_t size) const
+  {
+    if (offset >= m_fileSize or size <= 0)
+      return;
+    size = std::min(size, m_fileSize - offset);
+
+    char *p = NULL;
+    if (isChunkCache()) {
+      const Chunk *chunk = findChunk(offset, size);
+      if (NULL != chunk)
+	p = chunk->begin + (offset % m_options.chunkSize);
+    }else if (NULL != m_begin and isInWindow(offset, size)) {
+      p = m_begin + (offset - m_offset);
+    }
+
+    if (NULL == p) {
+      (void)posix_fadvise(m_fd, offset, size, POSIX_FADV_WILLNEED);
+      return;
+    }
+
+    // mappings start on a page boundary of the file, so this is one too
+    const off_t slop = offset % g_pageSize;
+    (void)madvise(p - slop, size + slop, MADV_WILLNEED);
   }
 
   bool MmapFile::isInWindow(off_t offset, off_t size) const
   {
+    if (isChunkCache())
+      return offset + size <= m_fileSize and NULL != findChunk(offset, size);
+
     off_t mappedSize = effectiveWindowSize(m_fileSize, m_offset, m_windowSize);
 
     //     { size }
@@ -173,20 +495,63 @@ namespace FileUtils {
     //
     // Clients of this class could still cast away constness and edit the
     // mapped-to memory, but I can't stop them from doing that...the same is
-    // true of std::string::c_str(), however.  To really address this problem 
-    // I'd have to provide read/write modes to this class which is not worth
-    // doing right now but certainly worth thinking about in the future.
+    // true of std::string::c_str(), however.  Open the file read-only
+    // (Options::readOnly) and the pages are mapped PROT_READ, so at least
+    // those clients get a SIGSEGV rather than a modified file.
     //
     if( offset >= m_fileSize ) 
       return NULL;
-    return const_cast<MmapFile &>(*this).getPtr(offset, size);
+
+    // Don't hand out pages past the end: a read-only file can't grow,
+    // and a writable one mustn't under readers sharing a lock.
+    if (offset + size > m_fileSize)
+      return NULL;
+
+    // Readers of a whole-file mapping may be many threads at once, so
+    // they write nothing shared, not even the hit count.
+    if (isWholeFile() and isInWindow(offset, size))
+      return m_begin + offset;
+
+    return const_cast<MmapFile &>(*this).mapRange(offset, size);
   }
 
   void *MmapFile::getPtr(const off_t offset, const off_t size)
   {
-    if (isInWindow(offset, size))
+    checkWritable();
+    return mapRange(offset, size);
+  }
+
+  void *MmapFile::mapRange(const off_t offset, const off_t size)
+  {
+    if (isChunkCache()) {
+      if( m_fileSize < offset + size )
+	resize(offset + size);
+
+      const off_t start = offset - (offset % m_options.chunkSize);
+      const Chunk *chunk = findChunk(offset, size);
+      if (NULL == chunk)
+	return mapChunk(offset, size);
+
+      ThreadUtils::atomicAdd(m_stats.hits, uint64_t(1));
+      m_lru.splice(m_lru.begin(), m_lru, chunk->lruPos); // most recent now
+      return chunk->begin + (offset - start);
+    }
+
+    if (isInWindow(offset, size)) {
+      ThreadUtils::atomicAdd(m_stats.hits, uint64_t(1));
       return m_begin + (offset - m_offset);
+    }
+
+    ThreadUtils::atomicAdd(m_stats.misses, uint64_t(1));
+
+    if (isWholeFile()) {
+      // everything we've got is mapped; the file has to grow
+      resize(offset + size);
+      return m_begin + offset;
+    }
 
+    if (NULL != m_begin)
+      ThreadUtils::atomicAdd(m_stats.remaps, uint64_t(1));
     unmap();
 
     // put the offset on a page boundary
@@ -197,9 +562,9 @@ namespace FileUtils {
     m_windowSize += g_pageSize - (m_windowSize % g_pageSize);
 
     if( m_fileSize < offset + size )
-      m_fileSize = growFile(m_fd, offset + size);
+      resize(offset + size);
 
-    m_begin = mmapFile(m_fd, m_offset, m_windowSize);
+    m_begin = mmapFile(m_fd, protection(), m_offset, m_windowSize);
 
     assert( m_offset <= offset );
     assert( m_offset + m_windowSize >= offset + size );
@@ -99,6 +99,257 @@ namespace { // <anonymous>
     }
   }
 
+  void testMmapWholeFile(UnitTestControl &utc)
+  {
+    const string &tmpFileName = tmpnam(NULL);
+    const off_t pageSize = getpagesize();
+
+    MmapFile::Options options;
+    options.mapping = MmapFile::Options::WHOLE_FILE;
+    options.reserveSize = 4*pageSize;
+
+    {
+      MmapFile file(tmpFileName, options);
+      TEST_ASSERT(utc, 0 == file.size());
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(0));
+
+      char *first = file.getWritePtr<char>(0, 10);
+      strcpy(first, "first");
+
+      // growing within the reservation doesn't move the mapping
+      char *second = file.getWritePtr<char>(3*pageSize, 10);
+      strcpy(second, "second");
+      TEST_ASSERT(utc, first + 3*pageSize == second);
+      TEST_ASSERT(utc, first == file.getReadPtr<char>(0));
+      TEST_ASSERT(utc, file.isInWindow(0, file.size()));
+
+      // outgrowing it does, but nothing is lost
+      char *third = file.getWritePtr<char>(10*pageSize, 10);
+      strcpy(third, "third");
+      TEST_ASSERT(utc, 10*pageSize + 10 == file.size());
+      TEST_ASSERT(utc, 0 == strcmp("first", file.getReadPtr<char>(0)));
+      TEST_ASSERT(utc, 0 == strcmp("second", file.getReadPtr<char>(3*pageSize)));
+      TEST_ASSERT(utc, file.isInWindow(0, file.size()));
+
+      file.trim(3*pageSize + 10);
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(10*pageSize));
+      TEST_ASSERT(utc, 0 == strcmp("second", file.getReadPtr<char>(3*pageSize)));
+
+      // reading never grows it, even when it's writable
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(3*pageSize, 20));
+      TEST_ASSERT(utc, 3*pageSize + 10 == file.size());
+    }
+
+    {
+      // the sliding window sees the same thing
+      MmapFile file(tmpFileName);
+      TEST_ASSERT(utc, 3*pageSize + 10 == file.size());
+      TEST_ASSERT(utc, 0 == strcmp("first", file.getReadPtr<char>(0)));
+      TEST_ASSERT(utc, 0 == strcmp("second", file.getReadPtr<char>(3*pageSize)));
+    }
+
+    {
+      MmapFile file(tmpFileName, options);
+      TEST_ASSERT(utc, 0 == strcmp("second", file.getReadPtr<char>(3*pageSize)));
+      file.clear();
+      TEST_ASSERT(utc, 0 == file.size());
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(0));
+      strcpy(file.getWritePtr<char>(pageSize, 10), "again");
+      TEST_ASSERT(utc, 0 == strcmp("again", file.getReadPtr<char>(pageSize)));
+    }
+    unlink(tmpFileName.c_str());
+  }
+
+  void testMmapChunkCache(UnitTestControl &utc)
+  {
+    const string &tmpFileName = tmpnam(NULL);
+    const off_t pageSize = getpagesize();
+
+    MmapFile::Options options;
+    options.mapping = MmapFile::Options::CHUNK_CACHE;
+    options.chunkSize = 1; // rounded up to a page
+    options.cacheBudget = 2*pageSize;
+
+    {
+      MmapFile file(tmpFileName, options);
+      TEST_ASSERT(utc, pageSize == file.options().chunkSize);
+
+      strcpy(file.getWritePtr<char>(10, 10), "index");
+      strcpy(file.getWritePtr<char>(5*pageSize + 10, 10), "blob");
+      TEST_ASSERT(utc, 2 == file.stats().misses);
+      TEST_ASSERT(utc, 0 == file.stats().remaps);
+
+      // two hot chunks alternating don't thrash
+      for(int i = 0; i < 10; ++i) {
+	TEST_ASSERT(utc, 0 == strcmp("index", file.getReadPtr<char>(10)));
+	TEST_ASSERT(utc, 0 == strcmp("blob", file.getReadPtr<char>(5*pageSize + 10)));
+      }
+      TEST_ASSERT(utc, 20 == file.stats().hits);
+      TEST_ASSERT(utc, 2 == file.stats().misses);
+      TEST_ASSERT(utc, file.isInWindow(10, 10));
+
+      // a third chunk evicts the least recently used one
+      strcpy(file.getWritePtr<char>(3*pageSize, 10), "third");
+      TEST_ASSERT(utc, 1 == file.stats().remaps);
+      TEST_ASSERT(utc, not file.isInWindow(10, 10));
+      TEST_ASSERT(utc, file.isInWindow(5*pageSize + 10, 10));
+
+      // a range across a chunk boundary is still contiguous
+      char *span = file.getWritePtr<char>(2*pageSize - 3, 6);
+      strcpy(span, "span!");
+      TEST_ASSERT(utc, 0 == strcmp("span!", file.getReadPtr<char>(2*pageSize - 3)));
+      TEST_ASSERT(utc, 0 == strcmp("n!", file.getReadPtr<char>(2*pageSize)));
+
+      file.trim(5*pageSize);
+      TEST_ASSERT(utc, not file.isInWindow(3*pageSize, 10));
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(5*pageSize + 10));
+    }
+
+    {
+      MmapFile file(tmpFileName);
+      TEST_ASSERT(utc, 5*pageSize == file.size());
+      TEST_ASSERT(utc, 0 == strcmp("index", file.getReadPtr<char>(10)));
+      TEST_ASSERT(utc, 0 == strcmp("span!", file.getReadPtr<char>(2*pageSize - 3, 6)));
+      TEST_ASSERT(utc, 0 == strcmp("third", file.getReadPtr<char>(3*pageSize)));
+    }
+    unlink(tmpFileName.c_str());
+  }
+
+  void testMmapPreallocation(UnitTestControl &utc)
+  {
+    const string &tmpFileName = tmpnam(NULL);
+    const off_t maxSlack = 64 << 10;
+
+    MmapFile::Options options;
+    options.maxPreallocation = maxSlack;
+
+    struct stat st;
+    {
+      MmapFile file(tmpFileName, options);
+
+      // append a record at a time the way a HeapFile does
+      off_t end = 0;
+      for(int i = 0; i < 10000; ++i) {
+	file.trim(end + 100);
+	memset(file.getWritePtr<char>(end, 100), i % 256, 100);
+	end += 100;
+	TEST_ASSERT(utc, end == file.size());
+      }
+      TEST_ASSERT(utc, file.stats().resizes < 40); // 10000 w/o preallocation
+      TEST_ASSERT(utc, file.physicalSize() >= file.size());
+      TEST_ASSERT(utc, file.physicalSize() <= file.size() + maxSlack);
+      TEST_ASSERT(utc, 0 == stat(tmpFileName.c_str(), &st));
+      TEST_ASSERT(utc, file.physicalSize() == st.st_size);
+
+      // shrinking a little doesn't touch the disk, a lot does
+      uint64_t resizes = file.stats().resizes;
+      file.trim(end - 1000);
+      TEST_ASSERT(utc, resizes == file.stats().resizes);
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(end - 1000));
+      TEST_ASSERT(utc, NULL != file.getReadPtr<char>(end - 1001));
+
+      file.trim(1000);
+      TEST_ASSERT(utc, file.physicalSize() == file.size());
+
+      file.trim(100);
+      file.trim(200);
+      file.shrinkToFit();
+      TEST_ASSERT(utc, 0 == stat(tmpFileName.c_str(), &st));
+      TEST_ASSERT(utc, 200 == st.st_size);
+
+      file.trim(5000);
+    }
+
+    // closing cuts off the slack
+    TEST_ASSERT(utc, 0 == stat(tmpFileName.c_str(), &st));
+    TEST_ASSERT(utc, 5000 == st.st_size);
+
+    {
+      MmapFile file(tmpFileName, options);
+      TEST_ASSERT(utc, 5000 == file.size());
+      TEST_ASSERT(utc, 1 == *file.getReadPtr<char>(100));
+      file.clear();
+      TEST_ASSERT(utc, 0 == file.physicalSize());
+    }
+    unlink(tmpFileName.c_str());
+  }
+
+  void testMmapPins(UnitTestControl &utc)
+  {
+    const string &tmpFileName = tmpnam(NULL);
+    const off_t pageSize = getpagesize();
+
+    MmapFile::Options options[3];
+    options[1].mapping = MmapFile::Options::WHOLE_FILE;
+    options[1].reserveSize = pageSize;
+    options[2].mapping = MmapFile::Options::CHUNK_CACHE;
+    options[2].chunkSize = pageSize;
+    options[2].cacheBudget = pageSize;
+
+    for(int i = 0; i < 3; ++i) {
+      MmapFile file(tmpFileName, options[i]);
+      strcpy(file.getWritePtr<char>(10, 10), "pinned");
+
+      file.pin();
+      file.pin();
+      TEST_ASSERT(utc, file.isPinned());
+      const char *pinned = file.getReadPtr<char>(10);
+
+      // all of these would unmap the first page if it weren't pinned
+      for(off_t offset = pageSize; offset < 20*pageSize; offset += pageSize)
+	strcpy(file.getWritePtr<char>(offset, 10), "other");
+      file.trim(5*pageSize);
+
+      TEST_ASSERT(utc, 0 == strcmp("pinned", pinned));
+      file.unpin();
+      TEST_ASSERT(utc, 0 == strcmp("pinned", pinned));
+      file.unpin();
+      TEST_ASSERT(utc, not file.isPinned());
+      TEST_ASSERT(utc, 0 == strcmp("pinned", file.getReadPtr<char>(10)));
+      TEST_ASSERT(utc, 0 == strcmp("other", file.getReadPtr<char>(4*pageSize)));
+      file.clear();
+    }
+    unlink(tmpFileName.c_str());
+  }
+
+  void testMmapWillNeed(UnitTestControl &utc)
+  {
+    const string &tmpFileName = tmpnam(NULL);
+    const off_t pageSize = getpagesize();
+
+    MmapFile::Options options[3];
+    options[1].mapping = MmapFile::Options::WHOLE_FILE;
+    options[2].mapping = MmapFile::Options::CHUNK_CACHE;
+    options[2].chunkSize = pageSize;
+
+    for(int i = 0; i < 3; ++i) {
+      MmapFile file(tmpFileName, options[i]);
+      TEST_ASSERT(utc, file.size() == 0);
+      file.willNeed(0, pageSize); // nothing there yet
+
+      for(off_t offset = 0; offset < 8*pageSize; offset += pageSize)
+	strcpy(file.getWritePtr<char>(offset + 10, 10), "needed");
+
+      // mapped, not mapped and partly past the end; none of it maps a thing
+      const MmapFile::Stats before = file.stats();
+      const off_t size = file.size();
+      file.willNeed(7*pageSize + 10, 10);
+      file.willNeed(10, 3*pageSize);
+      file.willNeed(6*pageSize, 10*pageSize);
+      file.willNeed(20*pageSize, pageSize);
+      TEST_ASSERT(utc, before.hits == file.stats().hits);
+      TEST_ASSERT(utc, before.misses == file.stats().misses);
+      TEST_ASSERT(utc, size == file.size());
+
+      for(off_t offset = 0; offset < 8*pageSize; offset += pageSize)
+	TEST_ASSERT(utc, 0 == strcmp("needed", file.getReadPtr<char>(offset + 10, 7)));
+      file.sync();
+      file.flush();
+      file.clear();
+    }
+    unlink(tmpFileName.c_str());
+  }
+
   void testMmapReadOnlyFile(UnitTestControl &utc)
   {
     const string &tmpFileName = tmpnam(NULL);
@@ -117,9 +368,81 @@ namespace { // <anonymous>
       didCatchException = true;
     }
     TEST_ASSERT(utc, didCatchException);
+
+    // ...but we can open it read-only
+    MmapFile::Options options;
+    options.readOnly = true;
+    {
+      MmapFile m(tmpFileName, options);
+      TEST_ASSERT(utc, m.isReadOnly());
+      TEST_ASSERT(utc, 0 == m.size());
+      TEST_ASSERT(utc, NULL == m.getReadPtr<char>(0));
+    }
+    unlink(tmpFileName.c_str());
+
+    // and it has to exist to be opened read-only
+    didCatchException = false;
+    try {
+      MmapFile m(tmpFileName, options);
+    }catch(const exception &e) {
+      didCatchException = true;
+    }
+    TEST_ASSERT(utc, didCatchException);
+  }
+
+  void testMmapReadOnlyMode(UnitTestControl &utc)
+  {
+    const string &tmpFileName = tmpnam(NULL);
+    const string &testString = "The quick brown fox jumped over the lazy dog.";
+
+    {
+      MmapFile file(tmpFileName);
+      strcpy(file.getWritePtr<char>(100, testString.size() + 1), testString.c_str());
+    }
+
+    MmapFile::Options options;
+    options.readOnly = true;
+
+    const MmapFile::Options::Mapping mappings[] = {
+      MmapFile::Options::SLIDING_WINDOW,
+      MmapFile::Options::WHOLE_FILE,
+      MmapFile::Options::CHUNK_CACHE
+    };
+    for(size_t i = 0; i < sizeof(mappings)/sizeof(mappings[0]); ++i) {
+      options.mapping = mappings[i];
+
+      // two at once
+      MmapFile file(tmpFileName, options), other(tmpFileName, options);
+      const off_t size = file.size();
+      TEST_ASSERT(utc, 0 == strcmp(testString.c_str(), file.getReadPtr<char>(100)));
+      TEST_ASSERT(utc, 0 == strcmp(testString.c_str(), other.getReadPtr<char>(100)));
+
+      // reading past the end doesn't grow the file
+      TEST_ASSERT(utc, NULL == file.getReadPtr<char>(100, size));
+      TEST_ASSERT(utc, size == file.size());
+
+      int numThrown = 0;
+      try { file.getWritePtr<char>(0); }catch(const runtime_error &) { ++numThrown; }
+      try { file.trim(10); }catch(const runtime_error &) { ++numThrown; }
+      try { file.clear(); }catch(const runtime_error &) { ++numThrown; }
+      try { file.shrinkToFit(); }catch(const runtime_error &) { ++numThrown; }
+      try { file.flush(); }catch(const runtime_error &) { ++numThrown; }
+      try { file.sync(); }catch(const runtime_error &) { ++numThrown; }
+      TEST_ASSERT(utc, 6 == numThrown);
+    }
+
+    struct stat st;
+    TEST_ASSERT(utc, 0 == stat(tmpFileName.c_str(), &st));
+    TEST_ASSERT(utc, static_cast<off_t>(100 + testString.size() + 1) == st.st_size);
     unlink(tmpFileName.c_str());
   }
 } // end namespace <anonymous>
 
 REGISTER_TEST(testMmapFileBasics, &::testMmapFileBasics)
+REGISTER_TEST(testMmapWholeFile, &::testMmapWholeFile)
+REGISTER_TEST(testMmapChunkCache, &::testMmapChunkCache)
+REGISTER_TEST(testMmapPreallocation, &::testMmapPreallocation)
+REGISTER_TEST(testMmapPins, &::testMmapPins)
+REGISTER_TEST(testMmapWillNeed, &::testMmapWillNeed)
 REGISTER_TEST(testMmapReadOnlyFile, &::testMmapReadOnlyFile)
+REGISTER_TEST(testMmapReadOnlyMode, &::testMmapReadOnlyMode)
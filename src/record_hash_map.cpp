@@ -0,0 +1,302 @@
+#include <record_hash_map.h>
+#include <cassert>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+
+      const size_t GROUP_SIZE = 16;
+
+      // Control bytes.  A full slot holds the 7 low bits of its hash,
+      // so anything negative is not a full slot.
+      const int8_t EMPTY   = -128;
+      const int8_t DELETED = -2;
+
+      // The Record keys are djb2 hashes which are poorly mixed in
+      // their low bits, so run them through the murmur3 finalizer.
+      size_t mix(uint32_t h)
+      {
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+      }
+
+      size_t h1(size_t hash) { return hash >> 7; }
+      int8_t h2(size_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+      uint32_t lowestBit(uint32_t mask) { return __builtin_ctz(mask); }
+
+#ifdef __SSE2__
+      __m128i load(const int8_t *group)
+      {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+      }
+
+      // One bit per slot in the group whose control byte is _b_.
+      uint32_t match(const int8_t *group, int8_t b)
+      {
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(b), load(group)));
+      }
+
+      uint32_t matchEmptyOrDeleted(const int8_t *group)
+      {
+	return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), load(group)));
+      }
+#else
+      uint32_t match(const int8_t *group, int8_t b)
+      {
+	uint32_t mask = 0;
+	for(size_t i = 0; i < GROUP_SIZE; ++i)
+	  mask |= uint32_t(group[i] == b) << i;
+	return mask;
+      }
+
+      uint32_t matchEmptyOrDeleted(const int8_t *group)
+      {
+	uint32_t mask = 0;
+	for(size_t i = 0; i < GROUP_SIZE; ++i)
+	  mask |= uint32_t(group[i] < -1) << i;
+	return mask;
+      }
+#endif
+
+      uint32_t matchEmpty(const int8_t *group)
+      {
+	return match(group, EMPTY);
+      }
+
+    } // end namespace <anonymous>
+
+    const size_t RecordHashMap::npos = numeric_limits<size_t>::max();
+
+    RecordHashMap::const_iterator::const_iterator()
+      : m_map(NULL), m_slot(npos), m_keyed(false), m_key(0), m_h2(0),
+	m_group(0), m_probe(0), m_matches(0)
+    {}
+
+    RecordHashMap::const_iterator::const_iterator(const RecordHashMap *map,
+						  size_t slot)
+      : m_map(map), m_slot(slot), m_keyed(false), m_key(0), m_h2(0),
+	m_group(0), m_probe(0), m_matches(0)
+    {}
+
+    RecordHashMap::const_iterator::const_iterator(const RecordHashMap *map,
+						  uint32_t key)
+      : m_map(map), m_slot(npos), m_keyed(true), m_key(key), m_h2(0),
+	m_group(0), m_probe(0), m_matches(0)
+    {
+      if (map->m_slots.empty())
+	return;
+
+      const size_t hash = mix(key);
+      const size_t numGroups = map->m_slots.size() / GROUP_SIZE;
+
+      m_h2 = h2(hash);
+      m_group = h1(hash) & (numGroups - 1);
+      m_matches = match(&map->m_ctrl[m_group * GROUP_SIZE], m_h2);
+      nextMatch();
+    }
+
+    RecordHashMap::const_iterator &RecordHashMap::const_iterator::operator++()
+    {
+      assert(npos != m_slot);
+
+      if (m_keyed) {
+	nextMatch();
+      } else {
+	++m_slot;
+	nextFull();
+      }
+      return *this;
+    }
+
+    RecordHashMap::const_iterator RecordHashMap::const_iterator::operator++(int)
+    {
+      const_iterator tmp(*this);
+      ++*this;
+      return tmp;
+    }
+
+    // Moves m_slot forward to the next full slot, starting with m_slot.
+    void RecordHashMap::const_iterator::nextFull()
+    {
+      const size_t capacity = m_map->m_slots.size();
+      while(m_slot < capacity and m_map->m_ctrl[m_slot] < 0)
+	++m_slot;
+
+      if (m_slot >= capacity)
+	m_slot = npos;
+    }
+
+    // Moves m_slot to the next slot holding m_key along the probe
+    // sequence of m_key.  Probing stops at the first group with an
+    // EMPTY slot since an insertion would have stopped there, too.
+    void RecordHashMap::const_iterator::nextMatch()
+    {
+      const size_t numGroups = m_map->m_slots.size() / GROUP_SIZE;
+
+      for(;;) {
+	while(0 != m_matches) {
+	  size_t slot = m_group * GROUP_SIZE + lowestBit(m_matches);
+	  m_matches &= m_matches - 1;
+	  if (m_map->m_slots[slot].first == m_key) {
+	    m_slot = slot;
+	    return;
+	  }
+	}
+
+	const int8_t *group = &m_map->m_ctrl[m_group * GROUP_SIZE];
+	if (0 != matchEmpty(group) or ++m_probe >= numGroups) {
+	  m_slot = npos;
+	  return;
+	}
+
+	m_group = (m_group + m_probe) & (numGroups - 1);
+	m_matches = match(&m_map->m_ctrl[m_group * GROUP_SIZE], m_h2);
+      }
+    }
+
+    RecordHashMap::RecordHashMap()
+      : m_ctrl(), m_slots(), m_size(0), m_growthLeft(0)
+    {}
+
+    RecordHashMap::const_iterator RecordHashMap::begin() const
+    {
+      const_iterator itr(this, size_t(0));
+      itr.nextFull();
+      return itr;
+    }
+
+    RecordHashMap::const_iterator RecordHashMap::at(size_t slot) const
+    {
+      if (slot >= m_slots.size())
+	return end();
+      const_iterator itr(this, slot);
+      itr.nextFull();
+      return itr;
+    }
+
+    RecordHashMap::const_iterator RecordHashMap::find(uint32_t key) const
+    {
+      return const_iterator(this, key);
+    }
+
+    pair<RecordHashMap::const_iterator, RecordHashMap::const_iterator>
+    RecordHashMap::equal_range(uint32_t key) const
+    {
+      return make_pair(find(key), end());
+    }
+
+    size_t RecordHashMap::count(uint32_t key) const
+    {
+      size_t n = 0;
+      for(const_iterator itr = find(key), itrEnd = end(); itr != itrEnd; ++itr)
+	++n;
+      return n;
+    }
+
+    // Returns the first EMPTY or DELETED slot along the probe sequence
+    // of _hash_.  There is always one because of the maximum load factor.
+    size_t RecordHashMap::findInsertSlot(size_t hash) const
+    {
+      const size_t numGroups = m_slots.size() / GROUP_SIZE;
+      size_t group = h1(hash) & (numGroups - 1);
+
+      for(size_t probe = 1; ; ++probe) {
+	uint32_t mask = matchEmptyOrDeleted(&m_ctrl[group * GROUP_SIZE]);
+	if (0 != mask)
+	  return group * GROUP_SIZE + lowestBit(mask);
+
+	assert(probe < numGroups);
+	group = (group + probe) & (numGroups - 1);
+      }
+    }
+
+    void RecordHashMap::insert(const value_type &v)
+    {
+      if (m_slots.empty())
+	rehash(GROUP_SIZE);
+
+      const size_t hash = mix(v.first);
+      size_t slot = findInsertSlot(hash);
+
+      if (0 == m_growthLeft and EMPTY == m_ctrl[slot]) {
+	// Grow only if we're mostly full of live elements; otherwise
+	// it's the DELETED slots that need clearing out.
+	const size_t capacity = m_slots.size();
+	rehash(m_size >= capacity * 7 / 16 ? 2 * capacity : capacity);
+	slot = findInsertSlot(hash);
+      }
+
+      if (EMPTY == m_ctrl[slot])
+	--m_growthLeft;
+
+      setCtrl(slot, h2(hash));
+      m_slots[slot] = v;
+      ++m_size;
+    }
+
+    void RecordHashMap::erase(const_iterator itr)
+    {
+      assert(itr.m_map == this and npos != itr.m_slot);
+      assert(0 <= m_ctrl[itr.m_slot]);
+
+      const size_t slot = itr.m_slot;
+      const int8_t *group = &m_ctrl[slot - slot % GROUP_SIZE];
+
+      // If the group still has an EMPTY slot then it has never been
+      // full, so no probe sequence has ever passed through it and this
+      // slot can go straight back to EMPTY.
+      if (0 != matchEmpty(group)) {
+	setCtrl(slot, EMPTY);
+	++m_growthLeft;
+      } else {
+	setCtrl(slot, DELETED);
+      }
+
+      m_slots[slot] = value_type();
+      --m_size;
+    }
+
+    void RecordHashMap::clear()
+    {
+      std::vector<int8_t>().swap(m_ctrl);
+      std::vector<value_type>().swap(m_slots);
+      m_size = 0;
+      m_growthLeft = 0;
+    }
+
+    void RecordHashMap::rehash(size_t newCapacity)
+    {
+      assert(0 == newCapacity % GROUP_SIZE);
+      assert(0 == (newCapacity & (newCapacity - 1))); // a power of two
+
+      std::vector<int8_t> oldCtrl(newCapacity, EMPTY);
+      std::vector<value_type> oldSlots(newCapacity);
+      oldCtrl.swap(m_ctrl);
+      oldSlots.swap(m_slots);
+
+      m_growthLeft = newCapacity - newCapacity / 8 - m_size;
+
+      for(size_t i = 0; i < oldSlots.size(); ++i) {
+	if (oldCtrl[i] < 0)
+	  continue;
+	const size_t hash = mix(oldSlots[i].first);
+	const size_t slot = findInsertSlot(hash);
+	setCtrl(slot, h2(hash));
+	m_slots[slot] = oldSlots[i];
+      }
+    }
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
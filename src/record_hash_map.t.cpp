@@ -0,0 +1,141 @@
+#include <record_hash_map.h>
+#include <cstdlib>
+#include <heap_index.h>
+#include <map>
+#include <set>
+#include <unit_test.h>
+#include <vector>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  void testRecordHashMapBasics(UnitTestControl &utc)
+  {
+    typedef RecordHashMap::const_iterator Itr;
+
+    RecordHashMap map;
+    TEST_ASSERT(utc, map.empty());
+    TEST_ASSERT(utc, map.begin() == map.end());
+    TEST_ASSERT(utc, map.find(0x0) == map.end());
+    TEST_ASSERT(utc, 0 == map.count(0x0));
+
+    Record a(8, 0xdeadbeef, 256), b(264, 0xdeadbeef, 256), c(520, 0x1, 256);
+    map.insert(make_pair(a.key(), &a));
+    map.insert(make_pair(b.key(), &b));
+    map.insert(make_pair(c.key(), &c));
+
+    TEST_ASSERT(utc, 3 == map.size());
+    TEST_ASSERT(utc, map.find(0x1)->second == &c);
+    TEST_ASSERT(utc, 2 == map.count(0xdeadbeef));
+    TEST_ASSERT(utc, map.find(0x2) == map.end());
+
+    // a key collision: both Records are visited by equal_range
+    set<Record *> seen;
+    pair<Itr, Itr> range = map.equal_range(0xdeadbeef);
+    for(; range.first != range.second; ++range.first) {
+      TEST_ASSERT(utc, 0xdeadbeef == range.first->first);
+      seen.insert(range.first->second);
+    }
+    TEST_ASSERT(utc, 2 == seen.size());
+    TEST_ASSERT(utc, seen.count(&a) and seen.count(&b));
+
+    size_t n = 0;
+    for(Itr itr = map.begin(); itr != map.end(); ++itr)
+      ++n;
+    TEST_ASSERT(utc, 3 == n);
+
+    // a walk picked up where it left off sees the rest of them
+    Itr second = map.begin();
+    ++second;
+    n = 0;
+    for(Itr itr = map.at(second.slot()); itr != map.end(); ++itr)
+      ++n;
+    TEST_ASSERT(utc, 2 == n);
+    TEST_ASSERT(utc, map.at(map.begin().slot()) == map.begin());
+    TEST_ASSERT(utc, map.at(map.capacity()) == map.end());
+
+    map.erase(map.find(0x1));
+    TEST_ASSERT(utc, map.find(0x1) == map.end());
+    TEST_ASSERT(utc, 2 == map.size());
+
+    map.clear();
+    TEST_ASSERT(utc, map.empty());
+    TEST_ASSERT(utc, 0 == map.capacity());
+    TEST_ASSERT(utc, map.find(0xdeadbeef) == map.end());
+  }
+
+  // Churn the map alongside a std::multimap and make sure they agree.
+  void testRecordHashMapChurn(UnitTestControl &utc)
+  {
+    typedef multimap<uint32_t, Record *> Reference;
+    typedef RecordHashMap::const_iterator Itr;
+
+    const size_t numRecords = 20000;
+    vector<Record> records(numRecords);
+    for(size_t i = 0; i < numRecords; ++i)
+      records[i] = Record(i, rand() % 5000, 1); // plenty of collisions
+
+    RecordHashMap map;
+    Reference ref;
+    vector<bool> present(numRecords, false);
+
+    for(int round = 0; round < 100000; ++round) {
+      size_t i = rand() % numRecords;
+      Record *r = &records[i];
+
+      if (not present[i]) {
+	map.insert(make_pair(r->key(), r));
+	ref.insert(make_pair(r->key(), r));
+	present[i] = true;
+	continue;
+      }
+
+      bool found = false;
+      pair<Itr, Itr> range = map.equal_range(r->key());
+      for(; range.first != range.second; ++range.first) {
+	if (range.first->second != r)
+	  continue;
+	map.erase(range.first);
+	found = true;
+	break;
+      }
+      TEST_ASSERT(utc, found);
+
+      pair<Reference::iterator, Reference::iterator> refRange =
+	ref.equal_range(r->key());
+      for(; refRange.first != refRange.second; ++refRange.first) {
+	if (refRange.first->second == r) {
+	  ref.erase(refRange.first);
+	  break;
+	}
+      }
+      present[i] = false;
+    }
+
+    TEST_ASSERT(utc, map.size() == ref.size());
+
+    // every key has the same number of Records in both
+    bool allMatch = true;
+    for(Reference::const_iterator itr = ref.begin(); itr != ref.end(); 
+	itr = ref.upper_bound(itr->first)) {
+      allMatch = allMatch and map.count(itr->first) == ref.count(itr->first);
+    }
+    TEST_ASSERT(utc, allMatch);
+
+    size_t n = 0;
+    for(Itr itr = map.begin(); itr != map.end(); ++itr, ++n)
+      allMatch = allMatch and present[itr->second - &records[0]];
+    TEST_ASSERT(utc, allMatch);
+    TEST_ASSERT(utc, n == map.size());
+
+    // the load factor is bounded, so we shouldn't have grown wildly
+    TEST_ASSERT(utc, map.capacity() <= 4 * numRecords);
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testRecordHashMapBasics, &::testRecordHashMapBasics)
+REGISTER_TEST(testRecordHashMapChurn, &::testRecordHashMapChurn)
@@ -0,0 +1,259 @@
+#include <segregated_free_list.h>
+#include <cassert>
+#include <heap_index.h>
+#include <limits>
+
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+
+      const size_t SL_BITS  = 4;
+      const size_t SL_COUNT = 1 << SL_BITS;   // second-level classes
+      const size_t FL_COUNT = 32 - SL_BITS + 1; // first-level classes
+      const size_t NUM_CLASSES = FL_COUNT * SL_COUNT;
+
+      // How many Records of the class a size falls in we look at for
+      // a close fit before settling for a bigger class.
+      const size_t MAX_SCAN = 8;
+
+      size_t mostSignificantBit(uint64_t v) { return 63 - __builtin_clzll(v); }
+      size_t lowestBit(uint32_t v) { return __builtin_ctz(v); }
+
+      // Sizes below SL_COUNT get one class apiece.  Above that the
+      // first level is the most significant bit and the second level
+      // is the next SL_BITS bits.
+      void mapping(uint64_t size, size_t &fl, size_t &sl)
+      {
+	if (size < SL_COUNT) {
+	  fl = 0;
+	  sl = size;
+	  return;
+	}
+	const size_t msb = mostSignificantBit(size);
+	fl = msb - SL_BITS + 1;
+	sl = (size >> (msb - SL_BITS)) - SL_COUNT;
+      }
+
+      size_t classOf(uint64_t size)
+      {
+	size_t fl, sl;
+	mapping(size, fl, sl);
+	return fl * SL_COUNT + sl;
+      }
+
+      // Rounds _size_ up to the smallest size of the next class so that
+      // every Record in the class we map to is big enough.
+      uint64_t roundUp(uint64_t size)
+      {
+	if (size < SL_COUNT)
+	  return size;
+	return size + (uint64_t(1) << (mostSignificantBit(size) - SL_BITS)) - 1;
+      }
+
+      const uint32_t NOT_FREE = numeric_limits<uint32_t>::max();
+    } // end namespace <anonymous>
+
+    SegregatedFreeList::const_iterator::const_iterator()
+      : m_list(NULL), m_class(NUM_CLASSES), m_pos(0), m_value(0, NULL)
+    {}
+
+    SegregatedFreeList::const_iterator::const_iterator(
+      const SegregatedFreeList *list, size_t sizeClass, size_t pos)
+      : m_list(list), m_class(sizeClass), m_pos(pos), m_value(0, NULL)
+    {
+      settle();
+    }
+
+    void SegregatedFreeList::const_iterator::settle()
+    {
+      while(m_class < NUM_CLASSES and 
+	    m_pos >= m_list->m_classes[m_class].size()) {
+	++m_class;
+	m_pos = 0;
+      }
+
+      if (m_class < NUM_CLASSES) {
+	Record *r = m_list->m_classes[m_class][m_pos];
+	m_value = value_type(r->size(), r);
+      } else {
+	m_pos = 0;
+	m_value = value_type(0, NULL);
+      }
+    }
+
+    SegregatedFreeList::const_iterator &
+    SegregatedFreeList::const_iterator::operator++()
+    {
+      ++m_pos;
+      settle();
+      return *this;
+    }
+
+    SegregatedFreeList::const_iterator
+    SegregatedFreeList::const_iterator::operator++(int)
+    {
+      const_iterator tmp(*this);
+      ++*this;
+      return tmp;
+    }
+
+    SegregatedFreeList::SegregatedFreeList()
+      : m_classes(NUM_CLASSES), m_firstLevel(0),
+	m_secondLevel(FL_COUNT, 0), m_size(0)
+    {}
+
+    SegregatedFreeList::const_iterator SegregatedFreeList::begin() const
+    {
+      return const_iterator(this, 0, 0);
+    }
+
+    SegregatedFreeList::const_iterator SegregatedFreeList::end() const
+    {
+      return const_iterator(this, NUM_CLASSES, 0);
+    }
+
+    SegregatedFreeList::const_iterator 
+    SegregatedFreeList::find(uint32_t size) const
+    {
+      const size_t sizeClass = classOf(size);
+      const vector<Record *> &records = m_classes[sizeClass];
+
+      for(size_t i = 0; i < records.size(); ++i) {
+	if (records[i]->size() == size)
+	  return const_iterator(this, sizeClass, i);
+      }
+      return end();
+    }
+
+    bool SegregatedFreeList::contains(const Record &r) const
+    {
+      if (NOT_FREE == r.m_freeSlot)
+	return false;
+
+      const vector<Record *> &records = m_classes[classOf(r.size())];
+      return r.m_freeSlot < records.size() and &r == records[r.m_freeSlot];
+    }
+
+    void SegregatedFreeList::insert(Record *r)
+    {
+      assert(NULL != r and NOT_FREE == r->m_freeSlot);
+
+      size_t fl, sl;
+      mapping(r->size(), fl, sl);
+      vector<Record *> &records = m_classes[fl * SL_COUNT + sl];
+
+      r->m_freeSlot = records.size();
+      records.push_back(r);
+
+      m_firstLevel |= uint32_t(1) << fl;
+      m_secondLevel[fl] |= uint32_t(1) << sl;
+      ++m_size;
+    }
+
+    bool SegregatedFreeList::erase(Record *r)
+    {
+      if (not contains(*r))
+	return false;
+
+      remove(classOf(r->size()), r->m_freeSlot);
+      return true;
+    }
+
+    void SegregatedFreeList::remove(size_t sizeClass, size_t pos)
+    {
+      vector<Record *> &records = m_classes[sizeClass];
+      assert(pos < records.size());
+
+      Record *r = records[pos];
+      Record *last = records.back();
+      records[pos] = last;
+      last->m_freeSlot = pos;
+      records.pop_back();
+      r->m_freeSlot = NOT_FREE;
+
+      if (records.empty()) {
+	const size_t fl = sizeClass / SL_COUNT, sl = sizeClass % SL_COUNT;
+	m_secondLevel[fl] &= ~(uint32_t(1) << sl);
+	if (0 == m_secondLevel[fl])
+	  m_firstLevel &= ~(uint32_t(1) << fl);
+      }
+      --m_size;
+    }
+
+    Record *SegregatedFreeList::takeFit(uint32_t size)
+    {
+      const size_t sizeClass = classOf(size);
+
+      // A close fit from the last few Records of the class _size_ falls
+      // in, otherwise anything from the next non-empty class up, and as
+      // a last resort, before the caller has to grow the file, whatever
+      // fits in the class _size_ falls in.
+      Record *r = bestFit(sizeClass, size, MAX_SCAN);
+      if (NULL == r)
+	r = anyFromClassAbove(size);
+      if (NULL == r)
+	r = bestFit(sizeClass, size, m_classes[sizeClass].size());
+
+      assert(NULL == r or r->size() >= size);
+      return r;
+    }
+
+    Record *SegregatedFreeList::bestFit(size_t sizeClass, uint32_t size,
+					size_t maxScan)
+    {
+      const vector<Record *> &records = m_classes[sizeClass];
+      const size_t n = records.size();
+
+      size_t best = n;
+      for(size_t i = n; i > 0 and n - i < maxScan; --i) {
+	const uint32_t s = records[i - 1]->size();
+	if (s >= size and (best == n or s < records[best]->size()))
+	  best = i - 1;
+      }
+      if (best == n)
+	return NULL;
+
+      Record *r = records[best];
+      remove(sizeClass, best);
+      return r;
+    }
+
+    Record *SegregatedFreeList::anyFromClassAbove(uint32_t size)
+    {
+      size_t fl, sl;
+      mapping(roundUp(size), fl, sl);
+      if (fl >= FL_COUNT)
+	return NULL;
+
+      uint32_t slMap = m_secondLevel[fl] & (~uint32_t(0) << sl);
+      if (0 == slMap) {
+	const uint32_t flMap = m_firstLevel & (~uint32_t(0) << (fl + 1));
+	if (0 == flMap)
+	  return NULL;
+	fl = lowestBit(flMap);
+	slMap = m_secondLevel[fl];
+      }
+      sl = lowestBit(slMap);
+
+      const size_t sizeClass = fl * SL_COUNT + sl;
+      Record *r = m_classes[sizeClass].back();
+      remove(sizeClass, m_classes[sizeClass].size() - 1);
+      return r;
+    }
+
+    void SegregatedFreeList::clear()
+    {
+      for(size_t i = 0; i < NUM_CLASSES; ++i) {
+	for(size_t j = 0; j < m_classes[i].size(); ++j)
+	  m_classes[i][j]->m_freeSlot = NOT_FREE;
+	m_classes[i].clear();
+      }
+      m_firstLevel = 0;
+      m_secondLevel.assign(FL_COUNT, 0);
+      m_size = 0;
+    }
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
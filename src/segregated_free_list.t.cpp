@@ -0,0 +1,111 @@
+#include <segregated_free_list.h>
+#include <cstdlib>
+#include <heap_index.h>
+#include <map>
+#include <unit_test.h>
+#include <vector>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  void testSegregatedFreeListBasics(UnitTestControl &utc)
+  {
+    SegregatedFreeList list;
+    TEST_ASSERT(utc, list.empty());
+    TEST_ASSERT(utc, list.begin() == list.end());
+    TEST_ASSERT(utc, NULL == list.takeFit(1));
+
+    Record small(0, 0, 10), medium(10, 0, 300), large(310, 0, 5000);
+    list.insert(&large);
+    list.insert(&small);
+    list.insert(&medium);
+
+    TEST_ASSERT(utc, 3 == list.size());
+    TEST_ASSERT(utc, list.contains(small));
+    TEST_ASSERT(utc, not list.contains(Record(small))); // equal isn't enough
+    TEST_ASSERT(utc, list.find(300)->second == &medium);
+    TEST_ASSERT(utc, list.find(301) == list.end());
+
+    // iteration is by ascending size class
+    SegregatedFreeList::const_iterator itr = list.begin();
+    TEST_ASSERT(utc, itr->second == &small);
+    TEST_ASSERT(utc, (++itr)->second == &medium);
+    TEST_ASSERT(utc, (++itr)->first == 5000);
+    TEST_ASSERT(utc, ++itr == list.end());
+
+    // the smallest Record that fits
+    TEST_ASSERT(utc, list.takeFit(256) == &medium);
+    TEST_ASSERT(utc, not list.contains(medium));
+    TEST_ASSERT(utc, list.takeFit(301) == &large);
+    TEST_ASSERT(utc, NULL == list.takeFit(11));
+    TEST_ASSERT(utc, list.takeFit(10) == &small);
+    TEST_ASSERT(utc, list.empty());
+
+    list.insert(&small);
+    TEST_ASSERT(utc, list.erase(&small));
+    TEST_ASSERT(utc, not list.erase(&small));
+    TEST_ASSERT(utc, list.empty());
+  }
+
+  // Lots of free Records of the same size: everything stays O(1),
+  // takeFit never hands back something too small, and we never skip
+  // over a Record that fits.
+  void testSegregatedFreeListChurn(UnitTestControl &utc)
+  {
+    const size_t numRecords = 20000;
+    vector<Record> records;
+    records.reserve(numRecords);
+    for(size_t i = 0; i < numRecords; ++i)
+      records.push_back(Record(i, 0, (i % 2) ? 256 : 256 + rand() % 100000));
+
+    SegregatedFreeList list;
+    multimap<uint32_t, Record *> ref;
+    vector<bool> present(numRecords, false);
+
+    bool ok = true;
+    for(int round = 0; round < 100000; ++round) {
+      size_t i = rand() % numRecords;
+      if (not present[i]) {
+	list.insert(&records[i]);
+	ref.insert(make_pair(records[i].size(), &records[i]));
+	present[i] = true;
+	continue;
+      }
+
+      if (rand() % 2) {
+	ok = ok and list.erase(&records[i]);
+      } else {
+	uint32_t size = records[i].size();
+	Record *r = list.takeFit(size);
+	ok = ok and NULL != r and r->size() >= size;
+	i = r - &records[0];
+      }
+
+      multimap<uint32_t, Record *>::iterator itr = ref.lower_bound(records[i].size());
+      while(itr->second != &records[i])
+	++itr;
+      ref.erase(itr);
+      present[i] = false;
+    }
+    TEST_ASSERT(utc, ok);
+    TEST_ASSERT(utc, list.size() == ref.size());
+
+    for(size_t i = 0; i < numRecords; ++i)
+      ok = ok and present[i] == list.contains(records[i]);
+    TEST_ASSERT(utc, ok);
+
+    // a request for more than anything we've got fails
+    TEST_ASSERT(utc, NULL == list.takeFit(256 + 100000));
+
+    list.clear();
+    TEST_ASSERT(utc, list.empty());
+    TEST_ASSERT(utc, not list.contains(records[0]));
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testSegregatedFreeListBasics, &::testSegregatedFreeListBasics)
+REGISTER_TEST(testSegregatedFreeListChurn, &::testSegregatedFreeListChurn)
@@ -0,0 +1,359 @@
+#include <sharded_heap_file.h>
+#include <byte_order.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <heap_blob.h>
+#include <simple_encrypt.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace EndianUtils;
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+      const uint32_t MANIFEST_MAGIC = 0x53484431; // "SHD1"
+      const size_t MANIFEST_SIZE = 2 * sizeof(uint32_t);
+
+      void raise(const string &path, const char *action)
+      {
+	throw runtime_error("Failed " + string(action) + " " + path +
+			    " with error: " + strerror(errno));
+      }
+
+      string shardPath(const string &path, unsigned i)
+      {
+	ostringstream s;
+	s << path << '.' << i;
+	return s.str();
+      }
+
+      // The number of shards the manifest at _path_ lists, zero if
+      // there's no manifest.
+      unsigned readManifest(const string &path)
+      {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0 and ENOENT == errno)
+	  return 0;
+	if (fd < 0)
+	  raise(path, "opening");
+
+	uint8_t buffer[MANIFEST_SIZE];
+	const ssize_t n = pread(fd, buffer, sizeof(buffer), 0);
+	close(fd);
+	if (n < 0)
+	  raise(path, "reading");
+
+	const uint8_t *p = buffer;
+	uint32_t magic = 0, numShards = 0;
+	if (ssize_t(sizeof(buffer)) == n) {
+	  readN2H(p, magic);
+	  readN2H(p, numShards);
+	}
+	if (MANIFEST_MAGIC != magic or 0 == numShards)
+	  throw runtime_error(path + " isn't a shard manifest");
+	return numShards;
+      }
+
+      // Written to the side and renamed into place, so there's either
+      // a whole manifest at _path_ or none at all.
+      void writeManifest(const string &path, unsigned numShards)
+      {
+	uint8_t buffer[MANIFEST_SIZE];
+	uint8_t *p = buffer;
+	writeH2N(p, MANIFEST_MAGIC);
+	writeH2N(p, uint32_t(numShards));
+
+	const string tmpPath = path + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+		      S_IRUSR | S_IWUSR);
+	if (fd < 0)
+	  raise(tmpPath, "opening");
+	if (ssize_t(sizeof(buffer)) != pwrite(fd, buffer, sizeof(buffer), 0) or
+	    0 != fdatasync(fd)) {
+	  close(fd);
+	  raise(tmpPath, "writing");
+	}
+	close(fd);
+	if (0 != rename(tmpPath.c_str(), path.c_str()))
+	  raise(path, "writing");
+      }
+
+      // hash() is what a shard's index goes by, so the shard is picked
+      // by its high bits after mixing them up, leaving the index
+      // buckets within a shard as evenly used as they'd be w/o shards.
+      unsigned shardFor(uint32_t hashCode, size_t numShards)
+      {
+	hashCode ^= hashCode >> 16;
+	hashCode *= 0x85ebca6b;
+	hashCode ^= hashCode >> 13;
+	hashCode *= 0xc2b2ae35;
+	hashCode ^= hashCode >> 16;
+	return (uint64_t(hashCode) * numShards) >> 32;
+      }
+
+      /**
+       * Forwards what a shard's getBlobs() finds to the caller's
+       * MultiBlobReader, by its position in the whole batch and one
+       * shard at a time.
+       */
+      class SerialReader : public MultiBlobReader {
+      public:
+	SerialReader(const MultiBlobReader &reader, ThreadUtils::Mutex &mutex,
+		     const vector<size_t> &positions)
+	  : m_reader(reader), m_mutex(mutex), m_positions(positions)
+	{}
+
+	virtual void readBlob(size_t i, const uint8_t *blob, size_t size) const {
+	  ThreadUtils::MutexLock lock(m_mutex);
+	  m_reader.readBlob(m_positions[i], blob, size);
+	}
+
+      private:
+	const MultiBlobReader &m_reader;
+	ThreadUtils::Mutex &m_mutex;
+	const vector<size_t> &m_positions;
+      };
+
+      template<class Shard>
+      struct ShardReads : public ThreadUtils::Task {
+	ShardReads() : shard(NULL), reader(NULL), mutex(NULL), ids(),
+		       positions(), found(), numFound(0) {}
+
+	virtual void run() {
+	  numFound = shard->getBlobs(ids, SerialReader(*reader, *mutex, positions),
+				     found);
+	}
+
+	const Shard *shard;
+	const MultiBlobReader *reader;
+	ThreadUtils::Mutex *mutex;
+	vector<vector<uint8_t> > ids;
+	vector<size_t> positions; // of _ids_ in the whole batch
+	vector<bool> found;
+	size_t numFound;
+      };
+
+      template<class Shard>
+      struct ShardWrites : public ThreadUtils::Task {
+	ShardWrites() : shard(NULL), batch(), positions(), written(),
+			numWritten(0) {}
+
+	virtual void run() {
+	  numWritten = shard->writeBlobs(batch, written);
+	}
+
+	Shard *shard;
+	typename Shard::Batch batch;
+	vector<size_t> positions; // of _batch_ in the whole batch
+	vector<bool> written;
+	size_t numWritten;
+      };
+
+      template<class Shard>
+      struct ShardExpiry : public ThreadUtils::Task {
+	ShardExpiry(Shard &s) : shard(&s), numExpired(0) {}
+	virtual void run() { numExpired = shard->expireBlobs(); }
+
+	Shard *shard;
+	size_t numExpired;
+      };
+
+      template<class Shard>
+      struct ShardClear : public ThreadUtils::Task {
+	ShardClear(Shard &s) : shard(&s) {}
+	virtual void run() { shard->clear(); }
+
+	Shard *shard;
+      };
+
+      template<class Shard>
+      struct ShardMaxSize : public ThreadUtils::Task {
+	ShardMaxSize(Shard &s, uint64_t m) : shard(&s), maxSize(m) {}
+	virtual void run() { shard->setMaxSize(maxSize); }
+
+	Shard *shard;
+	uint64_t maxSize;
+      };
+
+      template<class T>
+      vector<ThreadUtils::Task *> tasksOf(vector<T> &tasks)
+      {
+	vector<ThreadUtils::Task *> ptrs;
+	for(size_t i = 0; i < tasks.size(); ++i)
+	  ptrs.push_back(&tasks[i]);
+	return ptrs;
+      }
+    } // end namespace <anonymous>
+
+    template<class EP>
+    ShardedHeapFileT<EP>::ShardedHeapFileT(const string &path, unsigned numShards,
+					   const vector<uint8_t> &key,
+					   const MmapFile::Options &fileOptions)
+      : m_shards(), m_pool()
+    {
+      const unsigned numListed = readManifest(path);
+      if (0 == numListed) {
+	if (0 == numShards)
+	  throw runtime_error("No shard manifest at " + path);
+	if (fileOptions.readOnly)
+	  throw runtime_error("Can't create shards for " + path + " read-only");
+	writeManifest(path, numShards);
+      }else if (0 != numShards and numShards != numListed) {
+	ostringstream s;
+	s << path << " has " << numListed << " shards, not " << numShards;
+	throw runtime_error(s.str());
+      }else {
+	numShards = numListed;
+      }
+
+      try {
+	for(unsigned i = 0; i < numShards; ++i)
+	  m_shards.push_back(new Shard(shardPath(path, i), key, fileOptions));
+	m_pool.reset(new ThreadUtils::WorkerPool(numShards - 1));
+      }catch(...) {
+	closeShards();
+	throw;
+      }
+    }
+
+    template<class EP>
+    ShardedHeapFileT<EP>::~ShardedHeapFileT()
+    {
+      closeShards();
+    }
+
+    template<class EP>
+    void ShardedHeapFileT<EP>::closeShards()
+    {
+      for(size_t i = 0; i < m_shards.size(); ++i)
+	delete m_shards[i];
+      m_shards.clear();
+    }
+
+    template<class EP>
+    unsigned ShardedHeapFileT<EP>::shardOf(const uint8_t *id, size_t idSize) const
+    {
+      return shardFor(hash(id, idSize), m_shards.size());
+    }
+
+    template<class EP>
+    uint64_t ShardedHeapFileT<EP>::size() const
+    {
+      uint64_t total = 0;
+      for(size_t i = 0; i < m_shards.size(); ++i)
+	total += m_shards[i]->size();
+      return total;
+    }
+
+    template<class EP>
+    size_t ShardedHeapFileT<EP>::getBlobs(const vector<vector<uint8_t> > &ids,
+					  const MultiBlobReader &reader,
+					  vector<bool> &found) const
+    {
+      if (1 == m_shards.size())
+	return m_shards[0]->getBlobs(ids, reader, found);
+
+      ThreadUtils::Mutex mutex;
+      vector<ShardReads<Shard> > reads(m_shards.size());
+      for(size_t s = 0; s < reads.size(); ++s) {
+	reads[s].shard = m_shards[s];
+	reads[s].reader = &reader;
+	reads[s].mutex = &mutex;
+      }
+      for(size_t i = 0; i < ids.size(); ++i) {
+	ShardReads<Shard> &r = reads[shardOf(ids[i])];
+	r.ids.push_back(ids[i]);
+	r.positions.push_back(i);
+      }
+
+      vector<ThreadUtils::Task *> tasks;
+      for(size_t s = 0; s < reads.size(); ++s) {
+	if (not reads[s].ids.empty())
+	  tasks.push_back(&reads[s]);
+      }
+      m_pool->run(tasks);
+
+      found.assign(ids.size(), false);
+      size_t numFound = 0;
+      for(size_t s = 0; s < reads.size(); ++s) {
+	for(size_t j = 0; j < reads[s].found.size(); ++j)
+	  found[reads[s].positions[j]] = reads[s].found[j];
+	numFound += reads[s].numFound;
+      }
+      return numFound;
+    }
+
+    template<class EP>
+    size_t ShardedHeapFileT<EP>::writeBlobs(const Batch &batch,
+					    vector<bool> &written)
+    {
+      if (1 == m_shards.size())
+	return m_shards[0]->writeBlobs(batch, written);
+
+      vector<ShardWrites<Shard> > writes(m_shards.size());
+      for(size_t s = 0; s < writes.size(); ++s)
+	writes[s].shard = m_shards[s];
+      for(size_t i = 0; i < batch.size(); ++i) {
+	ShardWrites<Shard> &w = writes[shardOf(batch[i].first)];
+	w.batch.push_back(batch[i]);
+	w.positions.push_back(i);
+      }
+
+      vector<ThreadUtils::Task *> tasks;
+      for(size_t s = 0; s < writes.size(); ++s) {
+	if (not writes[s].batch.empty())
+	  tasks.push_back(&writes[s]);
+      }
+      m_pool->run(tasks);
+
+      written.assign(batch.size(), false);
+      size_t numWritten = 0;
+      for(size_t s = 0; s < writes.size(); ++s) {
+	for(size_t j = 0; j < writes[s].written.size(); ++j)
+	  written[writes[s].positions[j]] = writes[s].written[j];
+	numWritten += writes[s].numWritten;
+      }
+      return numWritten;
+    }
+
+    template<class EP>
+    size_t ShardedHeapFileT<EP>::expireBlobs()
+    {
+      vector<ShardExpiry<Shard> > expiries;
+      for(size_t s = 0; s < m_shards.size(); ++s)
+	expiries.push_back(ShardExpiry<Shard>(*m_shards[s]));
+      m_pool->run(tasksOf(expiries));
+
+      size_t numExpired = 0;
+      for(size_t s = 0; s < expiries.size(); ++s)
+	numExpired += expiries[s].numExpired;
+      return numExpired;
+    }
+
+    template<class EP>
+    void ShardedHeapFileT<EP>::clear()
+    {
+      vector<ShardClear<Shard> > clears;
+      for(size_t s = 0; s < m_shards.size(); ++s)
+	clears.push_back(ShardClear<Shard>(*m_shards[s]));
+      m_pool->run(tasksOf(clears));
+    }
+
+    template<class EP>
+    void ShardedHeapFileT<EP>::setMaxSize(uint64_t maxSize)
+    {
+      vector<ShardMaxSize<Shard> > shares;
+      for(size_t s = 0; s < m_shards.size(); ++s)
+	shares.push_back(ShardMaxSize<Shard>(*m_shards[s], maxSize / m_shards.size()));
+      m_pool->run(tasksOf(shares));
+    }
+
+    template class ShardedHeapFileT<DefaultEncryptionPolicy>;
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
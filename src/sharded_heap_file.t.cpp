@@ -0,0 +1,195 @@
+#include <sharded_heap_file.h>
+#include <cstdio>
+#include <pthread.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <unit_test.h>
+#include <vector>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  typedef vector<uint8_t> Vec;
+
+  Vec idOf(size_t i)
+  {
+    Vec id(3);
+    id[0] = i;
+    id[1] = i >> 8;
+    id[2] = 's';
+    return id;
+  }
+
+  Vec blobOf(size_t i)
+  {
+    return Vec(50 + i % 100, static_cast<uint8_t>(i));
+  }
+
+  void removeShards(const string &path, unsigned numShards)
+  {
+    for(unsigned i = 0; i < numShards; ++i) {
+      char suffix[16];
+      sprintf(suffix, ".%u", i);
+      unlink((path + suffix).c_str());
+    }
+    unlink(path.c_str());
+  }
+
+  void testShardedHeapFileRouting(UnitTestControl &utc)
+  {
+    const string path = tmpnam(NULL);
+    const size_t NUM_BLOBS = 400;
+    {
+      ShardedHeapFile file(path, 4);
+      TEST_ASSERT(utc, 4 == file.numShards());
+      for(size_t i = 0; i < NUM_BLOBS; ++i)
+	TEST_ASSERT(utc, file.writeBlob(idOf(i), blobOf(i)));
+
+      uint64_t size = 0;
+      for(unsigned s = 0; s < file.numShards(); ++s) {
+	// every shard gets a fair share, and only what's routed to it
+	const uint32_t n = file.shard(s).getIndex().numAllocatedRecords();
+	TEST_ASSERT(utc, n > NUM_BLOBS / 8 and n < NUM_BLOBS / 2);
+	size += file.shard(s).size();
+      }
+      TEST_ASSERT(utc, size == file.size());
+      for(size_t i = 0; i < NUM_BLOBS; ++i)
+	TEST_ASSERT(utc, file.shard(file.shardOf(idOf(i))).hasBlob(idOf(i)));
+
+      Vec dataOut;
+      TEST_ASSERT(utc, file.eraseBlob(idOf(0)));
+      TEST_ASSERT(utc, not file.getBlob(idOf(0), dataOut));
+      TEST_ASSERT(utc, not file.hasBlob(idOf(0)));
+    }
+
+    // the manifest says how many there are
+    {
+      ShardedHeapFile file(path);
+      TEST_ASSERT(utc, 4 == file.numShards());
+      Vec dataOut;
+      for(size_t i = 1; i < NUM_BLOBS; ++i) {
+	TEST_ASSERT(utc, file.getBlob(idOf(i), dataOut));
+	TEST_ASSERT(utc, blobOf(i) == dataOut);
+      }
+    }
+
+    bool caught = false;
+    try {
+      ShardedHeapFile file(path, 3);
+    }catch(const std::runtime_error &) {
+      caught = true;
+    }
+    TEST_ASSERT(utc, caught);
+
+    removeShards(path, 4);
+    caught = false;
+    try {
+      ShardedHeapFile file(path); // no manifest, no shards
+    }catch(const std::runtime_error &) {
+      caught = true;
+    }
+    TEST_ASSERT(utc, caught);
+  }
+
+  struct Checker : public MultiBlobReader {
+    Checker(UnitTestControl &utc) : m_utc(utc), m_numRead(0) {}
+    virtual void readBlob(size_t i, const uint8_t *blob, size_t size) const {
+      TEST_ASSERT(m_utc, blobOf(i) == Vec(blob, blob + size));
+      ++m_numRead; // never from two threads at once
+    }
+    UnitTestControl &m_utc;
+    mutable size_t m_numRead;
+  };
+
+  void testShardedHeapFileBatches(UnitTestControl &utc)
+  {
+    const string path = tmpnam(NULL);
+    ShardedHeapFile file(path, 4);
+
+    ShardedHeapFile::Batch batch;
+    for(size_t i = 0; i < 300; ++i)
+      batch.push_back(make_pair(idOf(i), blobOf(i)));
+    batch.push_back(make_pair(Vec(Blob::MAX_ID_SIZE + 1, 'x'), Vec(1, 'x')));
+
+    vector<bool> written;
+    TEST_ASSERT(utc, 300 == file.writeBlobs(batch, written));
+    TEST_ASSERT(utc, 301 == written.size());
+    TEST_ASSERT(utc, written[0] and written[299] and not written[300]);
+
+    vector<Vec> ids;
+    for(size_t i = 0; i < 350; ++i)
+      ids.push_back(idOf(i));
+    vector<bool> found;
+    Checker checker(utc);
+    TEST_ASSERT(utc, 300 == file.getBlobs(ids, checker, found));
+    TEST_ASSERT(utc, 300 == checker.m_numRead);
+    TEST_ASSERT(utc, 350 == found.size());
+    TEST_ASSERT(utc, found[0] and found[299] and not found[300]);
+
+    // expiries, caps and clearing go to every shard
+    TEST_ASSERT(utc, file.writeBlob(idOf(1000), blobOf(0), 1));
+    TEST_ASSERT(utc, 1 == file.expireBlobs());
+
+    const uint64_t before = file.size();
+    file.setMaxSize(before / 2);
+    for(unsigned s = 0; s < file.numShards(); ++s)
+      TEST_ASSERT(utc, file.shard(s).size() <= before / 2 / file.numShards());
+
+    file.clear();
+    TEST_ASSERT(utc, 0 == file.getBlobs(ids, checker, found));
+    removeShards(path, 4);
+  }
+
+  struct Writer {
+    ShardedHeapFile *file;
+    size_t first;
+    size_t numMismatches;
+  };
+
+  void *writeConcurrently(void *arg)
+  {
+    Writer &writer = *static_cast<Writer *>(arg);
+    Vec dataOut;
+    for(size_t i = writer.first; i < writer.first + 200; ++i) {
+      writer.file->writeBlob(idOf(i), blobOf(i));
+      if (not writer.file->getBlob(idOf(i), dataOut) or blobOf(i) != dataOut)
+	++writer.numMismatches;
+    }
+    return NULL;
+  }
+
+  void testShardedHeapFileConcurrentWriters(UnitTestControl &utc)
+  {
+    const string path = tmpnam(NULL);
+    ShardedHeapFile file(path, 4);
+
+    const size_t NUM_WRITERS = 4;
+    Writer writers[NUM_WRITERS];
+    pthread_t threads[NUM_WRITERS];
+    for(size_t t = 0; t < NUM_WRITERS; ++t) {
+      Writer w = { &file, t * 200, 0 };
+      writers[t] = w;
+      TEST_ASSERT(utc, 0 == pthread_create(&threads[t], NULL, &writeConcurrently,
+					   &writers[t]));
+    }
+    for(size_t t = 0; t < NUM_WRITERS; ++t) {
+      TEST_ASSERT(utc, 0 == pthread_join(threads[t], NULL));
+      TEST_ASSERT(utc, 0 == writers[t].numMismatches);
+    }
+
+    Vec dataOut;
+    for(size_t i = 0; i < NUM_WRITERS * 200; ++i)
+      TEST_ASSERT(utc, file.getBlob(idOf(i), dataOut) and blobOf(i) == dataOut);
+    file.clear();
+    removeShards(path, 4);
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testShardedHeapFileRouting, &::testShardedHeapFileRouting)
+REGISTER_TEST(testShardedHeapFileBatches, &::testShardedHeapFileBatches)
+REGISTER_TEST(testShardedHeapFileConcurrentWriters, &::testShardedHeapFileConcurrentWriters)
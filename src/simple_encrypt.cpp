@@ -49,6 +49,15 @@ namespace Encryption {
   bool Simple<T>::decrypt(const T *in, T *out, std::size_t size) const {
     return XOR(m_key, in, out, size);
   }
+
+  template<typename T>
+  bool Simple<T>::isIdentity() const {
+    for(std::size_t i = 0; i < m_key.size(); ++i) {
+      if (T(0) != m_key[i])
+	return false;
+    }
+    return true;
+  }
   
   template class Simple<uint8_t>;
   template class Simple<uint16_t>;
@@ -40,6 +40,9 @@ namespace { // <anonymous>
     TEST_ASSERT(utc, datum == decrypted);
     TEST_ASSERT(utc, datum != encrypted);
 
+    TEST_ASSERT(utc, not eKey.isIdentity());
+    TEST_ASSERT(utc, Simple<uint8_t>(Bytes()).isIdentity());
+    TEST_ASSERT(utc, Simple<uint8_t>(Bytes(4, 0)).isIdentity());
   }
 
 } // end namespace <anonymous>
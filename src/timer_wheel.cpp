@@ -0,0 +1,122 @@
+#include <timer_wheel.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    namespace { // <anonymous>
+      const uint64_t SLOT_MASK = TimerWheel::SLOTS - 1;
+
+      // The number of seconds a slot of _level_ covers, as a power of two.
+      unsigned bitsOf(unsigned level)
+      {
+	return TimerWheel::SLOT_BITS * level;
+      }
+
+      bool startsSlot(uint64_t time, unsigned level)
+      {
+	return 0 == (time & ((uint64_t(1) << bitsOf(level)) - 1));
+      }
+    } // end namespace <anonymous>
+
+    const unsigned TimerWheel::LEVELS;
+    const unsigned TimerWheel::SLOT_BITS;
+    const unsigned TimerWheel::SLOTS;
+
+    TimerWheel::TimerWheel(uint64_t now)
+      : m_now(now), m_size(0)
+    {
+      clear(now);
+    }
+
+    void TimerWheel::clear(uint64_t now)
+    {
+      for(unsigned level = 0; level < LEVELS; ++level) {
+	for(unsigned slot = 0; slot < SLOTS; ++slot)
+	  Slot().swap(m_slots[level][slot]);
+	m_levelSizes[level] = 0;
+      }
+      Slot().swap(m_overdue);
+      Slot().swap(m_far);
+      m_now = now;
+      m_size = 0;
+    }
+
+    void TimerWheel::schedule(uint32_t key, uint64_t expiry)
+    {
+      place(Timer(key, expiry));
+      ++m_size;
+    }
+
+    // Files _t_ under the lowest level whose slots cover the stretch
+    // of time between now and when it expires.
+    void TimerWheel::place(const Timer &t)
+    {
+      if (t.second <= m_now) {
+	m_overdue.push_back(t);
+	return;
+      }
+
+      for(unsigned level = 0; level < LEVELS; ++level) {
+	if ((t.second >> bitsOf(level + 1)) != (m_now >> bitsOf(level + 1)))
+	  continue;
+	m_slots[level][(t.second >> bitsOf(level)) & SLOT_MASK].push_back(t);
+	++m_levelSizes[level];
+	return;
+      }
+      m_far.push_back(t);
+    }
+
+    // Moves the timers in the slot of _level_ that starts now down to
+    // the levels below.
+    void TimerWheel::cascade(unsigned level)
+    {
+      Slot timers;
+      timers.swap(m_slots[level][(m_now >> bitsOf(level)) & SLOT_MASK]);
+      m_levelSizes[level] -= timers.size();
+
+      for(size_t i = 0; i < timers.size(); ++i)
+	place(timers[i]);
+    }
+
+    void TimerWheel::advance(uint64_t now, vector<Timer> &due)
+    {
+      while (m_now < now) {
+	// skip ahead to the next slot w/ timers in it to cascade
+	unsigned empty = 0;
+	while (empty < LEVELS and 0 == m_levelSizes[empty])
+	  ++empty;
+	if (LEVELS == empty and m_far.empty()) {
+	  m_now = now;
+	  break;
+	}
+	uint64_t next = ((m_now >> bitsOf(empty)) + 1) << bitsOf(empty);
+	m_now = std::min(next, now);
+
+	if (startsSlot(m_now, LEVELS)) {
+	  Slot timers;
+	  timers.swap(m_far);
+	  for(size_t i = 0; i < timers.size(); ++i)
+	    place(timers[i]);
+	}
+
+	for(unsigned level = LEVELS - 1; level > 0; --level) {
+	  if (startsSlot(m_now, level))
+	    cascade(level);
+	}
+
+	Slot &slot = m_slots[0][m_now & SLOT_MASK];
+	m_levelSizes[0] -= slot.size();
+	m_size -= slot.size();
+	due.insert(due.end(), slot.begin(), slot.end());
+	slot.clear();
+      }
+
+      m_size -= m_overdue.size();
+      due.insert(due.end(), m_overdue.begin(), m_overdue.end());
+      m_overdue.clear();
+    }
+
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
@@ -0,0 +1,102 @@
+#include <timer_wheel.h>
+#include <cstdlib>
+#include <unit_test.h>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  typedef TimerWheel::Timer Timer;
+
+  void testTimerWheelFires(UnitTestControl &utc)
+  {
+    TimerWheel wheel(1000);
+    vector<Timer> due;
+
+    wheel.schedule(1, 1001);
+    wheel.schedule(2, 1005);
+    wheel.schedule(3, 1000 + 70);         // level 1
+    wheel.schedule(4, 1000 + 5000);       // level 2
+    wheel.schedule(5, 1000 + (1u << 25)); // past the top level
+    wheel.schedule(6, 900);               // already expired
+    TEST_ASSERT(utc, 6 == wheel.size());
+
+    wheel.advance(1000, due);
+    TEST_ASSERT(utc, 1 == due.size() and 6 == due[0].first);
+    TEST_ASSERT(utc, 5 == wheel.size());
+
+    due.clear();
+    wheel.advance(1004, due);
+    TEST_ASSERT(utc, 1 == due.size() and 1 == due[0].first);
+
+    due.clear();
+    wheel.advance(1069, due);
+    TEST_ASSERT(utc, 1 == due.size() and 2 == due[0].first);
+
+    due.clear();
+    wheel.advance(1070, due);
+    TEST_ASSERT(utc, 1 == due.size() and Timer(3, 1070) == due[0]);
+
+    // time doesn't go backwards
+    due.clear();
+    wheel.advance(10, due);
+    TEST_ASSERT(utc, due.empty() and 1070 == wheel.now());
+
+    wheel.advance(1000 + 5000, due);
+    TEST_ASSERT(utc, 1 == due.size() and 4 == due[0].first);
+
+    due.clear();
+    wheel.advance(1000 + (1u << 25) - 1, due);
+    TEST_ASSERT(utc, due.empty() and 1 == wheel.size());
+    wheel.advance(1000 + (1u << 25), due);
+    TEST_ASSERT(utc, 1 == due.size() and 5 == due[0].first);
+    TEST_ASSERT(utc, 0 == wheel.size());
+
+    wheel.schedule(7, wheel.now() + 10);
+    wheel.clear(5);
+    TEST_ASSERT(utc, 0 == wheel.size() and 5 == wheel.now());
+    due.clear();
+    wheel.advance(1u << 30, due);
+    TEST_ASSERT(utc, due.empty());
+  }
+
+  void testTimerWheelRandom(UnitTestControl &utc)
+  {
+    const uint64_t start = 1400000000;
+    TimerWheel wheel(start);
+    vector<uint64_t> expiries;
+
+    srand(3);
+    for(uint32_t key = 0; key < 10000; ++key) {
+      const uint64_t expiry = start + rand() % (1u << (6 * (rand() % 5 + 1)));
+      expiries.push_back(expiry);
+      wheel.schedule(key, expiry);
+    }
+
+    vector<Timer> due;
+    uint64_t now = start;
+    size_t numFired = 0;
+    bool onTime = true;
+    while (0 != wheel.size()) {
+      const uint64_t then = now;
+      now += rand() % 3000;
+      due.clear();
+      wheel.advance(now, due);
+      for(size_t i = 0; i < due.size(); ++i) {
+	const uint64_t expiry = expiries[due[i].first];
+	onTime = onTime and expiry == due[i].second and expiry <= now and
+	  (expiry > then or expiry == start);
+	expiries[due[i].first] = 0; // fire once
+      }
+      numFired += due.size();
+    }
+    TEST_ASSERT(utc, onTime);
+    TEST_ASSERT(utc, 10000 == numFired);
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testTimerWheelFires, &::testTimerWheelFires)
+REGISTER_TEST(testTimerWheelRandom, &::testTimerWheelRandom)
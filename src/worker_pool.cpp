@@ -0,0 +1,108 @@
+#include <worker_pool.h>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ThreadUtils {
+
+  WorkerPool::WorkerPool(unsigned numThreads)
+    : m_mutex(), m_wakeUp(), m_finished(), m_batches(), m_stop(false),
+      m_threads()
+  {
+    for(unsigned i = 0; i < numThreads; ++i) {
+      pthread_t thread;
+      if (0 != pthread_create(&thread, NULL, &WorkerPool::work, this)) {
+	stop(); // the ones already started
+	throw runtime_error("Failed to start a worker thread");
+      }
+      m_threads.push_back(thread);
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    stop();
+  }
+
+  void WorkerPool::stop()
+  {
+    {
+      MutexLock lock(m_mutex);
+      m_stop = true;
+      m_wakeUp.broadcast();
+    }
+    for(size_t i = 0; i < m_threads.size(); ++i)
+      pthread_join(m_threads[i], NULL);
+    m_threads.clear();
+  }
+
+  // Takes the next Task of _batch_ and runs it w/o holding m_mutex,
+  // which the caller does.  Returns false if they've all been taken.
+  bool WorkerPool::runOne(Batch &batch)
+  {
+    if (batch.next == batch.tasks.size())
+      return false;
+
+    Task *task = batch.tasks[batch.next++];
+    if (batch.next == batch.tasks.size())
+      m_batches.erase(std::find(m_batches.begin(), m_batches.end(), &batch));
+
+    string error;
+    bool failed = false;
+    m_mutex.unlock();
+    try {
+      task->run();
+    }catch(const std::exception &e) {
+      failed = true;
+      error = e.what();
+    }catch(...) {
+      failed = true;
+      error = "Unknown exception in a Task";
+    }
+    m_mutex.lock();
+
+    if (failed and not batch.failed) {
+      batch.failed = true;
+      batch.error = error;
+    }
+    if (0 == --batch.pending)
+      m_finished.broadcast();
+    return true;
+  }
+
+  void *WorkerPool::work(void *p)
+  {
+    WorkerPool &pool = *static_cast<WorkerPool *>(p);
+    MutexLock lock(pool.m_mutex);
+    for(;;) {
+      while (not pool.m_stop and pool.m_batches.empty())
+	pool.m_wakeUp.wait(pool.m_mutex);
+      if (pool.m_batches.empty())
+	break; // stopped
+      pool.runOne(*pool.m_batches.front());
+    }
+    return NULL;
+  }
+
+  void WorkerPool::run(const vector<Task *> &tasks)
+  {
+    if (tasks.empty())
+      return;
+
+    Batch batch(tasks);
+    MutexLock lock(m_mutex);
+    m_batches.push_back(&batch);
+    if (tasks.size() > 1)
+      m_wakeUp.broadcast();
+
+    while (runOne(batch))
+      ;
+    while (0 != batch.pending)
+      m_finished.wait(m_mutex);
+
+    if (batch.failed)
+      throw runtime_error(batch.error);
+  }
+
+} // end namespace ThreadUtils
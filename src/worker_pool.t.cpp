@@ -0,0 +1,125 @@
+#include <worker_pool.h>
+#include <pthread.h>
+#include <stdexcept>
+#include <unit_test.h>
+
+using namespace std;
+using namespace ThreadUtils;
+
+namespace { // <anonymous>
+
+  struct Counter : public Task {
+    Counter() : thread(), numRuns(0) {}
+    virtual void run() {
+      thread = pthread_self();
+      ++numRuns;
+    }
+
+    pthread_t thread;
+    int numRuns;
+  };
+
+  struct Thrower : public Task {
+    virtual void run() { throw runtime_error("thrown"); }
+  };
+
+  void testWorkerPoolRun(UnitTestControl &utc)
+  {
+    WorkerPool pool(3);
+    TEST_ASSERT(utc, 3 == pool.numThreads());
+
+    vector<Counter> records(100);
+    vector<Task *> tasks;
+    for(size_t i = 0; i < records.size(); ++i)
+      tasks.push_back(&records[i]);
+    pool.run(tasks);
+    for(size_t i = 0; i < records.size(); ++i)
+      TEST_ASSERT(utc, 1 == records[i].numRuns);
+
+    pool.run(vector<Task *>()); // nothing to do
+
+    // a batch of one runs in the caller
+    pool.run(vector<Task *>(1, &records[0]));
+    TEST_ASSERT(utc, 2 == records[0].numRuns);
+    TEST_ASSERT(utc, pthread_equal(pthread_self(), records[0].thread));
+  }
+
+  void testWorkerPoolNoThreads(UnitTestControl &utc)
+  {
+    WorkerPool pool(0);
+    vector<Counter> records(10);
+    vector<Task *> tasks;
+    for(size_t i = 0; i < records.size(); ++i)
+      tasks.push_back(&records[i]);
+    pool.run(tasks);
+    for(size_t i = 0; i < records.size(); ++i) {
+      TEST_ASSERT(utc, 1 == records[i].numRuns);
+      TEST_ASSERT(utc, pthread_equal(pthread_self(), records[i].thread));
+    }
+  }
+
+  void testWorkerPoolExceptions(UnitTestControl &utc)
+  {
+    WorkerPool pool(2);
+    Counter before, after;
+    Thrower thrower;
+    vector<Task *> tasks;
+    tasks.push_back(&before);
+    tasks.push_back(&thrower);
+    tasks.push_back(&after);
+
+    bool caught = false;
+    try {
+      pool.run(tasks);
+    }catch(const runtime_error &e) {
+      caught = string("thrown") == e.what();
+    }
+    TEST_ASSERT(utc, caught);
+    TEST_ASSERT(utc, 1 == before.numRuns and 1 == after.numRuns);
+
+    // and it's still good for more
+    pool.run(vector<Task *>(1, &before));
+    TEST_ASSERT(utc, 2 == before.numRuns);
+  }
+
+  struct Caller {
+    WorkerPool *pool;
+    vector<Counter> records;
+  };
+
+  void *callPool(void *arg)
+  {
+    Caller &caller = *static_cast<Caller *>(arg);
+    vector<Task *> tasks;
+    for(size_t i = 0; i < caller.records.size(); ++i)
+      tasks.push_back(&caller.records[i]);
+    for(int n = 0; n < 50; ++n)
+      caller.pool->run(tasks);
+    return NULL;
+  }
+
+  void testWorkerPoolConcurrentCallers(UnitTestControl &utc)
+  {
+    WorkerPool pool(2);
+    const size_t NUM_CALLERS = 4;
+    Caller callers[NUM_CALLERS];
+    pthread_t threads[NUM_CALLERS];
+    for(size_t t = 0; t < NUM_CALLERS; ++t) {
+      callers[t].pool = &pool;
+      callers[t].records.resize(20);
+      TEST_ASSERT(utc, 0 == pthread_create(&threads[t], NULL, &callPool,
+					   &callers[t]));
+    }
+    for(size_t t = 0; t < NUM_CALLERS; ++t) {
+      TEST_ASSERT(utc, 0 == pthread_join(threads[t], NULL));
+      for(size_t i = 0; i < callers[t].records.size(); ++i)
+	TEST_ASSERT(utc, 50 == callers[t].records[i].numRuns);
+    }
+  }
+
+} // end namespace <anonymous>
+
+REGISTER_TEST(testWorkerPoolRun, &::testWorkerPoolRun)
+REGISTER_TEST(testWorkerPoolNoThreads, &::testWorkerPoolNoThreads)
+REGISTER_TEST(testWorkerPoolExceptions, &::testWorkerPoolExceptions)
+REGISTER_TEST(testWorkerPoolConcurrentCallers, &::testWorkerPoolConcurrentCallers)
@@ -0,0 +1,333 @@
+#include <write_ahead_log.h>
+#include <byte_order.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <heap_blob.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace EndianUtils;
+using namespace std;
+
+namespace FileUtils {
+  namespace StructuredFiles {
+    const std::size_t WriteAheadLog::ENTRY_SIZE =
+      sizeof(uint8_t) + Record::SERIALIZED_SIZE + sizeof(uint64_t);
+
+    namespace { // <anonymous>
+      // what a change is, the first byte of its entry
+      const uint8_t ADDED = '+';
+      const uint8_t DROPPED = '-';
+      const uint8_t EXPIRY_CHANGED = 'e';
+      const uint8_t CLEARED = 'c';
+
+      // size, hash and base
+      const std::size_t FRAME_HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+      // the hash covers the base and the changes
+      const std::size_t HASHED_FROM = 2 * sizeof(uint32_t);
+
+      void raise(const string &path, const char *action)
+      {
+	throw runtime_error("Failed " + string(action) + " " + path +
+			    " with error: " + strerror(errno));
+      }
+
+      // A new file is only sure to be there after a crash once the
+      // directory it's in has been synced too.
+      void syncDirectory(const string &path)
+      {
+	const string::size_type slash = path.rfind('/');
+	const string dir = (string::npos == slash) ? "." : path.substr(0, slash + 1);
+	int fd = open(dir.c_str(), O_RDONLY);
+	if (fd < 0)
+	  raise(dir, "opening");
+	const int err = fsync(fd);
+	close(fd);
+	if (0 != err)
+	  raise(dir, "syncing");
+      }
+    } // end namespace <anonymous>
+
+    WriteAheadLog::WriteAheadLog(const string &path, const MmapFile &file,
+				 uint64_t base)
+      : m_path(path), m_file(file), m_fd(-1), m_staged(), m_mutex(),
+	m_written(), m_queued(), m_base(base), m_numQueued(0), m_numSynced(0),
+	m_size(0), m_isSyncing(false), m_numSyncs(0), m_thread(),
+	m_isThreadRunning(false), m_stopThread(false), m_intervalMillis(0),
+	m_wakeUp()
+    {
+      m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+      if (m_fd < 0)
+	raise(path, "opening");
+      try {
+	if (0 != fdatasync(m_fd))
+	  raise(path, "syncing");
+	syncDirectory(path);
+      }catch(...) {
+	close(m_fd);
+	throw;
+      }
+    }
+
+    WriteAheadLog::~WriteAheadLog()
+    {
+      stopSyncing();
+      close(m_fd);
+    }
+
+    void WriteAheadLog::stage(uint8_t change, const Record &r, uint64_t expiry)
+    {
+      const std::size_t size = m_staged.size();
+      m_staged.resize(size + ENTRY_SIZE);
+      char *p = &m_staged[size];
+      writeH2N(p, change);
+      r.serialize(p);
+      writeH2N(p, expiry);
+    }
+
+    void WriteAheadLog::added(const Record &r)
+    {
+      stage(ADDED, r, 0);
+    }
+
+    void WriteAheadLog::dropped(const Record &r)
+    {
+      stage(DROPPED, r, 0);
+    }
+
+    void WriteAheadLog::expiryChanged(const Record &r)
+    {
+      stage(EXPIRY_CHANGED, r, r.expiry());
+    }
+
+    void WriteAheadLog::cleared()
+    {
+      stage(CLEARED, Record(), 0);
+    }
+
+    // Every call counts, changes or not: a Blob overwritten in place
+    // changes nothing in the index, but it still has to be synced.
+    uint64_t WriteAheadLog::append()
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      m_queued.insert(m_queued.end(), m_staged.begin(), m_staged.end());
+      m_staged.clear();
+      return ++m_numQueued;
+    }
+
+    void WriteAheadLog::sync(uint64_t position)
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      while (m_numSynced < position) {
+	if (m_isSyncing)
+	  m_written.wait(m_mutex);
+	else
+	  writeOut();
+      }
+    }
+
+    // Writes everything queued as one frame and syncs it, w/ m_mutex
+    // held, except while it's at it.  Whoever comes to sync meanwhile
+    // waits on m_written.  W/ nothing but Blobs to sync, no frame's
+    // written.
+    void WriteAheadLog::writeOut()
+    {
+      std::vector<char> frame(FRAME_HEADER_SIZE);
+      frame.insert(frame.end(), m_queued.begin(), m_queued.end());
+      char *p = &frame[0];
+      writeH2N(p, uint32_t(m_queued.size()));
+      p += sizeof(uint32_t); // the hash goes here
+      writeH2N(p, m_base);
+      p = &frame[sizeof(uint32_t)];
+      writeH2N(p, hash(reinterpret_cast<const uint8_t *>(&frame[HASHED_FROM]),
+		       frame.size() - HASHED_FROM));
+
+      const uint64_t upTo = m_numQueued;
+      const uint64_t at = m_size;
+      const bool hasChanges = not m_queued.empty();
+      m_queued.clear();
+      m_isSyncing = true;
+
+      m_mutex.unlock();
+      std::string error;
+      try {
+	m_file.sync(); // the Blobs first
+	if (hasChanges and
+	    (ssize_t(frame.size()) != pwrite(m_fd, &frame[0], frame.size(), at) or
+	     0 != fdatasync(m_fd)))
+	  raise(m_path, "writing");
+      }catch(const std::exception &e) {
+	error = e.what();
+      }
+      m_mutex.lock();
+
+      m_isSyncing = false;
+      m_written.broadcast();
+      if (not error.empty()) {
+	// back in front of whatever's been queued since
+	m_queued.insert(m_queued.begin(), frame.begin() + FRAME_HEADER_SIZE,
+			frame.end());
+	throw runtime_error(error);
+      }
+
+      if (hasChanges)
+	m_size += frame.size();
+      m_numSynced = upTo;
+      ++m_numSyncs;
+    }
+
+    void WriteAheadLog::reset(uint64_t base)
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      while (m_isSyncing)
+	m_written.wait(m_mutex);
+
+      m_staged.clear();
+      m_queued.clear();
+      m_numSynced = m_numQueued;
+      m_base = base;
+      m_written.broadcast();
+
+      if (0 != ftruncate(m_fd, 0) or 0 != fdatasync(m_fd))
+	raise(m_path, "truncating");
+      m_size = 0;
+    }
+
+    uint64_t WriteAheadLog::size() const
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      return m_size + m_queued.size() + m_staged.size();
+    }
+
+    uint64_t WriteAheadLog::numSyncs() const
+    {
+      ThreadUtils::MutexLock lock(m_mutex);
+      return m_numSyncs;
+    }
+
+    void WriteAheadLog::syncEvery(unsigned intervalMillis)
+    {
+      stopSyncing();
+      if (0 == intervalMillis)
+	return;
+
+      ThreadUtils::MutexLock lock(m_mutex);
+      m_intervalMillis = intervalMillis;
+      m_stopThread = false;
+      if (0 != pthread_create(&m_thread, NULL, &WriteAheadLog::runSyncing, this))
+	throw runtime_error("Failed to start the syncing thread");
+      m_isThreadRunning = true;
+    }
+
+    void WriteAheadLog::stopSyncing()
+    {
+      {
+	ThreadUtils::MutexLock lock(m_mutex);
+	if (not m_isThreadRunning)
+	  return;
+	m_stopThread = true;
+	m_wakeUp.signal();
+      }
+
+      pthread_join(m_thread, NULL);
+
+      ThreadUtils::MutexLock lock(m_mutex);
+      m_isThreadRunning = false;
+    }
+
+    void *WriteAheadLog::runSyncing(void *p)
+    {
+      WriteAheadLog &log = *static_cast<WriteAheadLog *>(p);
+      ThreadUtils::MutexLock lock(log.m_mutex);
+
+      while (not log.m_stopThread) {
+	log.m_wakeUp.wait(log.m_mutex, log.m_intervalMillis);
+	if (log.m_stopThread or log.m_isSyncing or
+	    log.m_numSynced == log.m_numQueued)
+	  continue;
+
+	try {
+	  log.writeOut();
+	}catch(const std::exception &e) {
+	  // it's still queued for the next time
+	}
+      }
+      return NULL;
+    }
+
+    void WriteAheadLog::read(const string &path, uint64_t base,
+			     std::vector<char> &entries)
+    {
+      entries.clear();
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0 and ENOENT == errno)
+	return;
+      if (fd < 0)
+	raise(path, "opening");
+
+      struct stat st;
+      std::vector<char> log;
+      if (0 == fstat(fd, &st))
+	log.resize(st.st_size);
+      if (log.empty() or ssize_t(log.size()) != pread(fd, &log[0], log.size(), 0)) {
+	close(fd);
+	return; // nothing there, or nothing we can use
+      }
+      close(fd);
+
+      for(std::size_t at = 0; at + FRAME_HEADER_SIZE <= log.size(); ) {
+	const char *p = &log[at];
+	uint32_t size = 0, hashCode = 0;
+	uint64_t frameBase = 0;
+	readN2H(p, size);
+	readN2H(p, hashCode);
+	readN2H(p, frameBase);
+	if (frameBase != base or 0 != size % ENTRY_SIZE or
+	    size > log.size() - at - FRAME_HEADER_SIZE)
+	  break;
+	if (hashCode != hash(reinterpret_cast<const uint8_t *>(&log[at + HASHED_FROM]),
+			     FRAME_HEADER_SIZE - HASHED_FROM + size))
+	  break;
+
+	entries.insert(entries.end(), p, p + size);
+	at += FRAME_HEADER_SIZE + size;
+      }
+    }
+
+    void WriteAheadLog::replay(const std::vector<char> &entries, Records &records)
+    {
+      if (entries.empty())
+	return;
+
+      const char *end = &entries[0] + entries.size();
+      for(const char *p = &entries[0]; p < end; ) {
+	uint8_t change = 0;
+	uint64_t expiry = 0;
+	readN2H(p, change);
+	const Record r(p); // advances p
+	readN2H(p, expiry);
+
+	const std::pair<uint64_t, bool> key(r.offset(), not r.isSlab());
+	if (ADDED == change) {
+	  records[key] = std::make_pair(r, uint64_t(0));
+	}else if (DROPPED == change and r.isSlab()) { // w/ its slots
+	  const std::pair<uint64_t, bool> slabEnd(r.offset() + r.size(), false);
+	  records.erase(records.lower_bound(key), records.lower_bound(slabEnd));
+	}else if (DROPPED == change) {
+	  records.erase(key);
+	}else if (EXPIRY_CHANGED == change) {
+	  Records::iterator itr = records.find(key);
+	  if (records.end() != itr)
+	    itr->second.second = expiry;
+	}else if (CLEARED == change) {
+	  records.clear();
+	}else {
+	  throw runtime_error("Unknown change in a write-ahead log");
+	}
+      }
+    }
+  } // end namespace StructuredFiles
+} // end namespace FileUtils
@@ -0,0 +1,173 @@
+#include <write_ahead_log.h>
+#include <fcntl.h>
+#include <heap_slab.h>
+#include <mutex.h>
+#include <pthread.h>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <unit_test.h>
+#include <vector>
+
+using namespace std;
+using namespace FileUtils;
+using namespace FileUtils::StructuredFiles;
+
+namespace { // <anonymous>
+
+  void testWriteAheadLogReplay(UnitTestControl &utc)
+  {
+    const string tmpFileName = tmpnam(NULL);
+    const string logName = tmpFileName + ".wal";
+    MmapFile file(tmpFileName);
+    WriteAheadLog log(logName, file, 64);
+    HeapIndex index;
+    index.setSlabThreshold(100);
+    index.setJournal(&log);
+
+    const Record *a = index.extend(8, 300, 0xa);
+    const Record *slot = index.extend(8 + 300, 50, 0xb); // w/ a Slab
+    const Record *other = index.allocate(50, 0xc);       // in the same one
+    index.setExpiry(*a, 1000);
+    log.sync(log.append());
+    TEST_ASSERT(utc, 1 == log.numSyncs());
+
+    vector<char> entries;
+    WriteAheadLog::read(logName, 65, entries); // another index's
+    TEST_ASSERT(utc, entries.empty());
+    WriteAheadLog::read(logName, 64, entries);
+    TEST_ASSERT(utc, 5 * WriteAheadLog::ENTRY_SIZE == entries.size());
+
+    WriteAheadLog::Records records;
+    WriteAheadLog::replay(entries, records);
+    TEST_ASSERT(utc, 4 == records.size());
+    WriteAheadLog::Records::const_iterator itr = records.begin();
+    TEST_ASSERT(utc, *a == itr->second.first and 1000 == itr->second.second);
+    ++itr;
+    TEST_ASSERT(utc, itr->second.first.isSlab() and 8 + 300 == itr->second.first.offset());
+    ++itr;
+    TEST_ASSERT(utc, *slot == itr->second.first and 0 == itr->second.second);
+    ++itr;
+    TEST_ASSERT(utc, *other == itr->second.first);
+
+    // the Slab goes w/ its last slot, in a frame of its own
+    index.deallocate(*slot);
+    index.deallocate(*other);
+    log.sync(log.append());
+    TEST_ASSERT(utc, 2 == log.numSyncs());
+
+    // what a crash cuts short is left out
+    {
+      int fd = open(logName.c_str(), O_WRONLY | O_APPEND);
+      TEST_ASSERT(utc, 0 <= fd);
+      const char torn[] = "\0\0\0\x19garbage";
+      TEST_ASSERT(utc, ssize_t(sizeof(torn)) == write(fd, torn, sizeof(torn)));
+      close(fd);
+    }
+    WriteAheadLog::read(logName, 64, entries);
+    TEST_ASSERT(utc, 8 * WriteAheadLog::ENTRY_SIZE == entries.size());
+    records.clear();
+    WriteAheadLog::replay(entries, records);
+    TEST_ASSERT(utc, 1 == records.size());
+    TEST_ASSERT(utc, *a == records.begin()->second.first);
+
+    // syncing w/ no changes writes no frame
+    const uint64_t size = log.size();
+    log.sync(log.append());
+    TEST_ASSERT(utc, 3 == log.numSyncs() and size == log.size());
+
+    // starting over
+    index.extend(8 + 300, 300, 0xd);
+    log.append();
+    TEST_ASSERT(utc, 0 != log.size());
+    log.reset(72);
+    TEST_ASSERT(utc, 0 == log.size());
+    WriteAheadLog::read(logName, 64, entries);
+    TEST_ASSERT(utc, entries.empty());
+
+    index.clear();
+    log.sync(log.append());
+    WriteAheadLog::read(logName, 72, entries);
+    TEST_ASSERT(utc, WriteAheadLog::ENTRY_SIZE == entries.size());
+    records.clear();
+    records[make_pair(uint64_t(8), true)] = make_pair(Record(8, 1, 300), uint64_t(0));
+    WriteAheadLog::replay(entries, records);
+    TEST_ASSERT(utc, records.empty());
+
+    index.setJournal(NULL);
+    unlink(tmpFileName.c_str());
+    unlink(logName.c_str());
+  }
+
+  // A writer: stages a change w/ the lock held, the way a HeapFile
+  // would, and waits for it outside of it.
+  struct Writer {
+    WriteAheadLog *log;
+    ThreadUtils::Mutex *lock;
+    uint64_t offset;
+    int numWrites;
+  };
+
+  void *write(void *arg)
+  {
+    Writer &w = *static_cast<Writer *>(arg);
+    for(int i = 0; i < w.numWrites; ++i) {
+      uint64_t position = 0;
+      {
+	ThreadUtils::MutexLock lock(*w.lock);
+	w.log->added(Record(w.offset + i * Record::MIN_SIZE, i, Record::MIN_SIZE));
+	position = w.log->append();
+      }
+      w.log->sync(position);
+    }
+    return NULL;
+  }
+
+  void testWriteAheadLogGroupSync(UnitTestControl &utc)
+  {
+    const string tmpFileName = tmpnam(NULL);
+    const string logName = tmpFileName + ".wal";
+    MmapFile file(tmpFileName);
+    {
+      WriteAheadLog log(logName, file, 0);
+      ThreadUtils::Mutex lock;
+
+      const int numThreads = 8, numWrites = 50;
+      vector<Writer> writers(numThreads);
+      vector<pthread_t> threads(numThreads);
+      for(int t = 0; t < numThreads; ++t) {
+	Writer w = {&log, &lock, uint64_t(t) << 32, numWrites};
+	writers[t] = w;
+	TEST_ASSERT(utc, 0 == pthread_create(&threads[t], NULL, &write, &writers[t]));
+      }
+      for(int t = 0; t < numThreads; ++t)
+	pthread_join(threads[t], NULL);
+
+      // however they were grouped, every one of them made it
+      TEST_ASSERT(utc, log.numSyncs() <= uint64_t(numThreads * numWrites));
+      vector<char> entries;
+      WriteAheadLog::read(logName, 0, entries);
+      WriteAheadLog::Records records;
+      WriteAheadLog::replay(entries, records);
+      TEST_ASSERT(utc, size_t(numThreads * numWrites) == records.size());
+
+      // the syncing thread catches up on its own
+      const uint64_t numSyncs = log.numSyncs();
+      log.added(Record(8, 1, Record::MIN_SIZE));
+      log.append();
+      log.syncEvery(1);
+      for(int i = 0; i < 1000 and numSyncs == log.numSyncs(); ++i)
+	usleep(1000);
+      TEST_ASSERT(utc, numSyncs + 1 == log.numSyncs());
+      WriteAheadLog::read(logName, 0, entries);
+      TEST_ASSERT(utc, size_t(numThreads * numWrites + 1) * WriteAheadLog::ENTRY_SIZE ==
+		  entries.size());
+      log.syncEvery(0);
+    }
+    unlink(tmpFileName.c_str());
+    unlink(logName.c_str());
+  }
+} // end namespace <anonymous>
+
+REGISTER_TEST(testWriteAheadLogReplay, &::testWriteAheadLogReplay)
+REGISTER_TEST(testWriteAheadLogGroupSync, &::testWriteAheadLogGroupSync)